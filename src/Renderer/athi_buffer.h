@@ -82,7 +82,7 @@ struct Buffer {
   Buffer() = default;
   ~Buffer();
 
-  void update(const string& name, void* data, size_t data_size) noexcept {
+  void update(const string& name, const void* data, size_t data_size) noexcept {
     glBindVertexArray(vao);
     check_gl_error();
 
@@ -104,7 +104,7 @@ struct Buffer {
       check_gl_error();
       vbo.data_size = data_size;
     } else {
-      glBufferSubData(vbo.type, 0, vbo.data_size, data);
+      glBufferSubData(vbo.type, 0, data_size, data);
       check_gl_error();
     }
   }
@@ -131,7 +131,7 @@ struct Buffer {
       glBufferData(vbo.type, data_size, static_cast<const GLvoid*>(data.data()), vbo.usage); check_gl_error();
       vbo.data_size = data_size;
     } else {
-      glBufferSubData(vbo.type, 0, vbo.data_size, static_cast<const GLvoid*>(data.data())); check_gl_error();
+      glBufferSubData(vbo.type, 0, data_size, static_cast<const GLvoid*>(data.data())); check_gl_error();
     }
   }
 
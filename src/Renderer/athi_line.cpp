@@ -19,7 +19,7 @@
 // DEALINGS IN THE SOFTWARE.
 
 #include "athi_line.h"
-#include "../athi_utility.h" // profile
+#include "../athi_profiler.h" // ATHI_PROFILE
 
 #include "athi_renderer.h"      // Shader
 #include "../Utility/threadsafe_container.h" // ThreadSafe::vector
@@ -63,6 +63,7 @@ void init_line_renderer() noexcept
 
 void render_lines() noexcept
 {
+  ATHI_PROFILE("render_lines");
   if (line_buffer.empty()) return;
 
   if (positions.size() < line_buffer.size())
@@ -26,7 +26,7 @@
 #include "athi_line.h"   // draw_line
 #include "athi_circle.h"   // draw_circle
 
-#include "../athi_utility.h"   // profile
+#include "../athi_profiler.h"   // ATHI_PROFILE
 #include "../athi_transform.h" // Transform
 #include "../Utility/threadsafe_container.h" // ThreadSafe::vector
 
@@ -59,6 +59,7 @@ void init_rect_renderer() noexcept
 
 void render_rects() noexcept
 {
+  ATHI_PROFILE("render_rects");
   if (rect_buffer.empty()) return;
 
   if (models.size() < rect_buffer.size()) {
@@ -25,6 +25,7 @@
 #include "athi_shader.h" // Shader
 #include "athi_buffer.h" // Buffer
 #include "athi_commandbuffer.h" // CommandBuffer
+#include "../Utility/athi_span.h" // Span
 
 #include "../athi_settings.h"  // console
 #include "../athi_utility.h"  // read_file
@@ -65,12 +66,20 @@ struct Renderer
     buffer.update(name, data);
   }
 
-  void update_buffer(const string& name, void* data, size_t data_size) noexcept
+  void update_buffer(const string& name, const void* data, size_t data_size) noexcept
   {
     buffer.bind();
     buffer.update(name, data, data_size);
   }
 
+  // Uploads straight from a ParticleStore field, or any other span.
+  template <class T>
+  void update_buffer(const string& name, Span<T> data) noexcept
+  {
+    buffer.bind();
+    buffer.update(name, data.data(), data.size_in_bytes());
+  }
+
   Vbo& make_buffer(const string& name) noexcept;
 
   void finish() noexcept;
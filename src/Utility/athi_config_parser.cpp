@@ -43,6 +43,7 @@ static const string default_config =
 "color_by_velocity_threshold             : 0.002000\n"
 "\n"
 "random_velocity_force                   : 10.000000\n"
+"particle_lifetime                       : 0.000000\n"
 "\n"
 "circle_size                             : 45.060001\n"
 "circle_color                            : vec4(0.069776, 0.924528, 0.198796, 1.000000)\n"
@@ -55,8 +56,13 @@ static const string default_config =
 "gravity                                 : 10.981000\n"
 "time_scale                              : 1.000000\n"
 "use_gravitational_force                 : NO\n"
+"use_barnes_hut                          : YES\n"
+"barnes_hut_theta                        : 0.500000\n"
 "air_resistance                          : 0.990000\n"
 "physics_samples                         : 1.000000\n"
+"physics_tick_rate                       : 60.000000\n"
+"max_substeps                            : 8.000000\n"
+"interpolate_positions                   : YES\n"
 "\n"
 "# ------- Tree options -------\n"
 "\n"
@@ -66,9 +72,10 @@ static const string default_config =
 "quadtree_capacity                       : 100.000000\n"
 "quadtree_depth                          : 10.000000\n"
 "\n"
-"use_uniformgrid                         : NO\n"
-"uniformgrid_parts                       : 4.000000\n"
+"reorder_interval                        : 60.000000\n"
 "\n"
+"use_uniformgrid                         : NO\n"
+"use_sweep_and_prune                     : NO\n"
 "\n"
 "# ---------------- Render options ----------------\n"
 "\n"
@@ -106,6 +113,7 @@ static const string default_config =
 "draw_debug                              : 0.000000\n"
 "wireframe_mode                          : YES\n"
 "quadtree_show_only_occupied             : YES\n"
+"dump_critical_path                      : NO\n"
 "\n"
 "show_mouse_grab_lines                   : YES\n"
 "show_mouse_collision_box                : YES\n"
@@ -133,6 +141,7 @@ static const vector<string> available_vars = {
 {"acceleration_color_min"},
 {"air_resistance"},
 {"background_color"},
+{"barnes_hut_theta"},
 {"text_color"},
 {"blur_strength"},
 {"circle_color"},
@@ -155,6 +164,9 @@ static const vector<string> available_vars = {
 {"num_vertices_per_particle"},
 {"openCL_active"},
 {"physics_samples"},
+{"physics_tick_rate"},
+{"max_substeps"},
+{"interpolate_positions"},
 {"post_processing"},
 {"post_processing_samples"},
 {"px_scale"},
@@ -163,22 +175,26 @@ static const vector<string> available_vars = {
 {"quadtree_depth"},
 {"quadtree_show_only_occupied"},
 {"random_velocity_force"},
+{"particle_lifetime"},
+{"reorder_interval"},
 {"show_mouse_collision_box"},
 {"show_mouse_grab_lines"},
 {"show_settings"},
 {"time_scale"},
 {"tree_optimized_size"},
-{"uniformgrid_parts"},
 {"use_gravitational_force"},
+{"use_barnes_hut"},
 {"use_libdispatch"},
 {"use_multithreading"},
 {"use_uniformgrid"},
+{"use_sweep_and_prune"},
 {"variable_thread_count"},
 {"vsync"},
 {"wireframe_mode"},
 {"circle_collision"},
 {"border_collision"},
 {"draw_debug"},
+{"dump_critical_path"},
 {"window_pos"},
 {"screen_width"},
 {"screen_height"},
@@ -498,7 +514,7 @@ void init_variables() noexcept
         } else {
             if      (is_string(val))  { variable_map[var] = remove_quotes(val); }
             else if (is_float(val))   { variable_map[var] = get_float(val); }
-            else if (is_bool(val))    { variable_map[var] = get_bool(val); }
+            else if (is_bool(val))    { variable_map[var] = to_variable(get_bool(val)); }
         }
     }
 
@@ -507,6 +523,7 @@ void init_variables() noexcept
     set_variable(&acceleration_color_min, "acceleration_color_min");
     set_variable(&air_resistance, "air_resistance");
     set_variable(&background_color, "background_color");
+    set_variable(&barnes_hut_theta, "barnes_hut_theta");
     set_variable(&text_color, "text_color");
     set_variable(&blur_strength, "blur_strength");
     set_variable(&circle_color, "circle_color");
@@ -529,6 +546,9 @@ void init_variables() noexcept
     set_variable(&num_vertices_per_particle, "num_vertices_per_particle");
     set_variable(&openCL_active, "openCL_active");
     set_variable(&physics_samples, "physics_samples");
+    set_variable(&physics_tick_rate, "physics_tick_rate");
+    set_variable(&max_substeps, "max_substeps");
+    set_variable(&interpolate_positions, "interpolate_positions");
     set_variable(&post_processing, "post_processing");
     set_variable(&post_processing_samples, "post_processing_samples");
     set_variable(&px_scale, "px_scale");
@@ -537,22 +557,26 @@ void init_variables() noexcept
     set_variable(&quadtree_depth, "quadtree_depth");
     set_variable(&quadtree_show_only_occupied, "quadtree_show_only_occupied");
     set_variable(&random_velocity_force, "random_velocity_force");
+    set_variable(&particle_lifetime, "particle_lifetime");
+    set_variable(&reorder_interval, "reorder_interval");
     set_variable(&show_mouse_collision_box, "show_mouse_collision_box");
     set_variable(&show_mouse_grab_lines, "show_mouse_grab_lines");
     set_variable(&show_settings, "show_settings");
     set_variable(&time_scale, "time_scale");
     set_variable(&tree_optimized_size, "tree_optimized_size");
-    set_variable(&uniformgrid_parts, "uniformgrid_parts");
     set_variable(&use_gravitational_force, "use_gravitational_force");
+    set_variable(&use_barnes_hut, "use_barnes_hut");
     set_variable(&use_libdispatch, "use_libdispatch");
     set_variable(&use_multithreading, "use_multithreading");
     set_variable(&use_uniformgrid, "use_uniformgrid");
+    set_variable(&use_sweep_and_prune, "use_sweep_and_prune");
     set_variable(&variable_thread_count, "variable_thread_count");
     set_variable(&vsync, "vsync");
     set_variable(&wireframe_mode, "wireframe_mode");
     set_variable(&circle_collision, "circle_collision");
     set_variable(&border_collision, "border_collision");
     set_variable(&draw_debug, "draw_debug");
+    set_variable(&dump_critical_path, "dump_critical_path");
     set_variable(&window_pos, "window_pos");
     set_variable(&screen_width, "screen_width");
     set_variable(&screen_height, "screen_height");
@@ -565,61 +589,69 @@ void init_variables() noexcept
 
 void refresh_variables() noexcept
 {
-    variable_map["particle_texture"] = particle_texture;
-    variable_map["acceleration_color_max"] = acceleration_color_max;
-    variable_map["acceleration_color_min"] = acceleration_color_min;
-    variable_map["air_resistance"] = air_resistance;
-    variable_map["background_color"] = background_color;
-    variable_map["text_color"] = text_color;
-    variable_map["blur_strength"] = blur_strength;
-    variable_map["circle_color"] = circle_color;
-    variable_map["circle_size"] = circle_size;
-    variable_map["color_by_velocity_threshold"] = color_by_velocity_threshold;
-    variable_map["color_particles"] = color_particles;
-    variable_map["draw_circles"] = draw_circles;
-    variable_map["draw_lines"] = draw_lines;
-    variable_map["draw_particles"] = draw_particles;
-    variable_map["draw_rects"] = draw_rects;
-    variable_map["gButtonHeight"] = gButtonHeight;
-    variable_map["gButtonWidth"] = gButtonWidth;
-    variable_map["gravity"] = gravity;
-    variable_map["has_random_velocity"] = has_random_velocity;
-    variable_map["is_particles_colored_by_acc"] = is_particles_colored_by_acc;
-    variable_map["monitor_refreshrate"] = monitor_refreshrate;
-    variable_map["mouse_busy_UI"] = mouse_busy_UI;
-    variable_map["mouse_size"] = mouse_size;
-    variable_map["multithreaded_particle_update"] = multithreaded_particle_update;
-    variable_map["num_vertices_per_particle"] = num_vertices_per_particle;
-    variable_map["openCL_active"] = openCL_active;
-    variable_map["physics_samples"] = physics_samples;
-    variable_map["post_processing"] = post_processing;
-    variable_map["post_processing_samples"] = post_processing_samples;
-    variable_map["px_scale"] = px_scale;
-    variable_map["quadtree_active"] = quadtree_active;
-    variable_map["quadtree_capacity"] = quadtree_capacity;
-    variable_map["quadtree_depth"] = quadtree_depth;
-    variable_map["quadtree_show_only_occupied"] = quadtree_show_only_occupied;
-    variable_map["random_velocity_force"] = random_velocity_force;
-    variable_map["show_mouse_collision_box"] = show_mouse_collision_box;
-    variable_map["show_mouse_grab_lines"] = show_mouse_grab_lines;
-    variable_map["show_settings"] = show_settings;
-    variable_map["time_scale"] = time_scale;
-    variable_map["tree_optimized_size"] = tree_optimized_size;
-    variable_map["uniformgrid_parts"] = uniformgrid_parts;
-    variable_map["use_gravitational_force"] = use_gravitational_force;
-    variable_map["use_libdispatch"] = use_libdispatch;
-    variable_map["use_multithreading"] = use_multithreading;
-    variable_map["use_uniformgrid"] = use_uniformgrid;
-    variable_map["variable_thread_count"] = variable_thread_count;
-    variable_map["vsync"] = vsync;
-    variable_map["wireframe_mode"] = wireframe_mode;
-    variable_map["circle_collision"] = circle_collision;
-    variable_map["border_collision"] = border_collision;
-    variable_map["draw_debug"] = draw_debug;
-    variable_map["window_pos"] = window_pos;
-    variable_map["screen_width"] = screen_width;
-    variable_map["screen_height"] = screen_height;
-    variable_map["framebuffer_width"] = framebuffer_width;
-    variable_map["framebuffer_height"] = framebuffer_height;
-    variable_map["cycle_particle_color"] = cycle_particle_color;
+    variable_map["particle_texture"] = to_variable(particle_texture);
+    variable_map["acceleration_color_max"] = to_variable(acceleration_color_max);
+    variable_map["acceleration_color_min"] = to_variable(acceleration_color_min);
+    variable_map["air_resistance"] = to_variable(air_resistance);
+    variable_map["background_color"] = to_variable(background_color);
+    variable_map["barnes_hut_theta"] = to_variable(barnes_hut_theta);
+    variable_map["text_color"] = to_variable(text_color);
+    variable_map["blur_strength"] = to_variable(blur_strength);
+    variable_map["circle_color"] = to_variable(circle_color);
+    variable_map["circle_size"] = to_variable(circle_size);
+    variable_map["color_by_velocity_threshold"] = to_variable(color_by_velocity_threshold);
+    variable_map["color_particles"] = to_variable(color_particles);
+    variable_map["draw_circles"] = to_variable(draw_circles);
+    variable_map["draw_lines"] = to_variable(draw_lines);
+    variable_map["draw_particles"] = to_variable(draw_particles);
+    variable_map["draw_rects"] = to_variable(draw_rects);
+    variable_map["gButtonHeight"] = to_variable(gButtonHeight);
+    variable_map["gButtonWidth"] = to_variable(gButtonWidth);
+    variable_map["gravity"] = to_variable(gravity);
+    variable_map["has_random_velocity"] = to_variable(has_random_velocity);
+    variable_map["is_particles_colored_by_acc"] = to_variable(is_particles_colored_by_acc);
+    variable_map["monitor_refreshrate"] = to_variable(monitor_refreshrate);
+    variable_map["mouse_busy_UI"] = to_variable(mouse_busy_UI);
+    variable_map["mouse_size"] = to_variable(mouse_size);
+    variable_map["multithreaded_particle_update"] = to_variable(multithreaded_particle_update);
+    variable_map["num_vertices_per_particle"] = to_variable(num_vertices_per_particle);
+    variable_map["openCL_active"] = to_variable(openCL_active);
+    variable_map["physics_samples"] = to_variable(physics_samples);
+    variable_map["physics_tick_rate"] = to_variable(physics_tick_rate);
+    variable_map["max_substeps"] = to_variable(max_substeps);
+    variable_map["interpolate_positions"] = to_variable(interpolate_positions);
+    variable_map["post_processing"] = to_variable(post_processing);
+    variable_map["post_processing_samples"] = to_variable(post_processing_samples);
+    variable_map["px_scale"] = to_variable(px_scale);
+    variable_map["quadtree_active"] = to_variable(quadtree_active);
+    variable_map["quadtree_capacity"] = to_variable(quadtree_capacity);
+    variable_map["quadtree_depth"] = to_variable(quadtree_depth);
+    variable_map["quadtree_show_only_occupied"] = to_variable(quadtree_show_only_occupied);
+    variable_map["random_velocity_force"] = to_variable(random_velocity_force);
+    variable_map["particle_lifetime"] = to_variable(particle_lifetime);
+    variable_map["reorder_interval"] = to_variable(reorder_interval);
+    variable_map["show_mouse_collision_box"] = to_variable(show_mouse_collision_box);
+    variable_map["show_mouse_grab_lines"] = to_variable(show_mouse_grab_lines);
+    variable_map["show_settings"] = to_variable(show_settings);
+    variable_map["time_scale"] = to_variable(time_scale);
+    variable_map["tree_optimized_size"] = to_variable(tree_optimized_size);
+    variable_map["use_gravitational_force"] = to_variable(use_gravitational_force);
+    variable_map["use_barnes_hut"] = to_variable(use_barnes_hut);
+    variable_map["use_libdispatch"] = to_variable(use_libdispatch);
+    variable_map["use_multithreading"] = to_variable(use_multithreading);
+    variable_map["use_uniformgrid"] = to_variable(use_uniformgrid);
+    variable_map["use_sweep_and_prune"] = to_variable(use_sweep_and_prune);
+    variable_map["variable_thread_count"] = to_variable(variable_thread_count);
+    variable_map["vsync"] = to_variable(vsync);
+    variable_map["wireframe_mode"] = to_variable(wireframe_mode);
+    variable_map["circle_collision"] = to_variable(circle_collision);
+    variable_map["border_collision"] = to_variable(border_collision);
+    variable_map["draw_debug"] = to_variable(draw_debug);
+    variable_map["dump_critical_path"] = to_variable(dump_critical_path);
+    variable_map["window_pos"] = to_variable(window_pos);
+    variable_map["screen_width"] = to_variable(screen_width);
+    variable_map["screen_height"] = to_variable(screen_height);
+    variable_map["framebuffer_width"] = to_variable(framebuffer_width);
+    variable_map["framebuffer_height"] = to_variable(framebuffer_height);
+    variable_map["cycle_particle_color"] = to_variable(cycle_particle_color);
 }
@@ -87,6 +87,15 @@ void refresh_variables() noexcept;
 
 extern std::unordered_map<string, variant<string, float, vec2, vec3, vec4>> variable_map;
 
+// Integers and bools are kept as floats, see set_variable. Newer standard
+// libraries no longer pick the float alternative for them on their own.
+template <class T>
+static auto to_variable(const T& value)
+{
+    if constexpr (std::is_integral<T>::value) return static_cast<float>(value);
+    else return value;
+}
+
 template <class T>
 static void set_variable(T* var, const string& str)
 {
@@ -24,6 +24,8 @@
 
 static constexpr bool multithreaded_engine{false};    // Rendering and Update are run on separate threads.
 static constexpr bool use_textured_particles{false};   // Particles are rendered using textured billboards
+static constexpr bool collect_frame_stats{true};       // Per-thread collision counters, see FrameStats.
+static constexpr bool use_profiler{true};              // ATHI_PROFILE zones and trace captures, see athi_profiler.h.
 
 // Constants
 static constexpr f64 kPI = 3.14159265359;
@@ -0,0 +1,105 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "../athi_typedefs.h"
+
+#include <cstring> // memset, memcpy
+#include <utility> // std::swap
+
+// Number of bits per axis in a 2D morton code.
+static constexpr u32 kMortonBits = 16;
+
+// Spreads the lower 16 bits of x so there is a zero bit between each of them.
+constexpr u32 morton_part_1_by_1(u32 x) noexcept
+{
+  x &= 0x0000ffff;
+  x = (x | (x << 8)) & 0x00ff00ff;
+  x = (x | (x << 4)) & 0x0f0f0f0f;
+  x = (x | (x << 2)) & 0x33333333;
+  x = (x | (x << 1)) & 0x55555555;
+  return x;
+}
+
+// Interleaves x and y into a 32-bit morton code. x takes the even bits.
+constexpr u32 morton_encode(u32 x, u32 y) noexcept
+{
+  return morton_part_1_by_1(x) | (morton_part_1_by_1(y) << 1);
+}
+
+// Quantizes a position inside [min, min + extent) and returns its morton code.
+// 'inv_extent' is 1 / extent, passed in so callers can hoist the division.
+inline u32 morton_encode(const vec2 &pos, const vec2 &min, const vec2 &inv_extent) noexcept
+{
+  constexpr f32 cells = static_cast<f32>((1u << kMortonBits) - 1);
+  f32 x = (pos.x - min.x) * inv_extent.x * cells;
+  f32 y = (pos.y - min.y) * inv_extent.y * cells;
+  x = (x < 0.0f) ? 0.0f : (x > cells) ? cells : x;
+  y = (y < 0.0f) ? 0.0f : (y > cells) ? cells : y;
+  return morton_encode(static_cast<u32>(x), static_cast<u32>(y));
+}
+
+// LSD radix sort of 64-bit items by the 'key_bits' bits starting at 'key_shift'.
+// By default the key is the upper half and the lower 32 bits are free for a
+// payload, usually an index. Pass key_shift 0 and key_bits 64 to sort by the
+// whole value. 'scratch' is resized to match 'items' and reused between calls.
+inline void radix_sort_by_key(vector<u64> &items, vector<u64> &scratch, u32 key_bits = 32, u32 key_shift = 32) noexcept
+{
+  const size_t count = items.size();
+  if (count < 2) return;
+
+  scratch.resize(count);
+
+  u64 *src = items.data();
+  u64 *dst = scratch.data();
+
+  const u32 passes = (key_bits + 7) / 8;
+  for (u32 pass = 0; pass < passes; ++pass)
+  {
+    const u32 shift = key_shift + pass * 8;
+
+    size_t histogram[256];
+    std::memset(histogram, 0, sizeof(histogram));
+
+    for (size_t i = 0; i < count; ++i)
+      ++histogram[(src[i] >> shift) & 0xff];
+
+    // Skip passes where every item has the same digit
+    if (histogram[(src[0] >> shift) & 0xff] == count) continue;
+
+    size_t offset = 0;
+    for (auto &h: histogram)
+    {
+      const size_t c = h;
+      h = offset;
+      offset += c;
+    }
+
+    for (size_t i = 0; i < count; ++i)
+      dst[histogram[(src[i] >> shift) & 0xff]++] = src[i];
+
+    std::swap(src, dst);
+  }
+
+  // Make sure the result ends up in 'items'
+  if (src != items.data())
+    std::memcpy(items.data(), src, count * sizeof(u64));
+}
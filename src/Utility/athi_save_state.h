@@ -22,7 +22,7 @@
 #pragma once
 
 #include "console.h" // console
-#include "../athi_utility.h" // file_exists
+#include "../athi_utility.h" // file_exists, get_time
 
 //#include <algorithm>
 #include <vector>   // vector
@@ -71,7 +71,7 @@ static void write_data(
     const vector<B>& colors,
     const vector<C>& transforms)
 {
-    const auto start_time = glfwGetTime();
+    const auto start_time = get_time();
 
     if (particles.empty() && colors.empty() && transforms.empty()) return;
 
@@ -130,7 +130,7 @@ static void write_data(
 
     FILE.close();
 
-    const auto time_spent =  (glfwGetTime() - start_time) * 1000.0;
+    const auto time_spent =  (get_time() - start_time) * 1000.0;
     console->warn("[IO WRITE {}ms] {}", time_spent, get_size(s1/sizeof(A) + s2/sizeof(B) + s3/sizeof(C)));
 }
 
@@ -144,7 +144,7 @@ static void read_data(
     // If the file does not exist just return
     if (!file_exists(path)) return;
 
-    const auto start_time = glfwGetTime();
+    const auto start_time = get_time();
 
     std::ifstream FILE(path, std::ios::in | std::ofstream::binary);
 
@@ -203,6 +203,6 @@ static void read_data(
 
     FILE.close();
 
-    const auto time_spent =  (glfwGetTime() - start_time) * 1000.0;
+    const auto time_spent =  (get_time() - start_time) * 1000.0;
     console->warn("[IO READ {}ms] {}", time_spent, get_size(s1/sizeof(A) + s2/sizeof(B) + s3/sizeof(C)));
 }
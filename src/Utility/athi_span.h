@@ -0,0 +1,53 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "../athi_typedefs.h"
+
+#include <type_traits> // std::remove_const_t
+
+// A pointer and a count. Doesn't own anything, so it goes stale once the
+// memory it points into is freed or moved.
+template <class T>
+class Span
+{
+public:
+  Span() noexcept = default;
+  Span(T *data, size_t size) noexcept : ptr(data), count(size) {}
+
+  // Span<T> converts to Span<const T>
+  template <class U, class = std::enable_if_t<std::is_same_v<const U, T>>>
+  Span(const Span<U> &other) noexcept : ptr(other.data()), count(other.size()) {}
+
+  T *data() const noexcept { return ptr; }
+  size_t size() const noexcept { return count; }
+  bool empty() const noexcept { return count == 0; }
+  size_t size_in_bytes() const noexcept { return count * sizeof(T); }
+
+  T &operator[](size_t i) const noexcept { return ptr[i]; }
+
+  T *begin() const noexcept { return ptr; }
+  T *end() const noexcept { return ptr + count; }
+
+private:
+  T *ptr{nullptr};
+  size_t count{0};
+};
@@ -0,0 +1,212 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "./Utility/athi_morton.h" // morton_encode, radix_sort_by_key
+#include "athi_nbody.h" // gravitational_pull
+
+#include <algorithm> // std::lower_bound, std::max, std::min
+
+// Barnes-Hut approximation of n-body gravity.
+//
+// Particles are sorted by the morton code of their position and a quadtree
+// is carved out of the sorted range, like LinearQuadtree does it, except
+// that every particle lands in exactly one leaf. Each node stores the total
+// mass and centre of mass of everything below it. A node that looks small
+// from where a particle stands (size / distance < theta) pulls on it as a
+// single body, anything closer is opened up.
+//
+// A theta of 0 opens every node and gives the same result as summing over
+// all pairs. 0.5 is the usual trade off.
+class BarnesHut
+{
+public:
+
+  struct Node
+  {
+    vec2  center_of_mass  {0.0f, 0.0f};
+    f32   mass            {0.0f};
+    f32   size            {0.0f}; // Side length, nodes are square
+    s32   first_child     {-1};   // The four children are stored contiguously
+    u32   begin           {0};    // Range of 'order' below this node
+    u32   end             {0};
+  };
+
+  s32 max_depth     {12};
+  s32 max_capacity  {8};
+
+  vector<Node>  nodes;
+  vector<s32>   order;  // Particle indices in morton order
+
+  // Builds the tree over the first 'count' particles.
+  void build(const vec2 *position, const f32 *mass, size_t count) noexcept
+  {
+    this->position = position;
+    this->mass = mass;
+
+    nodes.clear();
+    order.clear();
+    if (count == 0) return;
+
+    // Square bounds around all particles
+    vec2 min = position[0];
+    vec2 max = position[0];
+    for (size_t i = 1; i < count; ++i)
+    {
+      min = glm::min(min, position[i]);
+      max = glm::max(max, position[i]);
+    }
+    const f32 size = std::max(std::max(max.x - min.x, max.y - min.y), 1e-6f);
+    const vec2 inv_extent = vec2(1.0f / size);
+
+    codes.resize(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+      const u64 code = morton_encode(position[i], min, inv_extent);
+      codes[i] = (code << 32) | static_cast<u32>(i);
+    }
+    radix_sort_by_key(codes, scratch, 2 * kMortonBits);
+
+    order.resize(count);
+    for (size_t i = 0; i < count; ++i)
+      order[i] = static_cast<s32>(static_cast<u32>(codes[i]));
+
+    Node root;
+    root.size = size;
+    root.begin = 0;
+    root.end = static_cast<u32>(count);
+    nodes.emplace_back(root);
+
+    // Morton codes use 2 bits per level, so we can't go deeper than this.
+    build_node(0, 0, std::min(max_depth, static_cast<s32>(kMortonBits) - 1));
+  }
+
+  // The pull on particle 'i' from every other particle.
+  // @Hot
+  vec2 pull_on(s32 i, f32 theta) const noexcept
+  {
+    vec2 pull{0.0f, 0.0f};
+    if (nodes.empty()) return pull;
+
+    const vec2 p = position[i];
+    const f32 m = mass[i];
+    const f32 theta_sqrd = theta * theta;
+
+    // Every level pushes at most four nodes and pops one.
+    s32 stack[4 * kMortonBits];
+    s32 top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+      const auto &node = nodes[stack[--top]];
+      if (node.mass == 0.0f) continue;
+
+      if (node.first_child == -1)
+      {
+        for (u32 k = node.begin; k < node.end; ++k)
+        {
+          const s32 j = order[k];
+          if (j != i) pull += gravitational_pull(p, m, position[j], mass[j]);
+        }
+        continue;
+      }
+
+      const vec2 d = node.center_of_mass - p;
+      if (node.size * node.size < theta_sqrd * (d.x * d.x + d.y * d.y))
+      {
+        pull += gravitational_pull(p, m, node.center_of_mass, node.mass);
+        continue;
+      }
+
+      for (s32 c = 0; c < 4; ++c)
+        stack[top++] = node.first_child + c;
+    }
+
+    return pull;
+  }
+
+private:
+
+  const vec2  *position {nullptr};
+  const f32   *mass     {nullptr};
+
+  // Scratch buffers kept around to avoid reallocating every frame
+  vector<u64> codes;
+  vector<u64> scratch;
+
+  // Splits node 'n' and sums up the mass below it.
+  void build_node(s32 n, s32 level, s32 depth) noexcept
+  {
+    const u32 begin = nodes[n].begin;
+    const u32 end = nodes[n].end;
+
+    if (static_cast<s32>(end - begin) <= max_capacity || level >= depth)
+    {
+      f32 total = 0.0f;
+      vec2 weighted{0.0f, 0.0f};
+      for (u32 k = begin; k < end; ++k)
+      {
+        const s32 i = order[k];
+        total += mass[i];
+        weighted += position[i] * mass[i];
+      }
+      nodes[n].mass = total;
+      nodes[n].center_of_mass = (total > 0.0f) ? weighted / total : vec2(0.0f);
+      return;
+    }
+
+    // The two code bits that pick a child at this level
+    const u32 shift = 32 + 2 * (kMortonBits - 1 - level);
+    const u64 prefix = (shift + 2 < 64) ? (codes[begin] >> (shift + 2)) << (shift + 2) : 0;
+
+    // Children in morton order: SW, SE, NW, NE
+    const s32 first = static_cast<s32>(nodes.size());
+    nodes[n].first_child = first;
+
+    u32 child_begin = begin;
+    for (s32 c = 0; c < 4; ++c)
+    {
+      const u64 upper = prefix + (static_cast<u64>(c + 1) << shift);
+      const u32 child_end = (c == 3) ? end
+        : static_cast<u32>(std::lower_bound(codes.begin() + child_begin, codes.begin() + end, upper) - codes.begin());
+
+      Node child;
+      child.size = nodes[n].size * 0.5f;
+      child.begin = child_begin;
+      child.end = child_end;
+      nodes.emplace_back(child);
+      child_begin = child_end;
+    }
+
+    f32 total = 0.0f;
+    vec2 weighted{0.0f, 0.0f};
+    for (s32 c = 0; c < 4; ++c)
+    {
+      build_node(first + c, level + 1, depth);
+      total += nodes[first + c].mass;
+      weighted += nodes[first + c].center_of_mass * nodes[first + c].mass;
+    }
+    nodes[n].mass = total;
+    nodes[n].center_of_mass = (total > 0.0f) ? weighted / total : vec2(0.0f);
+  }
+};
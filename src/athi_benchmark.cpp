@@ -0,0 +1,860 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "athi_benchmark.h"
+
+#include "athi_quadtree.h" // Quadtree
+#include "athi_linear_quadtree.h" // LinearQuadtree
+#include "athi_narrowphase.h" // narrowphase_scalar, get_narrowphase_sse, get_narrowphase_avx2
+#include "athi_contact.h" // resolve_contact
+#include "athi_uniformgrid.h" // UniformGrid
+#include "athi_barnes_hut.h" // BarnesHut
+#include "athi_nbody.h" // NBody, gravitational_pull
+#include "athi_dispatch.h" // dispatch
+#include "athi_emitter.h" // EmitterShape, EmitterParams, emit_particle
+#include "athi_headless.h" // headless_spawn, headless_step
+#include "athi_particle.h" // particle_system
+#include "athi_settings.h" // tree_type, physics_samples, use_multithreading
+#include "athi_utility.h" // get_time, rand_f32
+#include "Utility/console.h" // console
+
+#include <algorithm> // std::sort
+#include <cmath> // std::abs
+#include <functional> // std::function
+
+// Fills 'position' and 'radius' with 'count' particles spread over a 1024x1024 area.
+static void make_random_particles(size_t count, vector<vec2> &position, vector<f32> &radius) noexcept
+{
+  srand(1337);
+  position.resize(count);
+  radius.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    position[i] = rand_vec2(0.0f, 1024.0f);
+    radius[i] = rand_f32(0.5f, 2.0f);
+  }
+}
+
+void benchmark_quadtree_build() noexcept
+{
+  constexpr s32 depth = 10;
+  constexpr s32 capacity = 100;
+  constexpr s32 iterations = 5;
+
+  const vec2 min{0.0f, 0.0f};
+  const vec2 max{1024.0f, 1024.0f};
+
+  vector<vec2> position;
+  vector<f32> radius;
+  vector<vector<s32>> tree_container;
+
+  LinearQuadtree linear_quadtree;
+  linear_quadtree.max_depth = depth;
+  linear_quadtree.max_capacity = capacity;
+
+  console->info("Quadtree build benchmark (depth: {}, capacity: {}, iterations: {})", depth, capacity, iterations);
+
+  for (const size_t count: {10000, 100000, 1000000})
+  {
+    make_random_particles(count, position, radius);
+
+    // Pointer based quadtree, built the way ParticleSystem::update used to.
+    Quadtree::max_depth = depth;
+    Quadtree::max_capacity = capacity;
+    f64 quadtree_time = 0.0;
+    for (s32 i = 0; i < iterations; ++i)
+    {
+      const auto start = get_time();
+      tree_container.clear();
+      Quadtree quadtree(min, max);
+      quadtree.set_data(position, radius);
+      quadtree.input_range(0, static_cast<s32>(count));
+      quadtree.get(tree_container);
+      quadtree_time += get_time() - start;
+    }
+
+    // The first build grows the buffers, so it's left out of the timing.
+    linear_quadtree.reset(min, max);
+    linear_quadtree.set_data(position.data(), radius.data());
+    linear_quadtree.input_range(0, static_cast<s32>(count));
+
+    f64 linear_time = 0.0;
+    for (s32 i = 0; i < iterations; ++i)
+    {
+      const auto start = get_time();
+      linear_quadtree.reset(min, max);
+      linear_quadtree.set_data(position.data(), radius.data());
+      linear_quadtree.input_range(0, static_cast<s32>(count));
+      linear_time += get_time() - start;
+    }
+
+    quadtree_time = quadtree_time * 1000.0 / iterations;
+    linear_time = linear_time * 1000.0 / iterations;
+
+    console->info("{:>8} particles | Quadtree: {:8.3f}ms | LinearQuadtree: {:8.3f}ms | {:.2f}x",
+                  count, quadtree_time, linear_time, quadtree_time / linear_time);
+  }
+}
+
+void benchmark_narrowphase() noexcept
+{
+  constexpr size_t count = 100000;
+  constexpr u32 candidates_per_particle = 64;
+  constexpr s32 iterations = 10;
+
+  vector<vec2> position;
+  vector<f32> radius;
+  make_random_particles(count, position, radius);
+
+  // Each particle gets a run of random candidates, like a broadphase would hand it.
+  vector<s32> candidates(count * candidates_per_particle);
+  for (auto &c: candidates)
+    c = static_cast<s32>(rand() % count);
+
+  vector<s32> hits(candidates_per_particle);
+
+  struct Kernel
+  {
+    const char *name;
+    NarrowphaseKernel kernel;
+  };
+  const Kernel kernels[] = {
+    {"scalar", narrowphase_scalar},
+    {"SSE", get_narrowphase_sse()},
+    {"AVX2", get_narrowphase_avx2()},
+  };
+
+  console->info("Narrowphase benchmark ({} particles x {} candidates, iterations: {})",
+                count, candidates_per_particle, iterations);
+
+  for (const auto &k: kernels)
+  {
+    if (k.kernel == nullptr)
+    {
+      console->info("{:>8} | not supported", k.name);
+      continue;
+    }
+
+    u64 hit_count = 0;
+    const auto start = get_time();
+    for (s32 i = 0; i < iterations; ++i)
+    {
+      for (size_t a = 0; a < count; ++a)
+        hit_count += k.kernel(position.data(), radius.data(), static_cast<s32>(a),
+                              candidates.data() + a * candidates_per_particle,
+                              candidates_per_particle, hits.data());
+    }
+    const f64 time = get_time() - start;
+
+    const f64 pairs = static_cast<f64>(count) * candidates_per_particle * iterations;
+    console->info("{:>8} | {:8.1f}M pairs/s | {:8.3f}ms per pass | hits: {}",
+                  k.name, pairs / time / 1e6, time * 1000.0 / iterations, hit_count / iterations);
+  }
+  console->info("The simulation uses {}", get_narrowphase_name());
+}
+
+// The contact response as it was before resolve_contact: atan2/cos/sin for
+// the separation and a second normalize for the impulse. Kept to check the
+// new one against.
+static bool resolve_contact_reference(vec2 *position, vec2 *velocity, const f32 *radius, const f32 *mass,
+                                      s32 a, s32 b, const vec2 &bounds, f32 energy_loss) noexcept
+{
+  const f32 ar = radius[a];
+  const f32 br = radius[b];
+  const f32 sum_radius = ar + br;
+  const f32 dx = position[b].x - position[a].x;
+  const f32 dy = position[b].y - position[a].y;
+  if (dx * dx + dy * dy >= sum_radius * sum_radius) return false;
+
+  const vec2 a_vel = velocity[a];
+  const vec2 b_vel = velocity[b];
+  const f32 vdx = b_vel.x - a_vel.x;
+  const f32 vdy = b_vel.y - a_vel.y;
+  const f32 m1 = mass[a];
+  const f32 m2 = mass[b];
+
+  const vec2 a_pos = position[a];
+  const vec2 b_pos = position[b];
+  const f32 collision_depth = sum_radius - glm::distance(b_pos, a_pos);
+  if (collision_depth >= 1e-11f)
+  {
+    const f32 collision_angle = atan2(dy, dx);
+    const f32 cos_angle = cos(collision_angle);
+    const f32 sin_angle = sin(collision_angle);
+
+    const vec2 a_move = {-collision_depth * 0.5f * cos_angle, -collision_depth * 0.5f * sin_angle};
+    const vec2 b_move = { collision_depth * 0.5f * cos_angle,  collision_depth * 0.5f * sin_angle};
+
+    vec2 a_pos_move{0.0f};
+    vec2 b_pos_move{0.0f};
+    if (a_pos.x + a_move.x >= ar && a_pos.x + a_move.x <= bounds.x - ar) a_pos_move.x += a_move.x;
+    if (a_pos.y + a_move.y >= ar && a_pos.y + a_move.y <= bounds.y - ar) a_pos_move.y += a_move.y;
+    if (b_pos.x + b_move.x >= br && b_pos.x + b_move.x <= bounds.x - br) b_pos_move.x += b_move.x;
+    if (b_pos.y + b_move.y >= br && b_pos.y + b_move.y <= bounds.y - br) b_pos_move.y += b_move.y;
+
+    position[a] += a_pos_move;
+    position[b] += b_pos_move;
+  }
+
+  if (dx * vdx + dy * vdy < 1e-11f)
+  {
+    const vec2 norm = glm::normalize(vec2(dx, dy));
+    const vec2 tang = vec2(-norm.y, norm.x);
+    const f32 scal_norm_1 = glm::dot(norm, a_vel);
+    const f32 scal_norm_2 = glm::dot(norm, b_vel);
+    const f32 scal_tang_1 = glm::dot(tang, a_vel);
+    const f32 scal_tang_2 = glm::dot(tang, b_vel);
+
+    const f32 scal_norm_1_after = (scal_norm_1 * (m1 - m2) + 2.0f * m2 * scal_norm_2) / (m1 + m2);
+    const f32 scal_norm_2_after = (scal_norm_2 * (m2 - m1) + 2.0f * m1 * scal_norm_1) / (m1 + m2);
+
+    velocity[a] = (tang * scal_tang_1 + norm * scal_norm_1_after) * energy_loss;
+    velocity[b] = (tang * scal_tang_2 + norm * scal_norm_2_after) * energy_loss;
+  }
+  return true;
+}
+
+// Fills a 'bounds' sized box with 'count' particles and random velocities.
+static void make_random_pile(size_t count, const vec2 &bounds, vector<vec2> &position, vector<vec2> &velocity,
+                             vector<f32> &radius, vector<f32> &mass) noexcept
+{
+  srand(1337);
+  position.resize(count);
+  velocity.resize(count);
+  radius.resize(count);
+  mass.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    radius[i] = rand_f32(2.0f, 3.0f);
+    mass[i] = kPI * radius[i] * radius[i];
+    position[i] = vec2(rand_f32(radius[i], bounds.x - radius[i]), rand_f32(radius[i], bounds.y - radius[i]));
+    velocity[i] = rand_vec2(-5.0f, 5.0f);
+  }
+}
+
+// Every overlapping pair in 'position', found with a UniformGrid over 'bounds'.
+static void find_grid_pairs(const vec2 &bounds, vector<vec2> &position, vector<f32> &radius, UniformGrid &grid,
+                            vector<std::pair<s32, s32>> &pairs) noexcept
+{
+  grid.reset(vec2(0.0f), bounds);
+  grid.set_data(position.data(), radius.data());
+  grid.input_range(0, static_cast<s32>(position.size()));
+  pairs.clear();
+  grid.for_each_pair(0, grid.cell_total(), [&](s32 a, s32 b) { pairs.emplace_back(a, b); });
+}
+
+static constexpr size_t kContactDenseCount = 20000;
+static constexpr f32 kContactEnergyLoss = 0.99f;
+
+bool check_contact_solver() noexcept
+{
+  constexpr size_t sparse_count = 2000;
+  constexpr s32 steps = 60;
+  constexpr f32 dt = 1.0f / 60.0f;
+  constexpr f32 tolerance = 1e-3f;
+
+  const vec2 bounds{512.0f, 512.0f};
+
+  vector<vec2> position;
+  vector<vec2> velocity;
+  vector<f32> radius;
+  vector<f32> mass;
+
+  UniformGrid grid;
+  vector<std::pair<s32, s32>> pairs;
+
+  // Trajectories. Resolving a pile one pair at a time is chaotic: nudging a
+  // single position by 1e-6 changes the outcome of the whole pile within a
+  // step. So this is done on a sparse scene where contacts rarely chain.
+  f32 max_trajectory_deviation = 0.0f;
+  {
+    make_random_pile(sparse_count, bounds, position, velocity, radius, mass);
+    auto new_position = position;
+    auto new_velocity = velocity;
+
+    for (s32 step = 0; step < steps; ++step)
+    {
+      find_grid_pairs(bounds, position, radius, grid, pairs);
+      for (const auto &[a, b]: pairs)
+      {
+        resolve_contact_reference(position.data(), velocity.data(), radius.data(), mass.data(), a, b, bounds, kContactEnergyLoss);
+        resolve_contact(new_position.data(), new_velocity.data(), radius.data(), mass.data(), a, b, bounds, kContactEnergyLoss);
+      }
+      for (size_t i = 0; i < sparse_count; ++i)
+      {
+        position[i] += velocity[i] * dt;
+        new_position[i] += new_velocity[i] * dt;
+        max_trajectory_deviation = std::max(max_trajectory_deviation, glm::distance(position[i], new_position[i]));
+      }
+    }
+
+    console->info("{} particles, {} steps | max trajectory deviation: {:.2e}px ({})", sparse_count, steps,
+                  max_trajectory_deviation, max_trajectory_deviation <= tolerance ? "ok" : "OUT OF TOLERANCE");
+  }
+
+  // Every contact in the dense pile, each resolved from the same state by both.
+  f32 max_contact_deviation = 0.0f;
+  {
+    make_random_pile(kContactDenseCount, bounds, position, velocity, radius, mass);
+    find_grid_pairs(bounds, position, radius, grid, pairs);
+
+    for (const auto &[a, b]: pairs)
+    {
+      const s32 i[2] = {a, b};
+      vec2 ref_position[2], ref_velocity[2], new_position[2], new_velocity[2];
+      f32 r[2], m[2];
+      for (s32 k = 0; k < 2; ++k)
+      {
+        ref_position[k] = new_position[k] = position[i[k]];
+        ref_velocity[k] = new_velocity[k] = velocity[i[k]];
+        r[k] = radius[i[k]];
+        m[k] = mass[i[k]];
+      }
+      resolve_contact_reference(ref_position, ref_velocity, r, m, 0, 1, bounds, kContactEnergyLoss);
+      resolve_contact(new_position, new_velocity, r, m, 0, 1, bounds, kContactEnergyLoss);
+      for (s32 k = 0; k < 2; ++k)
+      {
+        max_contact_deviation = std::max(max_contact_deviation, glm::distance(ref_position[k], new_position[k]));
+        max_contact_deviation = std::max(max_contact_deviation, glm::distance(ref_velocity[k], new_velocity[k]));
+      }
+    }
+
+    console->info("{} pairs | max single contact deviation: {:.2e} ({})", pairs.size(),
+                  max_contact_deviation, max_contact_deviation <= tolerance ? "ok" : "OUT OF TOLERANCE");
+  }
+
+  return max_trajectory_deviation <= tolerance && max_contact_deviation <= tolerance;
+}
+
+void benchmark_contact_solver() noexcept
+{
+  constexpr s32 iterations = 20;
+
+  const vec2 bounds{512.0f, 512.0f};
+
+  console->info("Contact solver benchmark ({} particles, iterations: {})", kContactDenseCount, iterations);
+
+  check_contact_solver();
+
+  vector<vec2> position;
+  vector<vec2> velocity;
+  vector<f32> radius;
+  vector<f32> mass;
+  make_random_pile(kContactDenseCount, bounds, position, velocity, radius, mass);
+
+  UniformGrid grid;
+  vector<std::pair<s32, s32>> pairs;
+  find_grid_pairs(bounds, position, radius, grid, pairs);
+
+  // Speed: the dense pile's pair list resolved from the same starting state.
+  struct Solver
+  {
+    const char *name;
+    bool (*resolve)(vec2 *, vec2 *, const f32 *, const f32 *, s32, s32, const vec2 &, f32) noexcept;
+  };
+  const Solver solvers[] = {
+    {"trig", resolve_contact_reference},
+    {"sqrt", resolve_contact},
+  };
+
+  f64 times[2];
+  for (s32 s = 0; s < 2; ++s)
+  {
+    f64 time = 0.0;
+    u64 contacts = 0;
+    for (s32 i = 0; i < iterations; ++i)
+    {
+      auto pos = position;
+      auto vel = velocity;
+      const auto start = get_time();
+      for (const auto &[a, b]: pairs)
+        contacts += solvers[s].resolve(pos.data(), vel.data(), radius.data(), mass.data(), a, b, bounds, kContactEnergyLoss);
+      time += get_time() - start;
+    }
+    times[s] = time * 1000.0 / iterations;
+    console->info("{:>8} | {:8.3f}ms per pass | {} pairs | {} contacts",
+                  solvers[s].name, times[s], pairs.size(), contacts / iterations);
+  }
+  console->info("speedup: {:.2f}x", times[0] / times[1]);
+}
+
+static const char *tree_type_name(TreeType tree) noexcept
+{
+  switch (tree)
+  {
+    case TreeType::Quadtree:      return "quadtree";
+    case TreeType::UniformGrid:   return "uniformgrid";
+    case TreeType::SweepAndPrune: return "sweep_and_prune";
+    case TreeType::None:          return "none";
+  }
+  return "?";
+}
+
+// Runs 'frames' frames of a small, fast moving pile of mixed radii with the
+// 'tree' broadphase, calling 'check' every physics sample before the
+// contacts are resolved. Particles cross several leaves and cells per
+// frame, and the reorder runs too, so a tree that falls behind the
+// positions or a pair that goes missing in a reorder shows up.
+static void run_contact_scene(TreeType tree, bool multithreaded, u32 frames, const std::function<void()> &check) noexcept
+{
+  const auto saved_tree = tree_type;
+  const auto saved_samples = physics_samples;
+  const auto saved_reorder_interval = reorder_interval;
+  const auto saved_multithreading = use_multithreading;
+  const auto saved_particle_update = multithreaded_particle_update;
+
+  tree_type = tree;
+  physics_samples = 2;
+  reorder_interval = 7;
+  use_multithreading = multithreaded;
+  multithreaded_particle_update = multithreaded;
+
+  HeadlessScene scene;
+  scene.particles = 1000;
+  scene.radius = 1.5f;
+  scene.radius_max = 4.0f;
+  scene.speed = 240.0f;
+  scene.width = 320;
+  scene.height = 240;
+  scene.seed = 7;
+
+  particle_system.erase_all();
+  headless_spawn(scene);
+  headless_step(1.0f / 60.0f);
+
+  particle_system.on_contacts = check;
+  for (u32 frame = 0; frame < frames; ++frame)
+    headless_step(1.0f / 60.0f);
+  particle_system.on_contacts = nullptr;
+
+  particle_system.erase_all();
+  headless_step(1.0f / 60.0f);
+
+  tree_type = saved_tree;
+  physics_samples = saved_samples;
+  reorder_interval = saved_reorder_interval;
+  use_multithreading = saved_multithreading;
+  multithreaded_particle_update = saved_particle_update;
+}
+
+bool check_broadphase() noexcept
+{
+  constexpr u32 frames = 30;
+
+  // Pairs this close to touching may go either way between the kernels
+  constexpr f32 margin = 1e-4f;
+
+  vector<u64> found;
+  bool passed = true;
+
+  for (const bool multithreaded : {false, true})
+  {
+    for (const auto tree : {TreeType::Quadtree, TreeType::UniformGrid, TreeType::SweepAndPrune, TreeType::None})
+    {
+      u64 contacts = 0, missed = 0, extra = 0, duplicates = 0;
+
+      run_contact_scene(tree, multithreaded, frames, [&]()
+      {
+        const auto &ps = particle_system;
+        const vec2 *position = ps.particles.position.data();
+        const f32 *radius = ps.particles.radius.data();
+        const u32 count = ps.particle_count;
+
+        found.assign(ps.pairs.begin(), ps.pairs.end());
+        std::sort(found.begin(), found.end());
+
+        // Walk every pair in the same order as the sorted keys
+        size_t next = 0;
+        for (u32 a = 0; a < count; ++a)
+        {
+          for (u32 b = a + 1; b < count; ++b)
+          {
+            const u64 key = (static_cast<u64>(a) << 32) | b;
+            u32 times_found = 0;
+            for (; next < found.size() && found[next] <= key; ++next)
+            {
+              if (found[next] == key) ++times_found;
+              else ++extra; // Not a pair of two different particles in range
+            }
+            duplicates += (times_found > 1);
+
+            const f32 dx = position[b].x - position[a].x;
+            const f32 dy = position[b].y - position[a].y;
+            const f32 sum_radius = radius[a] + radius[b];
+            const f32 distance_sqrd = dx * dx + dy * dy;
+            const f32 sqr_radius = sum_radius * sum_radius;
+            const bool touching = distance_sqrd < sqr_radius;
+            contacts += touching;
+            if (std::abs(distance_sqrd - sqr_radius) <= margin * sqr_radius) continue;
+
+            missed += (touching && times_found == 0);
+            extra += (!touching && times_found != 0);
+          }
+        }
+        extra += found.size() - next;
+      });
+
+      const bool ok = (missed == 0 && extra == 0 && duplicates == 0);
+      console->info("{:>15} {} | {} contacts over {} frames | missed: {} | extra: {} | duplicates: {} ({})",
+                    tree_type_name(tree), multithreaded ? "threaded" : "serial  ", contacts, frames,
+                    missed, extra, duplicates, ok ? "ok" : "FAILED");
+      passed &= ok;
+    }
+  }
+  return passed;
+}
+
+bool check_coloring() noexcept
+{
+  constexpr u32 frames = 30;
+  constexpr u32 kPairColors = ParticleSystem::kPairColors;
+
+  vector<u32> last_batch;
+  vector<u64> sorted_pairs;
+  vector<u64> sorted_batched;
+  bool passed = true;
+
+  for (const bool multithreaded : {false, true})
+  {
+    for (const auto tree : {TreeType::Quadtree, TreeType::UniformGrid, TreeType::SweepAndPrune, TreeType::None})
+    {
+      u64 pairs = 0, conflicts = 0, lost = 0, overflow = 0;
+
+      run_contact_scene(tree, multithreaded, frames, [&]()
+      {
+        const auto &ps = particle_system;
+
+        // Every particle is stamped with the batch it was last seen in,
+        // starting at 1 so a fresh 0 never matches.
+        last_batch.assign(ps.particle_count, 0);
+        for (u32 c = 0; c < kPairColors; ++c)
+        {
+          for (u32 k = ps.batch_start[c]; k < ps.batch_start[c + 1]; ++k)
+          {
+            const u32 a = static_cast<u32>(ps.batched_pairs[k] >> 32);
+            const u32 b = static_cast<u32>(ps.batched_pairs[k]);
+            conflicts += (last_batch[a] == c + 1) + (last_batch[b] == c + 1);
+            last_batch[a] = last_batch[b] = c + 1;
+          }
+        }
+        overflow += ps.batch_start[kPairColors + 1] - ps.batch_start[kPairColors];
+
+        // The batches hold every pair exactly once
+        sorted_pairs.assign(ps.pairs.begin(), ps.pairs.end());
+        sorted_batched.assign(ps.batched_pairs.begin(), ps.batched_pairs.begin() + ps.batch_start[kPairColors + 1]);
+        std::sort(sorted_pairs.begin(), sorted_pairs.end());
+        std::sort(sorted_batched.begin(), sorted_batched.end());
+        lost += (sorted_pairs != sorted_batched);
+        pairs += ps.pairs.size();
+      });
+
+      const bool ok = (conflicts == 0 && lost == 0);
+      console->info("{:>15} {} | {} pairs over {} frames | shared particles: {} | samples with lost pairs: {} | overflow: {} ({})",
+                    tree_type_name(tree), multithreaded ? "threaded" : "serial  ", pairs, frames,
+                    conflicts, lost, overflow, ok ? "ok" : "FAILED");
+      passed &= ok;
+    }
+  }
+  return passed;
+}
+
+void benchmark_barnes_hut() noexcept
+{
+  constexpr size_t count = 10000;
+  constexpr s32 iterations = 3;
+
+  vector<vec2> position;
+  vector<f32> radius;
+  make_random_particles(count, position, radius);
+
+  vector<f32> mass(count);
+  for (size_t i = 0; i < count; ++i)
+    mass[i] = kPI * radius[i] * radius[i];
+
+  console->info("Barnes-Hut benchmark ({} particles, iterations: {})", count, iterations);
+
+  // Brute force, the reference for the error
+  NBody nbody;
+  vector<vec2> exact;
+  f64 brute_time = 0.0;
+  for (s32 it = 0; it < iterations; ++it)
+  {
+    const auto start = get_time();
+    nbody.compute(position.data(), mass.data(), count, exact, false);
+    brute_time += get_time() - start;
+  }
+  brute_time = brute_time * 1000.0 / iterations;
+  console->info("   brute force | {:8.3f}ms", brute_time);
+
+  BarnesHut barnes_hut;
+  vector<vec2> approx(count);
+
+  for (const f32 theta: {0.0f, 0.25f, 0.5f, 0.75f, 1.0f})
+  {
+    // Tree build included, since it's redone every frame
+    f64 time = 0.0;
+    for (s32 it = 0; it < iterations; ++it)
+    {
+      const auto start = get_time();
+      barnes_hut.build(position.data(), mass.data(), count);
+      for (size_t i = 0; i < count; ++i)
+        approx[i] = barnes_hut.pull_on(static_cast<s32>(i), theta);
+      time += get_time() - start;
+    }
+    time = time * 1000.0 / iterations;
+
+    // Error relative to the size of each particle's exact pull. The max is
+    // large for particles whose pulls nearly cancel out, the mean is the one to watch.
+    f64 mean_error = 0.0;
+    f64 max_error = 0.0;
+    for (size_t i = 0; i < count; ++i)
+    {
+      const f64 error = glm::length(approx[i] - exact[i]) / std::max(glm::length(exact[i]), 1e-20f);
+      mean_error += error;
+      max_error = std::max(max_error, error);
+    }
+    mean_error /= count;
+
+    console->info("theta {:5.2f} | {:8.3f}ms | {:6.2f}x | mean error: {:.2e} | max error: {:.2e}",
+                  theta, time, brute_time / time, mean_error, max_error);
+  }
+}
+
+void benchmark_nbody() noexcept
+{
+  console->info("N-body kernel benchmark (workers: {})", dispatch.size());
+
+  NBody nbody;
+  vector<vec2> position;
+  vector<f32> radius;
+  vector<f32> mass;
+  vector<vec2> naive;
+  vector<vec2> tiled;
+
+  for (const size_t count: {1000, 5000, 20000})
+  {
+    make_random_particles(count, position, radius);
+    mass.resize(count);
+    for (size_t i = 0; i < count; ++i)
+      mass[i] = kPI * radius[i] * radius[i];
+
+    // Every ordered pair, one particle at a time, like apply_n_body used to
+    naive.resize(count);
+    const auto naive_start = get_time();
+    for (size_t i = 0; i < count; ++i)
+    {
+      vec2 pull{0.0f, 0.0f};
+      for (size_t j = 0; j < count; ++j)
+        if (i != j) pull += gravitational_pull(position[i], mass[i], position[j], mass[j]);
+      naive[i] = pull;
+    }
+    const f64 naive_time = get_time() - naive_start;
+
+    const auto serial_start = get_time();
+    nbody.compute(position.data(), mass.data(), count, tiled, false);
+    const f64 serial_time = get_time() - serial_start;
+
+    const auto parallel_start = get_time();
+    nbody.compute(position.data(), mass.data(), count, tiled, true);
+    const f64 parallel_time = get_time() - parallel_start;
+
+    f64 max_error = 0.0;
+    for (size_t i = 0; i < count; ++i)
+      max_error = std::max(max_error, static_cast<f64>(glm::length(tiled[i] - naive[i]) / std::max(glm::length(naive[i]), 1e-20f)));
+
+    // Interactions are counted once per pair, the naive loop visits each twice.
+    const f64 pairs = static_cast<f64>(nbody.interactions);
+    console->info("{:>6} particles | naive: {:8.1f}M/s | tiled: {:8.1f}M/s | tiled parallel: {:8.1f}M/s | max error: {:.2e}",
+                  count, pairs / naive_time / 1e6, pairs / serial_time / 1e6, pairs / parallel_time / 1e6, max_error);
+  }
+}
+
+void benchmark_dispatch() noexcept
+{
+  constexpr s32 iterations = 10000;
+  const s32 threads = dispatch.size();
+
+  console->info("Dispatch benchmark ({} threads, iterations: {})", threads, iterations);
+
+  // The way parallel_for used to work: one enqueued task and future per thread
+  const auto enqueue_for = [threads](size_t count, auto &&f)
+  {
+    vector<std::future<void>> results(threads);
+    for (s32 i = 0; i < threads; ++i)
+    {
+      const auto [begin, end] = get_begin_and_end(i, count, threads);
+      results[i] = dispatch.enqueue(f, begin, end);
+    }
+    for (auto &&res : results) res.get();
+  };
+
+  // Small tasks: a little math on a few thousand floats
+  vector<f32> data(4096, 1.0f);
+  const auto small = [&data](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+      data[i] = std::sqrt(data[i] * 1.0001f + 0.5f);
+  };
+  const auto empty = [](size_t, size_t) {};
+
+  const auto time_us = [](auto &&body)
+  {
+    const auto start = get_time();
+    for (s32 i = 0; i < iterations; ++i) body();
+    return (get_time() - start) * 1e6 / iterations;
+  };
+
+  const f64 empty_new = time_us([&] { dispatch.parallel_for(0, threads, empty); });
+  const f64 empty_old = time_us([&] { enqueue_for(threads, empty); });
+  const f64 small_serial = time_us([&] { small(0, data.size()); });
+  const f64 small_new = time_us([&] { dispatch.parallel_for(0, data.size(), small); });
+  const f64 small_old = time_us([&] { enqueue_for(data.size(), small); });
+
+  GrainSize tuner;
+  const f64 small_tuned = time_us([&] { dispatch.parallel_for(0, data.size(), small, tuner); });
+
+  console->info("  empty | parallel_for: {:8.2f}us | enqueue + future: {:8.2f}us", empty_new, empty_old);
+  console->info("  small | parallel_for: {:8.2f}us | tuned: {:8.2f}us | enqueue + future: {:8.2f}us | serial: {:8.2f}us",
+                small_new, small_tuned, small_old, small_serial);
+
+  // Skewed: item 'i' does 'i' units of work, like rows of an all pairs loop
+  constexpr size_t skewed_count = 2048;
+  vector<f32> out(skewed_count);
+  const auto skewed = [&out](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      f32 sum = 0.0f;
+      for (size_t k = 0; k < i; ++k) sum += std::sqrt(static_cast<f32>(k));
+      out[i] = sum;
+    }
+  };
+  constexpr s32 skewed_iterations = 20;
+  const auto time_ms = [](auto &&body)
+  {
+    const auto start = get_time();
+    for (s32 i = 0; i < skewed_iterations; ++i) body();
+    return (get_time() - start) * 1e3 / skewed_iterations;
+  };
+
+  const f64 skewed_even = time_ms([&] { dispatch.parallel_for(0, skewed_count, skewed, (skewed_count + threads - 1) / threads); });
+  const f64 skewed_dynamic = time_ms([&] { dispatch.parallel_for(0, skewed_count, skewed); });
+  const f64 skewed_weighted = time_ms([&] {
+    dispatch.parallel_for_weighted(0, skewed_count, [](size_t i) { return static_cast<f64>(i); }, skewed);
+  });
+
+  console->info(" skewed | one chunk per thread: {:8.3f}ms | dynamic: {:8.3f}ms | weighted: {:8.3f}ms",
+                skewed_even, skewed_dynamic, skewed_weighted);
+}
+
+// The particle arrays of a ParticleSystem, without the rest of it
+struct SpawnArrays
+{
+  vector<s32> id;
+  vector<vec2> position;
+  vector<vec2> velocity;
+  vector<f32> radius;
+  vector<f32> mass;
+  vector<vec4> color;
+};
+
+static void spawn_bulk(SpawnArrays &a, u32 count, EmitterShape shape, const EmitterParams &params, bool parallel) noexcept
+{
+  a.id.resize(count);
+  a.position.resize(count);
+  a.velocity.resize(count);
+  a.radius.resize(count);
+  a.mass.resize(count);
+  a.color.resize(count);
+
+  const f32 mass = kPI * params.radius * params.radius;
+  const auto fill = [&](size_t first, size_t last)
+  {
+    for (size_t i = first; i < last; ++i)
+    {
+      a.id[i] = static_cast<s32>(i);
+      emit_particle(shape, params, static_cast<u32>(i), a.position[i], a.velocity[i]);
+      a.radius[i] = params.radius;
+      a.mass[i] = mass;
+      a.color[i] = params.color;
+    }
+  };
+
+  if (parallel)
+    dispatch.parallel_for(0, count, fill);
+  else
+    fill(0, count);
+}
+
+void benchmark_spawn() noexcept
+{
+  constexpr u32 count = 1000000;
+  console->info("Spawn benchmark ({} particles, workers: {})", count, dispatch.size());
+
+  EmitterParams params;
+  params.center = vec2(512.0f, 512.0f);
+  params.size = vec2(1024.0f, 1024.0f);
+  params.spacing = 1.0f;
+  params.speed = 2.0f;
+  params.seed = 1337;
+
+  // One buffered closure per particle, like the old 'add'
+  {
+    SpawnArrays a;
+    vector<std::function<void()>> calls;
+    const auto start = get_time();
+    for (u32 i = 0; i < count; ++i)
+    {
+      const vec2 pos = rand_vec2(0.0f, 1024.0f);
+      const vec2 vel = rand_vec2(-params.speed, params.speed);
+      const f32 radius = params.radius;
+      const vec4 color = params.color;
+      calls.emplace_back([&a, pos, vel, radius, color]() {
+        a.id.emplace_back(static_cast<s32>(a.id.size()));
+        a.position.emplace_back(pos);
+        a.velocity.emplace_back(vel);
+        a.radius.emplace_back(radius);
+        a.mass.emplace_back(kPI * radius * radius);
+        a.color.emplace_back(color);
+      });
+    }
+    for (auto &c : calls) c();
+    console->info("  one at a time:       {:8.2f}ms", (get_time() - start) * 1000.0);
+  }
+
+  for (const auto shape : {EmitterShape::Point, EmitterShape::Disc, EmitterShape::Rectangle, EmitterShape::Grid})
+  {
+    SpawnArrays serial;
+    SpawnArrays parallel;
+
+    const auto serial_start = get_time();
+    spawn_bulk(serial, count, shape, params, false);
+    const f64 serial_time = get_time() - serial_start;
+
+    const auto parallel_start = get_time();
+    spawn_bulk(parallel, count, shape, params, true);
+    const f64 parallel_time = get_time() - parallel_start;
+
+    const bool same = serial.position == parallel.position && serial.velocity == parallel.velocity;
+    const char *names[] = {"point", "disc", "rectangle", "grid"};
+    console->info("  bulk {:>9}: serial {:8.2f}ms | parallel {:8.2f}ms | same scene: {}",
+                  names[static_cast<s32>(shape)], serial_time * 1000.0, parallel_time * 1000.0, same ? "yes" : "NO");
+  }
+}
@@ -0,0 +1,100 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+// Micro benchmarks for the simulation core.
+// They run on synthetic data and print their results to the console.
+// None of them need a window, see 'athi_bench --micro'. The checks at the
+// bottom return whether they passed, see 'athi_bench --check'.
+
+// Compares the build time of the pointer based Quadtree against
+// the LinearQuadtree at 10k, 100k and 1M particles.
+void benchmark_quadtree_build() noexcept;
+
+// Runs every narrowphase kernel the CPU supports on the same candidate
+// lists and reports pairs tested per second.
+void benchmark_narrowphase() noexcept;
+
+// Checks resolve_contact against the old trig based contact response, both
+// contact by contact and over a few seconds of trajectories, on a fixed
+// seed. Returns false if either drifts more than 1e-3 apart.
+bool check_contact_solver() noexcept;
+
+// Runs a small, fast moving pile with every broadphase, serial and on the
+// pool, and compares the contacts of each physics sample against testing
+// every pair. Returns false if one is missed, made up or listed twice.
+bool check_broadphase() noexcept;
+
+// Runs the same pile and checks that no particle shows up twice in one
+// batch of ParticleSystem::color_pairs, and that the batches hold every
+// pair exactly once.
+bool check_coloring() noexcept;
+
+// Runs check_contact_solver, then times both solvers on a dense pile.
+void benchmark_contact_solver() noexcept;
+
+// Compares the Barnes-Hut gravity at a range of theta against summing over
+// every pair, reporting time and the relative error of each particle's pull.
+void benchmark_barnes_hut() noexcept;
+
+// Times the tiled all-pairs gravity kernel, serial and on the Dispatch pool,
+// against the plain double loop, in interactions per second.
+void benchmark_nbody() noexcept;
+
+// Measures how long a parallel_for takes with an empty body and with a few
+// microseconds of work, against one enqueue and future per thread. Then
+// runs a skewed loop split evenly, in dynamic chunks and by cost.
+void benchmark_dispatch() noexcept;
+
+// Spawns 1M particles one closure and six emplace_backs at a time, like
+// 'add' used to, and in bulk like 'add_bulk', serial and on the Dispatch
+// pool. Also checks the parallel fill gives the same scene as the serial one.
+void benchmark_spawn() noexcept;
+
+struct MicroBenchmark
+{
+  const char *name;
+  void      (*run)() noexcept;
+};
+
+// Every benchmark above, by the name 'athi_bench --micro' knows it by.
+static constexpr MicroBenchmark micro_benchmarks[] = {
+  {"quadtree_build", benchmark_quadtree_build},
+  {"narrowphase",    benchmark_narrowphase},
+  {"contact_solver", benchmark_contact_solver},
+  {"barnes_hut",     benchmark_barnes_hut},
+  {"nbody",          benchmark_nbody},
+  {"dispatch",       benchmark_dispatch},
+  {"spawn",          benchmark_spawn},
+};
+
+struct CorrectnessCheck
+{
+  const char *name;
+  bool      (*run)() noexcept;
+};
+
+// The checks above, by the name 'athi_bench --check' knows them by.
+static constexpr CorrectnessCheck correctness_checks[] = {
+  {"contact_solver", check_contact_solver},
+  {"broadphase",     check_broadphase},
+  {"coloring",       check_coloring},
+};
@@ -0,0 +1,244 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <array> // std::array
+#include <atomic> // std::atomic
+#include <cstring> // memcpy
+#include <new> // operator new, std::align_val_t
+#include <thread> // std::this_thread::yield
+#include <type_traits> // std::decay_t
+#include <utility> // std::forward
+
+#include <glm/vec2.hpp> // glm::vec2
+#include <glm/vec4.hpp> // glm::vec4
+
+enum class CommandType : u8
+{
+  Spawn,    // 'count' particles at 'vec' with 'radius', 'color' and 'lifetime'
+  EraseAll,
+  Recolor,  // The 'count' particle ids in 'payload' get 'color'
+  Impulse,  // The 'count' particle ids in 'payload' get 'vec' added to their velocity
+  Drag,     // The 'count' particle ids in 'payload' are pulled towards the point 'vec'
+  Remove,   // The 'count' particle ids in 'payload' are removed
+  Call,     // run(payload)
+};
+
+struct Command
+{
+  Command           *next {nullptr};
+  CommandType       type {CommandType::Call};
+  bool              from_heap {false};  // The arena was full
+  u32               count {0};
+  f32               radius {0.0f};
+  f32               lifetime {0.0f};
+  glm::vec2         vec {0.0f, 0.0f};
+  glm::vec4         color {1.0f, 1.0f, 1.0f, 1.0f};
+  void              (*run)(void *payload) {nullptr};
+  void              *payload {nullptr};
+
+  const s32 *ids() const noexcept { return static_cast<const s32 *>(payload); }
+};
+
+// Commands for the particle system from any thread, run by one thread at
+// the start of the next frame.
+//
+// Producers push onto a lock-free list with a single CAS. The consumer takes
+// the whole list with one exchange. Commands and their payloads, closures
+// included, are bump allocated from one of two arenas. The consumer switches
+// arenas when it takes the list and resets the old one once the commands
+// have run, so a frame's commands cost no heap allocations.
+class CommandQueue
+{
+public:
+  static constexpr size_t kArenaSize = 256 * 1024;
+
+  void spawn(const glm::vec2 &position, f32 radius, const glm::vec4 &color, u32 count, f32 lifetime) noexcept
+  {
+    emit(CommandType::Spawn, 0, [&](Command &c) {
+      c.vec = position;
+      c.radius = radius;
+      c.color = color;
+      c.count = count;
+      c.lifetime = lifetime;
+    });
+  }
+
+  void erase_all() noexcept
+  {
+    emit(CommandType::EraseAll, 0, [](Command &) {});
+  }
+
+  void recolor(const s32 *ids, u32 count, const glm::vec4 &color) noexcept
+  {
+    emit(CommandType::Recolor, sizeof(s32) * count, [&](Command &c) {
+      std::memcpy(c.payload, ids, sizeof(s32) * count);
+      c.count = count;
+      c.color = color;
+    });
+  }
+
+  void impulse(const s32 *ids, u32 count, const glm::vec2 &impulse) noexcept
+  {
+    emit(CommandType::Impulse, sizeof(s32) * count, [&](Command &c) {
+      std::memcpy(c.payload, ids, sizeof(s32) * count);
+      c.count = count;
+      c.vec = impulse;
+    });
+  }
+
+  void drag(const s32 *ids, u32 count, const glm::vec2 &point) noexcept
+  {
+    emit(CommandType::Drag, sizeof(s32) * count, [&](Command &c) {
+      std::memcpy(c.payload, ids, sizeof(s32) * count);
+      c.count = count;
+      c.vec = point;
+    });
+  }
+
+  void remove(const s32 *ids, u32 count) noexcept
+  {
+    emit(CommandType::Remove, sizeof(s32) * count, [&](Command &c) {
+      std::memcpy(c.payload, ids, sizeof(s32) * count);
+      c.count = count;
+    });
+  }
+
+  // Anything else. 'f' is moved into the arena and destroyed after it has run.
+  template <class F>
+  void call(F &&f) noexcept
+  {
+    using Fn = std::decay_t<F>;
+    static_assert(alignof(Fn) <= kAlignment, "Closure needs more alignment than the arena gives.");
+
+    emit(CommandType::Call, sizeof(Fn), [&](Command &c) {
+      new (c.payload) Fn(std::forward<F>(f));
+      c.run = [](void *payload) {
+        auto &fn = *static_cast<Fn *>(payload);
+        fn();
+        fn.~Fn();
+      };
+    });
+  }
+
+  bool empty() const noexcept { return head.load(std::memory_order_relaxed) == nullptr; }
+
+  // Consumer only. Everything pushed so far, oldest first. Pass it to
+  // 'release' once the commands have run.
+  Command *take() noexcept
+  {
+    // New commands go to the other arena from now on. Wait for anyone still
+    // writing to this one, so every command in it is on the list.
+    const u32 taken = current.load();
+    current.store(taken ^ 1);
+    while (arenas[taken].writers.load() > 0) std::this_thread::yield();
+    taken_arena = taken;
+
+    // The list is newest first
+    Command *list = head.exchange(nullptr, std::memory_order_acquire);
+    Command *reversed = nullptr;
+    while (list)
+    {
+      Command *next = list->next;
+      list->next = reversed;
+      reversed = list;
+      list = next;
+    }
+    return reversed;
+  }
+
+  // Consumer only. Frees what 'take' returned.
+  void release(Command *list) noexcept
+  {
+    while (list)
+    {
+      Command *next = list->next;
+      if (list->from_heap) ::operator delete(list, std::align_val_t{kAlignment});
+      list = next;
+    }
+    arenas[taken_arena].used.store(0, std::memory_order_relaxed);
+  }
+
+private:
+  static constexpr size_t kAlignment = 16;
+
+  static constexpr size_t round_up(size_t size) noexcept
+  {
+    return (size + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  struct Arena
+  {
+    alignas(kAlignment) std::array<u8, kArenaSize> memory;
+    std::atomic<size_t> used {0};
+    std::atomic<s32> writers {0};  // Producers between allocating and pushing
+  };
+
+  // Allocates a command with 'payload_size' bytes after it, lets 'fill' set
+  // it up and pushes it.
+  template <class Fill>
+  void emit(CommandType type, size_t payload_size, Fill &&fill) noexcept
+  {
+    const size_t size = round_up(sizeof(Command)) + round_up(payload_size);
+
+    // Register as a writer, then make sure the consumer didn't switch arenas
+    // in between. If it did it may not wait for us, so try the new one.
+    Arena *arena;
+    for (;;)
+    {
+      const u32 index = current.load();
+      arena = &arenas[index];
+      arena->writers.fetch_add(1);
+      if (current.load() == index) break;
+      arena->writers.fetch_sub(1);
+    }
+
+    void *memory = nullptr;
+    bool from_heap = false;
+    const size_t offset = arena->used.fetch_add(size, std::memory_order_relaxed);
+    if (offset + size <= kArenaSize)
+      memory = arena->memory.data() + offset;
+    else
+    {
+      memory = ::operator new(size, std::align_val_t{kAlignment});
+      from_heap = true;
+    }
+
+    Command *command = new (memory) Command;
+    command->type = type;
+    command->from_heap = from_heap;
+    command->payload = static_cast<u8 *>(memory) + round_up(sizeof(Command));
+    fill(*command);
+
+    command->next = head.load(std::memory_order_relaxed);
+    while (!head.compare_exchange_weak(command->next, command, std::memory_order_release, std::memory_order_relaxed)) {}
+
+    arena->writers.fetch_sub(1);
+  }
+
+  std::array<Arena, 2> arenas;
+  std::atomic<u32> current {0};
+  u32 taken_arena {0};
+  std::atomic<Command *> head {nullptr};
+};
@@ -0,0 +1,99 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <cmath> // std::sqrt
+
+// Contact response between two circles of varying radius and mass.
+//
+// The contact normal is built once from dx/dy with a single sqrt and reused
+// for both the separation and the impulse. The border checks are selects
+// rather than branches, so a loop over a conflict free batch of pairs is
+// straight line code apart from the two early outs.
+//
+// Returns true if the circles overlapped.
+// @Hot
+inline bool resolve_contact(vec2 *position, vec2 *velocity, const f32 *radius, const f32 *mass,
+                            s32 a, s32 b, const vec2 &bounds, f32 energy_loss) noexcept
+{
+  const vec2 a_pos = position[a];
+  const vec2 b_pos = position[b];
+  const f32 ar = radius[a];
+  const f32 br = radius[b];
+
+  const f32 dx = b_pos.x - a_pos.x;
+  const f32 dy = b_pos.y - a_pos.y;
+  const f32 sum_radius = ar + br;
+  const f32 distance_sqrd = dx * dx + dy * dy;
+
+  if (distance_sqrd >= sum_radius * sum_radius) return false;
+
+  const f32 distance = std::sqrt(distance_sqrd);
+
+  // Unit normal from 'a' to 'b'. Circles on top of each other are pushed apart along x.
+  const bool coincident = distance < 1e-11f;
+  const f32 inv_distance = coincident ? 0.0f : 1.0f / distance;
+  const f32 nx = coincident ? 1.0f : dx * inv_distance;
+  const f32 ny = dy * inv_distance;
+
+  // Separate them, half each, unless that would push a circle through the border.
+  // This will become not needed when borders are segments instead of hardcoded.
+  const f32 depth = sum_radius - distance;
+  if (depth >= 1e-11f)
+  {
+    const f32 move_x = depth * 0.5f * nx;
+    const f32 move_y = depth * 0.5f * ny;
+
+    const f32 ax = a_pos.x - move_x;
+    const f32 ay = a_pos.y - move_y;
+    const f32 bx = b_pos.x + move_x;
+    const f32 by = b_pos.y + move_y;
+
+    position[a].x = (ax >= ar && ax <= bounds.x - ar) ? ax : a_pos.x;
+    position[a].y = (ay >= ar && ay <= bounds.y - ar) ? ay : a_pos.y;
+    position[b].x = (bx >= br && bx <= bounds.x - br) ? bx : b_pos.x;
+    position[b].y = (by >= br && by <= bounds.y - br) ? by : b_pos.y;
+  }
+
+  const vec2 a_vel = velocity[a];
+  const vec2 b_vel = velocity[b];
+  const f32 vdx = b_vel.x - a_vel.x;
+  const f32 vdy = b_vel.y - a_vel.y;
+
+  // Circles moving away from each other are left alone
+  if (dx * vdx + dy * vdy >= 1e-11f) return true;
+
+  // Elastic collision along the normal. The tangential velocity passes through
+  // untouched, so only the normal component needs to change.
+  const f32 m1 = mass[a];
+  const f32 m2 = mass[b];
+  const f32 normal_speed = nx * vdx + ny * vdy;
+  const f32 scale = 2.0f * normal_speed / (m1 + m2);
+  const f32 a_impulse = m2 * scale;
+  const f32 b_impulse = m1 * scale;
+
+  velocity[a] = vec2(a_vel.x + a_impulse * nx, a_vel.y + a_impulse * ny) * energy_loss;
+  velocity[b] = vec2(b_vel.x - b_impulse * nx, b_vel.y - b_impulse * ny) * energy_loss;
+
+  return true;
+}
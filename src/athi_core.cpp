@@ -34,7 +34,8 @@
 #include "./Renderer/athi_primitives.h" // draw_circle, draw_rects, draw_lines
 #include "athi_settings.h" // console, ThreadPoolSolution
 
-#include "athi_utility.h" // profile, Smooth_Average
+#include "athi_utility.h" // Smooth_Average
+#include "athi_profiler.h" // ATHI_PROFILE, profiler_frame
 #include "athi_window.h" // window
 #include "athi_dispatch.h" // dispatch
 
@@ -43,7 +44,7 @@
 
 #include <atomic> // atomic
 #include <mutex> // mutex
-#include <condition_variable> // condition_variable
+#include <thread> // thread
 #include <algorithm>
 
 #include <GL/glew.h>
@@ -59,11 +60,6 @@ static Smooth_Average<f64, 30> smooth_render_rametime_avg(&smoothed_render_frame
 
 static Renderer renderer;
 
-static bool ready_to_draw{false};
-
-static std::mutex draw_mutex;
-static std::condition_variable can_draw_cond;
-
 static void setup_fullscreen_quad()
 {
   auto &shader = renderer.make_shader();
@@ -127,6 +123,7 @@ void Athi_Core::init()
 {
   spdlog::set_pattern("[%H:%M:%S] %v");
   console = spdlog::stdout_color_mt("Athi");
+  profiler_set_thread_name("main");
   if constexpr (DEBUG_MODE) console->critical("DEBUG MODE: ON");
   if constexpr (multithreaded_engine) console->critical("MULTITHREADED ENGINE: ON");
 
@@ -138,10 +135,12 @@ void Athi_Core::init()
 
   gui_init(get_window_context(), px_scale);
   variable_thread_count = std::thread::hardware_concurrency();
+  dispatch.init();
 
   // Debug information
   console->info("{} {}", FRED("CPU:"), get_cpu_brand());
   console->info("Threads available: {}", std::thread::hardware_concurrency());
+  console->info("Physical cores: {} (dispatch threads: {})", physical_core_count(), dispatch.size());
   console->info("IMGUI VERSION {}", ImGui::GetVersion());
   console->info("GLM VERSION {}", "0.9.8");
   console->info("GL_VERSION {}", glGetString(GL_VERSION));
@@ -159,6 +158,7 @@ void Athi_Core::init()
   init_rect_renderer();
   init_input_manager();
   entity_manager.init();
+  build_frame_graph();
 
   custom_gui_init();
 
@@ -179,14 +179,19 @@ void Athi_Core::start()
   framebuffers.resize(1);
   framebuffers[0].resize(framebuffer_width, framebuffer_height);
 
-  std::future<void> update_fut;
+  // Physics gets a thread of its own instead of a pool worker, so the pool
+  // keeps all its workers for the stages of the frame.
+  std::thread physics_thread;
   if constexpr (multithreaded_engine) {
-    update_fut = dispatch.enqueue(&Athi_Core::physics_loop, this);
+    physics_thread = std::thread(&Athi_Core::physics_loop, this);
   }
 
+  auto time_last_frame = get_time();
   while (!glfwWindowShouldClose(window_context))
   {
     const auto time_start_frame = get_time();
+    const auto time_since_last_frame = time_start_frame - time_last_frame;
+    time_last_frame = time_start_frame;
 
     //@Hack @Apple: GLFW 3.2.1 has a bug that ignores vsync when not visible
     if (glfwGetWindowAttrib(window_context, GLFW_VISIBLE))
@@ -200,43 +205,42 @@ void Athi_Core::start()
 
     if constexpr (multithreaded_engine)
     {
-      // GPU draw
+      // Input changes particles directly, so it waits for the physics step in progress
       {
-        std::unique_lock<std::mutex> lock(draw_mutex);
-        can_draw_cond.wait(lock, []() { return ready_to_draw; });
-
-        // Input
+        std::unique_lock<std::mutex> lock(particle_system.particles_mutex);
         update_inputs();
+      }
 
-        // GPU draw
-        draw(window_context);
+      // GPU draw. Draws the newest snapshot physics published, without waiting for it.
+      draw(window_context);
 
-        ready_to_draw = false;
-        can_draw_cond.notify_one();
-      }
     // Single threaded engine
     } else {
 
       // Input
       update_inputs();
 
-      // CPU Update
-      update(1.0f/60.0f);
+      // CPU Update. Whatever the last frame took, in fixed steps, and the
+      // particles are drawn however far we are into the next one.
+      step_physics(time_since_last_frame);
+      particle_system.render_alpha = fixed_step.alpha(1.0 / std::max(physics_tick_rate, 1));
 
       // GPU draw
       draw(window_context);
     }
 
     if (framerate_limit != 0) limit_FPS(framerate_limit, time_start_frame);
+    profiler_frame();
     frametime = (get_time() - time_start_frame) * 1000.0;
     framerate = static_cast<u32>(std::round(1000.0f / smoothed_frametime));
     smooth_frametime_avg.add_new_frametime(frametime);
+    record_frame_history();
   }
 
   app_is_running = false;
 
   if constexpr (multithreaded_engine) {
-    update_fut.get();
+    physics_thread.join();
   }
 
   shutdown();
@@ -244,13 +248,16 @@ void Athi_Core::start()
 
 void Athi_Core::draw(GLFWwindow *window)
 {
+  ATHI_PROFILE("draw");
   const auto time_start_frame = get_time();
   glClearColor(background_color.r, background_color.g, background_color.b, background_color.a); check_gl_error();
 
   glClear(GL_COLOR_BUFFER_BIT); check_gl_error();
 
   // Upload gpu buffers
+  const auto time_start_upload = get_time();
   particle_system.gpu_buffer_update();
+  gpu_upload_frametime = (get_time() - time_start_upload) * 1000.0;
 
   // @Hot: We seem to be fillrate limited.
   //  Igpus have a hard time at higher resolutions.
@@ -271,7 +278,12 @@ void Athi_Core::draw(GLFWwindow *window)
     draw_fullscreen_quad(framebuffers[0].texture, vec2(0, 0));
   }
 
-  particle_system.draw_debug_nodes();
+  {
+    // The debug view reads the trees, which the physics thread rebuilds
+    std::unique_lock<std::mutex> lock(particle_system.particles_mutex, std::defer_lock);
+    if (multithreaded_engine && draw_debug) lock.lock();
+    particle_system.draw_debug_nodes();
+  }
 
   // Draw entities
   entity_manager.draw();
@@ -293,6 +305,7 @@ void Athi_Core::draw(GLFWwindow *window)
   }
 
   {
+    ATHI_PROFILE("swap_buffers");
     glfwSwapBuffers(window);
   }
 
@@ -302,27 +315,70 @@ void Athi_Core::draw(GLFWwindow *window)
 
 }
 
+// With the multithreaded engine the physics lanes are whatever frame the
+// physics thread finished last, so they can repeat or skip frames.
+void Athi_Core::record_frame_history() noexcept
+{
+  FrameHistory::Frame frame;
+  for (u32 i = 0; i < kStageCount; ++i) {
+    frame.ms[i] = static_cast<f32>(frame_times.seconds[i] * 1000.0);
+  }
+  frame.ms[kGpuUploadLane] = static_cast<f32>(gpu_upload_frametime);
+  frame.ms[kDrawLane] = static_cast<f32>(std::max(0.0, render_frametime - gpu_upload_frametime));
+  frame.total_ms = static_cast<f32>(frametime);
+  frame_history.record(frame);
+}
+
+void Athi_Core::build_frame_graph()
+{
+  auto &graph = frame_graph;
+
+  // Entities and the color cycle don't touch particles, so they depend on nothing
+  graph.add("entities", [this] { entity_manager.update(frame_dt); });
+  graph.add("color cycle", [] {
+    if (cycle_particle_color) circle_color = color_over_time(get_time());
+  });
+
+  // Buffered calls add and recolor particles, so they go before anything that touches them.
+  const auto buffered_calls = graph.add("buffered calls", [] { particle_system.execute_buffered_calls(); });
+  const auto expire = graph.add("expire", [this] {
+    particle_system.begin_frame();
+    particle_system.expire(frame_dt);
+  });
+  const auto reorder = graph.add("reorder", [] { particle_system.reorder_if_due(); });
+  // Colors only read positions and velocities. They show the state the frame
+  // started with, which is one step behind the positions that get drawn.
+  // The tree is built inside 'simulate', once for every physics sample.
+  const auto colors = graph.add("colors", [] { particle_system.update_colors(); });
+  const auto simulate = graph.add("simulate", [this] { particle_system.simulate(frame_dt); });
+  const auto n_body = graph.add("n-body", [] {
+    if (use_gravitational_force) particle_system.apply_n_body();
+  });
+  const auto stats = graph.add("stats", [] { particle_system.end_frame(); });
+
+  graph.depend(expire, buffered_calls);
+  graph.depend(reorder, expire);
+  graph.depend(colors, reorder);
+  graph.depend(simulate, reorder);
+  graph.depend(simulate, colors);
+  graph.depend(n_body, simulate);
+  graph.depend(stats, n_body);
+}
+
 void Athi_Core::update(float dt)
 {
+  ATHI_PROFILE("update");
   const auto time_start_frame = get_time();
 
-  // Update entities
-  entity_manager.update(dt);
+  frame_dt = dt;
+  frame_graph.run(dispatch, use_multithreading);
 
-  // Update objects
-  particle_system.update(dt);
-
-  if (use_gravitational_force)
+  if (dump_critical_path)
   {
-    particle_system.apply_n_body();
+    frame_critical_path = frame_graph.critical_path_string();
+    console->info("Critical path: {}", frame_critical_path);
   }
 
-  if (cycle_particle_color)
-    circle_color = color_over_time(get_time());
-
-  // Update objects gpu data
-  particle_system.update_data();
-
   // Update timers
   physics_frametime = (get_time() - time_start_frame) * 1000.0;
   physics_framerate = static_cast<u32>(std::round(1000.0f / smoothed_physics_frametime));
@@ -330,34 +386,41 @@ void Athi_Core::update(float dt)
   timestep = dt;
 }
 
-void Athi_Core::draw_loop()
+// Runs as many steps of 1/physics_tick_rate seconds as 'elapsed' seconds
+// of real time call for, but no more than 'max_substeps'. Returns how many ran.
+u32 Athi_Core::step_physics(f64 elapsed)
 {
-  auto window_context = get_window_context();
-  glfwMakeContextCurrent(window_context);
-  while (app_is_running)
-  {
-    {
-      std::unique_lock<std::mutex> lock(draw_mutex);
-      can_draw_cond.wait(lock, []() { return ready_to_draw; });
+  const f64 step = 1.0 / std::max(physics_tick_rate, 1);
+  const u32 steps = fixed_step.advance(elapsed, step, static_cast<u32>(std::max(max_substeps, 1)));
 
-      draw(window_context);
-      ready_to_draw = false;
-    }
-    can_draw_cond.notify_one();
+  // Every step's stage times go in, so the frame timeline shows all of them
+  StageTimes step_times;
+  for (u32 i = 0; i < steps; ++i)
+  {
+    update(static_cast<f32>(step));
+    for (u32 s = 0; s < kStageCount; ++s) step_times.seconds[s] += frame_times.seconds[s];
   }
+  frame_times = step_times;
+
+  return steps;
 }
 
 void Athi_Core::physics_loop()
 {
+  profiler_set_thread_name("physics");
+  auto time_last_step = get_time();
   while (app_is_running)
   {
+    const auto time_start_frame = get_time();
+
     {
-      std::unique_lock<std::mutex> lock(draw_mutex);
-      can_draw_cond.wait(lock, []() { return !ready_to_draw; });
-      update(1.0f/60.0f);
-      ready_to_draw = true;
-      can_draw_cond.notify_one();
+      std::unique_lock<std::mutex> lock(particle_system.particles_mutex);
+      if (step_physics(time_start_frame - time_last_step) > 0) particle_system.publish_snapshot();
     }
+    time_last_step = time_start_frame;
+
+    // Wake up about when the next step is due, however fast the frames are drawn
+    limit_FPS(std::max(physics_tick_rate, 1), time_start_frame);
   }
 }
 
@@ -23,6 +23,8 @@
 
 #include "athi_window.h"
 #include "entity.h"
+#include "athi_task_graph.h" // TaskGraph
+#include "athi_fixed_step.h" // FixedStep
 #include "./Renderer/athi_circle.h"
 
 #include "athi_utility.h"
@@ -31,11 +33,22 @@ struct Athi_Core {
 
   EntityManager entity_manager;
 
+  // The stages of 'update' and what they wait on, see build_frame_graph
+  TaskGraph frame_graph;
+  float frame_dt{0.0f};
+
+  // Real time not yet simulated, see step_physics
+  FixedStep fixed_step;
+
   void update(float dt);
+  u32 step_physics(f64 elapsed);
+  void build_frame_graph();
   void draw(GLFWwindow *window);
 
+  // Adds the frame that just finished to 'frame_history'
+  void record_frame_history() noexcept;
+
   void window_loop();
-  void draw_loop();
   void physics_loop();
 
   void init();
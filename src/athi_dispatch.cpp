@@ -1,3 +1,368 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
 #include "athi_dispatch.h"
 
+#include "athi_profiler.h" // ATHI_PROFILE, profiler_set_thread_name
+
+#include <cstdio> // snprintf
+#include <set> // std::set
+#include <fstream> // std::ifstream
+
+#ifdef _WIN32
+  #include <windows.h> // GetLogicalProcessorInformation
+#elif defined(__APPLE__)
+  #include <sys/sysctl.h> // sysctlbyname
+#endif
+
 Dispatch dispatch;
+
+// Which worker of which pool this thread is.
+static thread_local const Dispatch *tls_pool{nullptr};
+static thread_local s32 tls_worker{-1};
+
+// The external deque this thread holds, if it isn't a worker. Gives it back
+// when the thread exits. The main thread's thread locals go before the
+// global pool does, so 'pool' is still alive then.
+struct ExternalDeque
+{
+  Dispatch *pool {nullptr};
+  s32 index {-1};
+  u32 generation {0};
+
+  ~ExternalDeque()
+  {
+    if (pool) pool->release_external(index, generation);
+  }
+};
+static thread_local ExternalDeque tls_external;
+
+s32 physical_core_count() noexcept
+{
+  const s32 threads = std::max(1u, std::thread::hardware_concurrency());
+  s32 cores = 0;
+
+#ifdef _WIN32
+  DWORD length = 0;
+  GetLogicalProcessorInformation(nullptr, &length);
+  vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> info(length / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+  if (!info.empty() && GetLogicalProcessorInformation(info.data(), &length))
+  {
+    for (const auto &i: info)
+      cores += (i.Relationship == RelationProcessorCore);
+  }
+#elif defined(__APPLE__)
+  s32 physical = 0;
+  size_t size = sizeof(physical);
+  if (sysctlbyname("hw.physicalcpu", &physical, &size, nullptr, 0) == 0)
+    cores = physical;
+#else
+  // Every distinct (physical id, core id) pair in /proc/cpuinfo is a core
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  std::set<std::pair<s32, s32>> seen;
+  s32 package = 0;
+  string line;
+  while (std::getline(cpuinfo, line))
+  {
+    const auto colon = line.find(':');
+    if (colon == string::npos) continue;
+    if (line.compare(0, 11, "physical id") == 0)
+      package = std::atoi(line.c_str() + colon + 1);
+    else if (line.compare(0, 7, "core id") == 0)
+      seen.emplace(package, std::atoi(line.c_str() + colon + 1));
+  }
+  cores = static_cast<s32>(seen.size());
+#endif
+
+  return (cores > 0 && cores <= threads) ? cores : threads;
+}
+
+Dispatch::~Dispatch()
+{
+  stop_workers();
+  if (tls_external.pool == this) tls_external.pool = nullptr;
+}
+
+void Dispatch::init(s32 thread_count)
+{
+  if (!workers.empty()) return;
+  start_workers(thread_count);
+}
+
+void Dispatch::resize(s32 thread_count)
+{
+  stop_workers();
+  start_workers(thread_count);
+}
+
+void Dispatch::start_workers(s32 thread_count)
+{
+  assert(thread_count > 0 && "0 threads doesn't make sense.");
+
+  // The thread calling parallel_for does its share, so it's one less worker.
+  // Always keep one, or enqueued jobs would never run.
+  stop = false;
+  worker_count = std::max(thread_count - 1, 1);
+  deque_count = worker_count + kMaxExternalThreads;
+  deques = std::make_unique<WorkStealingDeque[]>(deque_count);
+  {
+    std::lock_guard<std::mutex> lock(external_mutex);
+    external_free = (1u << kMaxExternalThreads) - 1;
+    generation.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  workers.reserve(worker_count);
+  for (s32 i = 0; i < worker_count; ++i)
+    workers.emplace_back([this, i] { worker_loop(i); });
+}
+
+void Dispatch::stop_workers()
+{
+  stop = true;
+  wake_workers();
+  for (auto&& worker : workers) worker.join();
+  workers.clear();
+}
+
+void Dispatch::wake_workers() noexcept
+{
+  epoch.fetch_add(1);
+  if (sleeping.load() > 0)
+  {
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    sleep_condition.notify_all();
+  }
+}
+
+Task *Dispatch::steal(s32 self) noexcept
+{
+  if (deque_count == 0) return nullptr;
+
+  // Start somewhere different every time so the thieves spread out
+  static thread_local u32 seed = 0x9e3779b9u;
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  const s32 start = static_cast<s32>(seed % static_cast<u32>(deque_count));
+
+  for (s32 k = 0; k < deque_count; ++k)
+  {
+    const s32 victim = (start + k) % deque_count;
+    if (victim == self) continue;
+    if (Task *task = deques[victim].steal()) return task;
+  }
+  return nullptr;
+}
+
+void Dispatch::execute(Task *task)
+{
+  ATHI_PROFILE("task");
+  task->run(task->context);
+  if (task->pending) task->pending->fetch_sub(1, std::memory_order_release);
+}
+
+bool Dispatch::run_enqueued()
+{
+  std::function<void()> task;
+  {
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    if (tasks.empty()) return false;
+    task = std::move(tasks.front());
+    tasks.pop();
+  }
+  task();
+  return true;
+}
+
+s32 Dispatch::local_index() noexcept
+{
+  if (tls_pool == this) return tls_worker;
+  if (tls_external.pool == this && tls_external.generation == generation.load(std::memory_order_relaxed))
+    return tls_external.index;
+  return claim_external();
+}
+
+s32 Dispatch::claim_external() noexcept
+{
+  // Not started, or this thread has a deque of another pool
+  if (workers.empty()) return -1;
+  if (tls_external.pool != nullptr && tls_external.pool != this) return -1;
+
+  std::lock_guard<std::mutex> lock(external_mutex);
+  if (external_free == 0) return -1;
+
+  u32 slot = 0;
+  while (!(external_free & (1u << slot))) ++slot;
+  external_free &= ~(1u << slot);
+
+  tls_external.pool = this;
+  tls_external.index = worker_count + static_cast<s32>(slot);
+  tls_external.generation = generation.load(std::memory_order_relaxed);
+  return tls_external.index;
+}
+
+void Dispatch::release_external(s32 index, u32 owner_generation) noexcept
+{
+  std::lock_guard<std::mutex> lock(external_mutex);
+  // The workers were restarted since, and the deque with them
+  if (owner_generation != generation.load(std::memory_order_relaxed)) return;
+  external_free |= 1u << (index - worker_count);
+}
+
+bool Dispatch::push_local(Task *task)
+{
+  const s32 self = local_index();
+  return self >= 0 && deques[self].push(task);
+}
+
+Task *Dispatch::pop_local()
+{
+  const s32 self = local_index();
+  return (self >= 0) ? deques[self].pop() : nullptr;
+}
+
+void Dispatch::submit(Task *task)
+{
+  if (!push_local(task))
+  {
+    execute(task);
+    return;
+  }
+  wake_workers();
+}
+
+void Dispatch::wait(const std::atomic<s32> &pending)
+{
+  ATHI_PROFILE("wait");
+  const s32 self = local_index();
+  while (pending.load(std::memory_order_acquire) > 0)
+  {
+    Task *task = pop_local();
+    if (task == nullptr) task = steal(self);
+    if (task != nullptr)
+      execute(task);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void Dispatch::run_job(void *job, void (*run)(void *), size_t max_helpers)
+{
+  ATHI_PROFILE("parallel_for");
+  const s32 self = local_index();
+
+  // Helpers live on this stack, which is why we wait for all of them below.
+  const s32 helper_count = static_cast<s32>(std::min({max_helpers, static_cast<size_t>(worker_count), static_cast<size_t>(kMaxHelpers)}));
+  std::array<Task, kMaxHelpers> helpers;
+  std::atomic<s32> pending{0};
+
+  for (s32 h = 0; h < helper_count; ++h)
+  {
+    helpers[h].run = run;
+    helpers[h].context = job;
+    helpers[h].pending = &pending;
+    pending.fetch_add(1, std::memory_order_relaxed);
+    if (!push_local(&helpers[h]))
+    {
+      pending.fetch_sub(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+  if (helper_count > 0) wake_workers();
+
+  run(job);
+
+  // Take back the helpers nobody picked up. They'd find no chunks left anyway.
+  while (pending.load(std::memory_order_acquire) > 0)
+  {
+    Task *task = pop_local();
+    if (task == nullptr) break;
+    if (task->context != job)
+    {
+      // Belongs to a job further down this thread's stack
+      push_local(task);
+      break;
+    }
+    pending.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  // The rest are running. Help out elsewhere while they finish.
+  if (pending.load(std::memory_order_acquire) == 0) return;
+
+  ATHI_PROFILE("wait for helpers");
+  while (pending.load(std::memory_order_acquire) > 0)
+  {
+    if (Task *task = steal(self))
+      execute(task);
+    else
+      std::this_thread::yield();
+  }
+}
+
+void Dispatch::worker_loop(s32 index)
+{
+  tls_pool = this;
+  tls_worker = index;
+
+  char name[32];
+  std::snprintf(name, sizeof(name), "worker %d", index + 1);
+  profiler_set_thread_name(name);
+
+  // Rounds of looking for work before going to sleep
+  constexpr s32 kSpinRounds = 64;
+
+  s32 idle = 0;
+  while (!stop)
+  {
+    const u32 seen = epoch.load();
+
+    Task *task = deques[index].pop();
+    if (task == nullptr) task = steal(index);
+    if (task != nullptr)
+    {
+      execute(task);
+      idle = 0;
+      continue;
+    }
+
+    if (run_enqueued())
+    {
+      idle = 0;
+      continue;
+    }
+
+    if (++idle < kSpinRounds)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+
+    // Nothing came in for a while. Sleep until someone pushes work.
+    ATHI_PROFILE("sleep");
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    sleeping.fetch_add(1);
+    sleep_condition.wait(lock, [this, seen] { return stop || epoch.load() != seen; });
+    sleeping.fetch_sub(1);
+    idle = 0;
+  }
+
+  // Finish what was enqueued before shutting down
+  while (run_enqueued()) {}
+}
@@ -24,59 +24,202 @@
 #include "./Utility/athi_constant_globals.h" // os
 #include "./athi_utility.h" // get_begin_and_end
 
+#include <algorithm> // std::min
+#include <array> // std::array
+#include <atomic> // std::atomic
+#include <chrono> // steady_clock
 #include <thread> // thread
 #include <cassert> // assert
 #include <condition_variable> // condition_variable
 #include <mutex> // mutex
 #include <functional> // std::function<void()>
 #include <future> // std::future
+#include <memory> // std::unique_ptr
 #include <queue> // std::queue
+#include <type_traits> // std::remove_reference_t
 
 #ifdef __APPLE__
   #include <dispatch/dispatch.h>  // dispatch_apply
 #endif
 
-class Dispatch {
- private:
-  s32 num_workers;
-  std::mutex queue_mutex;
-  std::condition_variable condition;
-  bool stop{false};
+// Number of physical cores, or the number of hardware threads if that can't be found.
+s32 physical_core_count() noexcept;
 
- public:
-  std::queue<std::function<void()>> tasks;
-  vector<std::thread> workers;
-  s32 size() { return num_workers; }
-  bool stopped() { return stop; }
-  Dispatch(s32 num_workers = std::thread::hardware_concurrency() * 2) {
-    assert(num_workers != 0 && "0 workers doesn't make sense.");
-    workers.resize(num_workers);
-    this->num_workers = num_workers;
-    for (auto&& worker : workers) {
-      worker = std::thread([this] {
-        while (true) {
-          std::function<void()> task;
-          {
-            std::unique_lock<std::mutex> lock(queue_mutex);
-            condition.wait(lock, [this] { return stop || !tasks.empty(); });
-            if (stop && tasks.empty()) return;
-            task = std::move(tasks.front());
-            tasks.pop();
-          }
-          task();
-        }
-      });
-    }
+// A unit of work the scheduler can pass around without allocating. Whoever
+// pushes it owns the storage and must keep it alive until it has run.
+struct Task
+{
+  void (*run)(void *context) {nullptr};
+  void *context {nullptr};
+  std::atomic<s32> *pending {nullptr}; // Decremented once the task has run
+};
+
+// Chase-Lev work stealing deque of fixed capacity.
+//
+// The owning thread pushes and pops at the bottom, any other thread may steal
+// from the top. Only steals and the owner taking the last item touch the same
+// end, and those are settled with a single CAS on 'top'.
+class WorkStealingDeque
+{
+public:
+  static constexpr s64 kCapacity = 1024;
+
+  // Owner only. Returns false when full, the caller should run the task itself.
+  bool push(Task *task) noexcept
+  {
+    const s64 b = bottom.load(std::memory_order_relaxed);
+    const s64 t = top.load(std::memory_order_acquire);
+    if (b - t >= kCapacity) return false;
+
+    buffer[b & kMask].store(task, std::memory_order_relaxed);
+    bottom.store(b + 1, std::memory_order_release);
+    return true;
   }
-  ~Dispatch() {
+
+  // Owner only. Takes the most recently pushed task.
+  Task *pop() noexcept
+  {
+    const s64 b = bottom.load(std::memory_order_relaxed) - 1;
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    s64 t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
     {
-      std::unique_lock<std::mutex> lock(queue_mutex);
-      stop = true;
+      bottom.store(b + 1, std::memory_order_relaxed);
+      return nullptr;
     }
-    condition.notify_all();
-    for (auto&& worker : workers) worker.join();
+
+    Task *task = buffer[b & kMask].load(std::memory_order_relaxed);
+    if (t == b)
+    {
+      // Last one. Race the thieves for it.
+      if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        task = nullptr;
+      bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+  }
+
+  // Any thread. Takes the oldest task.
+  Task *steal() noexcept
+  {
+    s64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const s64 b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+
+    Task *task = buffer[t & kMask].load(std::memory_order_relaxed);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+      return nullptr;
+    return task;
+  }
+
+private:
+  static constexpr s64 kMask = kCapacity - 1;
+
+  // On separate cache lines, thieves hammer 'top' while the owner works on 'bottom'
+  alignas(64) std::atomic<s64> top {0};
+  alignas(64) std::atomic<s64> bottom {0};
+  alignas(64) std::array<std::atomic<Task *>, kCapacity> buffer {};
+};
+
+// Cuts [first, last) into 'parts' ranges of roughly equal total 'cost(i)'.
+// Writes the parts + 1 boundaries to 'bounds'.
+template <class Cost>
+void split_by_cost(size_t first, size_t last, Cost &&cost, size_t parts, size_t *bounds)
+{
+  f64 total = 0.0;
+  for (size_t i = first; i < last; ++i) total += cost(i);
+
+  bounds[0] = first;
+  size_t part = 1;
+  f64 sum = 0.0;
+  for (size_t i = first; i < last && part < parts; ++i)
+  {
+    sum += cost(i);
+    // Cut once this part has its share
+    while (part < parts && sum >= total * part / parts)
+      bounds[part++] = i + 1;
+  }
+  while (part <= parts) bounds[part++] = last;
+}
+
+// Picks the chunk size for one call site of 'parallel_for' from how long its
+// items took the last few times, aiming for chunks of kTargetChunkTime.
+// Keep one around per call site.
+class GrainSize
+{
+public:
+  static constexpr f64 kTargetChunkTime = 50e-6;  // Seconds
+  static constexpr f64 kInlineTime = 20e-6;       // Ranges expected to take less run on the caller
+
+  size_t grain(size_t count, size_t max_chunks) const noexcept
+  {
+    // Until something has been measured, split evenly
+    const size_t even = (count + max_chunks - 1) / max_chunks;
+    if (seconds_per_item <= 0.0) return even;
+
+    const size_t tuned = static_cast<size_t>(kTargetChunkTime / seconds_per_item);
+    return std::max(std::min(tuned, count), even);
   }
 
+  bool run_inline(size_t count) const noexcept
+  {
+    return seconds_per_item > 0.0 && seconds_per_item * count < kInlineTime;
+  }
+
+  void record(size_t count, f64 seconds) noexcept
+  {
+    const f64 measured = seconds / static_cast<f64>(count);
+    seconds_per_item = (seconds_per_item <= 0.0) ? measured : seconds_per_item * 0.9 + measured * 0.1;
+  }
+
+private:
+  f64 seconds_per_item {0.0};
+};
+
+// Work stealing thread pool.
+//
+// Every worker owns a WorkStealingDeque. 'parallel_for' pushes a handful of
+// helper tasks onto the caller's deque, then works on the range itself. The
+// helpers and the caller take chunks off a shared counter until none are
+// left, so an idle worker that steals a helper joins in and a busy one
+// simply doesn't. Nothing is allocated: the tasks live on the caller's stack,
+// which is why 'parallel_for' blocks until every helper is done.
+//
+// Threads that aren't workers, like the main and physics threads, get a
+// deque of their own the first time they push work and give it back when
+// they exit. There are kMaxExternalThreads of them. A thread that finds
+// them all taken, or that already holds one of another pool, runs its work
+// on its own.
+//
+// No threads are started until 'init', so the global pool doesn't start any
+// during static initialization. Until then everything runs on the caller.
+//
+// 'enqueue' is for long running jobs that need a future, like the physics
+// loop, and still goes through a locked queue.
+class Dispatch {
+ public:
+  // Chunks per thread in 'parallel_for'. More gives better balance, fewer less overhead.
+  static constexpr size_t kChunksPerThread = 4;
+
+  // Threads taking part in a 'parallel_for', including the caller. Containers
+  // of this size give every participant exactly one element.
+  s32 size() const noexcept { return worker_count + 1; }
+  bool stopped() const noexcept { return stop; }
+
+  Dispatch() = default;
+  ~Dispatch();
+
+  // Starts the workers, unless they're running already. 'thread_count'
+  // includes the thread calling 'parallel_for', so one fewer worker is started.
+  void init(s32 thread_count = physical_core_count());
+
+  // Joins the workers and starts 'thread_count' - 1 new ones. Only call it
+  // when nothing is running on the pool, like between frames.
+  void resize(s32 thread_count);
+
   template <class F, class... Args>
   auto enqueue(F&& f, Args&&... args) -> std::future<std::result_of_t<F(Args...)>> {
     using return_type = std::result_of_t<F(Args...)>;
@@ -86,46 +229,220 @@ class Dispatch {
     {
       std::unique_lock<std::mutex> lock(queue_mutex);
       if (stop) throw std::runtime_error("enqueue on stopped ThreadPool");
+      if (workers.empty())
+      {
+        // Not started, nobody else would ever run it
+        lock.unlock();
+        (*task)();
+        return result;
+      }
       tasks.emplace([task]() { (*task)(); });
     }
-    condition.notify_one();
+    wake_workers();
     return result;
   }
 
   template <class Container, class F>
   void parallel_for_each(Container& container, F&& f)
   {
-    // Precalculate beginnings and ends
-    vector<std::tuple<size_t,size_t>> begin_ends(num_workers);
+    parallel_for(0, container.size(), std::forward<F>(f));
+  }
 
-    for (s32 i = 0; i < num_workers; ++i)
-      begin_ends[i] = get_begin_and_end(i, container.size(), num_workers);
+  // Splits [first, last) into chunks of 'grain' items and calls f(begin, end)
+  // on each, on this thread and on any worker that is free. Chunks are handed
+  // out one at a time, so uneven chunks even out. A grain of 0 makes
+  // kChunksPerThread chunks per thread. Returns once every chunk is done.
+  template <class F>
+  void parallel_for(size_t first, size_t last, F&& f, size_t grain = 0)
+  {
+    if (last <= first) return;
+    const size_t count = last - first;
+    if (grain == 0) grain = (count + size() * kChunksPerThread - 1) / (size() * kChunksPerThread);
 
-    if constexpr (os == OS::Apple)
+    // Too small to share
+    if (grain >= count)
     {
-        // Using Apple's GCD
-#ifdef __APPLE__
-        dispatch_apply(num_workers, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t i) {
-            const auto [begin, end] = begin_ends[i];
-            f(begin, end);
-        });
-#endif
+      f(first, last);
+      return;
+    }
+
+    ForJob<std::remove_reference_t<F>> job{f, first, last, grain, (count + grain - 1) / grain};
+    run(job);
+  }
+
+  // Same, but the chunk size comes from how long the items took last time.
+  // Ranges that are expected to finish quickly run on this thread only.
+  template <class F>
+  void parallel_for(size_t first, size_t last, F&& f, GrainSize &tuner)
+  {
+    if (last <= first) return;
+    const size_t count = last - first;
+
+    if (tuner.run_inline(count))
+    {
+      const auto start = std::chrono::steady_clock::now();
+      f(first, last);
+      tuner.record(count, std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count());
+      return;
+    }
 
-    } else {
+    const size_t grain = tuner.grain(count, size() * kChunksPerThread);
+    ForJob<std::remove_reference_t<F>> job{f, first, last, grain, (count + grain - 1) / grain};
+    job.timed = true;
+    run(job);
+    tuner.record(count, job.nanoseconds.load() * 1e-9);
+  }
 
-        // Use the naive thread pool
-        vector<std::future<void>> results(num_workers);
+  // For items that cost very different amounts. 'cost(i)' is an estimate of
+  // the work for item 'i', like the number of pairs in a leaf. The range is
+  // cut so every chunk costs about the same.
+  template <class Cost, class F>
+  void parallel_for_weighted(size_t first, size_t last, Cost&& cost, F&& f)
+  {
+    if (last <= first) return;
+
+    std::array<size_t, kMaxWeightedChunks + 1> bounds;
+    const size_t chunk_count = std::min({last - first, static_cast<size_t>(size()) * kChunksPerThread, kMaxWeightedChunks});
+    split_by_cost(first, last, cost, chunk_count, bounds.data());
+
+    ForJob<std::remove_reference_t<F>> job{f, first, last, 0, chunk_count};
+    job.bounds = bounds.data();
+    run(job);
+  }
 
-        for (s32 i = 0; i < num_workers; ++i)
-        {
-            const auto [begin, end] = begin_ends[i];
-            results[i] = enqueue(std::forward<F>(f), begin, end);
-        }
+  // Pushes 'task' where a free worker can steal it, or runs it right away if
+  // there's no room. Tasks may submit more tasks. Like the helpers in
+  // 'parallel_for' the caller owns the storage, see 'wait'.
+  void submit(Task *task);
 
-        for (auto &&res : results)
-          res.get();
+  // Runs and steals tasks until 'pending' drops to zero.
+  void wait(const std::atomic<s32> &pending);
+
+ private:
+  // Upper bound on helpers per 'parallel_for', so the tasks fit on the stack.
+  static constexpr s32 kMaxHelpers = 64;
+
+  // Most chunks 'parallel_for_weighted' will cut a range into
+  static constexpr size_t kMaxWeightedChunks = 256;
+
+  template <class F>
+  struct ForJob
+  {
+    F &f;
+    size_t first;
+    size_t last;
+    size_t grain;           // Chunk c is [first + c * grain, first + (c + 1) * grain)..
+    size_t chunk_count;
+    const size_t *bounds {nullptr}; // ..unless these are set, then it's [bounds[c], bounds[c + 1])
+    bool timed {false};     // Sum up how long the chunks took in 'nanoseconds'
+
+    std::atomic<size_t> next {0};
+    std::atomic<u64> nanoseconds {0};
+
+    ForJob(F &f, size_t first, size_t last, size_t grain, size_t chunk_count) noexcept
+      : f(f), first(first), last(last), grain(grain), chunk_count(chunk_count) {}
+
+    void run_chunk(size_t c)
+    {
+      const size_t begin = bounds ? bounds[c] : first + c * grain;
+      const size_t end = bounds ? bounds[c + 1] : std::min(begin + grain, last);
+      if (begin < end) f(begin, end);
     }
+
+    static void run(void *context)
+    {
+      auto &job = *static_cast<ForJob *>(context);
+
+      if (!job.timed)
+      {
+        for (size_t c; (c = job.next.fetch_add(1, std::memory_order_relaxed)) < job.chunk_count;)
+          job.run_chunk(c);
+        return;
+      }
+
+      const auto start = std::chrono::steady_clock::now();
+      for (size_t c; (c = job.next.fetch_add(1, std::memory_order_relaxed)) < job.chunk_count;)
+        job.run_chunk(c);
+      const auto elapsed = std::chrono::steady_clock::now() - start;
+      job.nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(), std::memory_order_relaxed);
+    }
+  };
+
+  template <class Job>
+  void run(Job &job)
+  {
+#ifdef __APPLE__
+    if (use_libdispatch)
+    {
+      Job *job_ptr = &job;
+      dispatch_apply(job.chunk_count, dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0), ^(size_t c) {
+        job_ptr->run_chunk(c);
+      });
+      return;
+    }
+#endif
+    run_job(&job, &Job::run, job.chunk_count - 1);
   }
+
+  // Pushes up to 'max_helpers' tasks running 'run(job)', runs it on this
+  // thread too, and waits until every helper that was picked up is done.
+  void run_job(void *job, void (*run)(void *), size_t max_helpers);
+
+  // Tells sleeping workers there's new work.
+  void wake_workers() noexcept;
+
+  // Push to and pop from the deque of the calling thread. A thread without
+  // one can't push and gets nothing back.
+  bool push_local(Task *task);
+  Task *pop_local();
+
+  // Which deque belongs to the calling thread, -1 if none. Hands out an
+  // external one the first time a thread that isn't a worker asks.
+  s32 local_index() noexcept;
+  s32 claim_external() noexcept;
+
+  // Makes an external deque free again, see ExternalDeque in the .cpp.
+  void release_external(s32 index, u32 owner_generation) noexcept;
+  friend struct ExternalDeque;
+
+  // Takes a task from any deque but 'self'.
+  Task *steal(s32 self) noexcept;
+
+  // Runs a task and marks it done.
+  static void execute(Task *task);
+
+  // Runs one job from 'tasks'. Returns false if there was none.
+  bool run_enqueued();
+
+  void worker_loop(s32 index);
+  void start_workers(s32 thread_count);
+  void stop_workers();
+
+  s32 worker_count {0};
+  vector<std::thread> workers;
+
+  // Threads that aren't workers and can have a deque at the same time
+  static constexpr s32 kMaxExternalThreads = 8;
+
+  // One per worker, then kMaxExternalThreads for everybody else
+  std::unique_ptr<WorkStealingDeque[]> deques;
+  s32 deque_count {0};
+
+  // Which external deques are free, one bit each. Starting the workers makes
+  // new deques, so it bumps 'generation' and every thread claims a new one.
+  std::mutex external_mutex;
+  u32 external_free {0};
+  std::atomic<u32> generation {0};
+
+  std::queue<std::function<void()>> tasks;
+  std::mutex queue_mutex;
+
+  // Workers with nothing to do sleep here until 'epoch' moves
+  std::mutex sleep_mutex;
+  std::condition_variable sleep_condition;
+  std::atomic<u32> epoch {0};
+  std::atomic<s32> sleeping {0};
+  std::atomic<bool> stop {false};
 };
 
 extern Dispatch dispatch;
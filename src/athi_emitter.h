@@ -0,0 +1,117 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "./Utility/athi_constant_globals.h" // kPI
+
+#include <algorithm> // std::max
+#include <cmath> // sqrt, cos, sin
+#include <glm/vec2.hpp> // glm::vec2
+#include <glm/vec4.hpp> // glm::vec4
+
+enum class EmitterShape : u8
+{
+  Point,      // Everything at 'center', flying apart
+  Disc,       // Inside the circle of diameter 'size.x' around 'center'
+  Rectangle,  // Inside the 'size' box around 'center'
+  Grid,       // Rows 'spacing' apart in the 'size' box around 'center', starting at its min corner
+};
+
+struct EmitterParams
+{
+  glm::vec2   center      {0.0f, 0.0f};
+  glm::vec2   size        {100.0f, 100.0f};
+  f32         spacing     {2.0f};
+  f32         radius      {1.0f};
+  f32         radius_max  {0.0f};  // Above 'radius', radii are uniform in [radius, radius_max]
+  glm::vec4   color       {1.0f, 1.0f, 1.0f, 1.0f};
+  f32         speed       {0.0f};  // Velocities are random, up to this fast
+  f32         lifetime    {0.0f};  // Seconds, 0 lives forever
+  u64         seed        {0};
+};
+
+// SplitMix64. Small and fast, and good enough that neighbouring seeds give unrelated numbers.
+inline u64 splitmix64(u64 &state) noexcept
+{
+  u64 z = (state += 0x9E3779B97F4A7C15ull);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+  return z ^ (z >> 31);
+}
+
+// In [0, 1)
+inline f32 unit_f32(u64 &state) noexcept
+{
+  return static_cast<f32>(splitmix64(state) >> 40) * (1.0f / 16777216.0f);
+}
+
+// Uniform in the disc of 'radius' around the origin
+inline glm::vec2 in_disc(u64 &state, f32 radius) noexcept
+{
+  const f32 r = radius * std::sqrt(unit_f32(state));
+  const f32 angle = static_cast<f32>(2.0 * kPI) * unit_f32(state);
+  return {r * std::cos(angle), r * std::sin(angle)};
+}
+
+// Position and velocity of particle 'i' of a spawn. They only depend on 'i'
+// and the seed, so the particles can be filled in any order on any thread
+// and the same seed always gives the same scene.
+inline void emit_particle(EmitterShape shape, const EmitterParams &params, u32 i,
+                          glm::vec2 &position, glm::vec2 &velocity) noexcept
+{
+  u64 state = params.seed ^ (static_cast<u64>(i) * 0xD1B54A32D192ED03ull);
+
+  switch (shape)
+  {
+    case EmitterShape::Point: {
+      position = params.center;
+    } break;
+
+    case EmitterShape::Disc: {
+      position = params.center + in_disc(state, params.size.x * 0.5f);
+    } break;
+
+    case EmitterShape::Rectangle: {
+      const f32 x = unit_f32(state) - 0.5f;
+      const f32 y = unit_f32(state) - 0.5f;
+      position = params.center + glm::vec2(x, y) * params.size;
+    } break;
+
+    case EmitterShape::Grid: {
+      const u32 columns = std::max(1u, static_cast<u32>(params.size.x / params.spacing));
+      const glm::vec2 cell(static_cast<f32>(i % columns), static_cast<f32>(i / columns));
+      position = params.center - params.size * 0.5f + cell * params.spacing;
+    } break;
+  }
+
+  velocity = in_disc(state, params.speed);
+}
+
+// Radius of particle 'i' of a spawn. Like 'emit_particle' it only depends on 'i' and the seed.
+inline f32 emit_radius(const EmitterParams &params, u32 i) noexcept
+{
+  if (params.radius_max <= params.radius) return params.radius;
+
+  u64 state = ~params.seed ^ (static_cast<u64>(i) * 0xD1B54A32D192ED03ull);
+  return params.radius + (params.radius_max - params.radius) * unit_f32(state);
+}
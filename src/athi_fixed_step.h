@@ -0,0 +1,50 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <cmath> // std::fmod
+
+// Turns real time into a whole number of physics steps of a fixed length,
+// so the simulation runs at the same speed whatever the framerate.
+struct FixedStep
+{
+  f64 accumulator{0.0};  // Seconds not yet simulated
+
+  // Adds 'elapsed' seconds and returns how many steps of 'step' seconds to run.
+  // Never more than 'max_steps': if a step takes longer than it simulates,
+  // catching up only makes the next frame slower. The time over the limit is
+  // dropped, and the simulation slows down instead.
+  u32 advance(f64 elapsed, f64 step, u32 max_steps) noexcept
+  {
+    accumulator += elapsed;
+    u32 steps = static_cast<u32>(accumulator / step);
+    if (steps > max_steps) steps = max_steps;
+    accumulator -= steps * step;
+    if (accumulator >= step) accumulator = std::fmod(accumulator, step);
+    return steps;
+  }
+
+  // How far the time left over is into the next step, from 0 to 1.
+  f32 alpha(f64 step) const noexcept { return static_cast<f32>(accumulator / step); }
+};
@@ -0,0 +1,122 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "athi_stage_times.h" // Stage, kStageCount
+
+#include <algorithm> // std::nth_element, std::min
+#include <array> // std::array
+
+// The lanes of the performance timeline: every physics stage, then the two
+// render stages. Durations are in milliseconds.
+static constexpr u32 kGpuUploadLane = kStageCount;
+static constexpr u32 kDrawLane = kStageCount + 1;
+static constexpr u32 kFrameLaneCount = kStageCount + 2;
+
+inline const char *frame_lane_name(u32 lane) noexcept
+{
+  if (lane < kStageCount) return stage_name(static_cast<Stage>(lane));
+  return lane == kGpuUploadLane ? "gpu_upload" : "draw";
+}
+
+// The last 'kCapacity' frames, oldest overwritten first. Everything is a
+// fixed size member, so recording is a copy into the ring and never
+// allocates. The percentiles sort a copy, so only ask for them when shown.
+class FrameHistory
+{
+public:
+  static constexpr u32 kCapacity = 4096;
+
+  struct Frame
+  {
+    u64 index{0};
+    f32 total_ms{0.0f};
+    std::array<f32, kFrameLaneCount> ms{};
+  };
+
+  struct Percentiles
+  {
+    f32 p50{0.0f};
+    f32 p95{0.0f};
+    f32 p99{0.0f};
+  };
+
+  void record(Frame frame) noexcept
+  {
+    frame.index = recorded++;
+    frames[head] = frame;
+    head = (head + 1) % kCapacity;
+    if (!has_worst || frame.total_ms > worst_frame.total_ms) {
+      worst_frame = frame;
+      has_worst = true;
+    }
+  }
+
+  u32 size() const noexcept { return static_cast<u32>(std::min<u64>(recorded, kCapacity)); }
+
+  // 'age' 0 is the newest frame.
+  const Frame &frame(u32 age) const noexcept { return frames[(head + kCapacity - 1 - age) % kCapacity]; }
+
+  // The slowest frame since the last reset_worst, if any.
+  const Frame *worst() const noexcept { return has_worst ? &worst_frame : nullptr; }
+  void reset_worst() noexcept { has_worst = false; }
+
+  void clear() noexcept
+  {
+    recorded = 0;
+    head = 0;
+    has_worst = false;
+  }
+
+  // Over the last 'count' frames. Pass kFrameLaneCount as the lane for the
+  // whole frame.
+  Percentiles percentiles(u32 lane, u32 count = kCapacity) noexcept
+  {
+    const u32 n = std::min(count, size());
+    if (n == 0) return {};
+
+    for (u32 i = 0; i < n; ++i) {
+      const auto &f = frame(i);
+      scratch[i] = lane < kFrameLaneCount ? f.ms[lane] : f.total_ms;
+    }
+
+    const auto at = [this, n](f32 q) {
+      const u32 k = std::min(n - 1, static_cast<u32>(q * static_cast<f32>(n)));
+      std::nth_element(scratch.begin(), scratch.begin() + k, scratch.begin() + n);
+      return scratch[k];
+    };
+    Percentiles result;
+    result.p50 = at(0.50f);
+    result.p95 = at(0.95f);
+    result.p99 = at(0.99f);
+    return result;
+  }
+
+private:
+  std::array<Frame, kCapacity> frames{};
+  std::array<f32, kCapacity> scratch{};
+  u64 recorded{0};
+  u32 head{0};
+  Frame worst_frame;
+  bool has_worst{false};
+};
@@ -0,0 +1,162 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "Utility/athi_constant_globals.h" // collect_frame_stats
+
+#include <array> // std::array
+#include <algorithm> // std::max
+#include <atomic> // std::atomic
+
+enum class Stat : u32
+{
+  CandidatePairs,    // Pairs the broadphase handed to the narrowphase
+  NarrowphaseHits,   // Candidate pairs that actually overlap
+  ResolvedContacts,  // Contacts the solver pushed apart
+  DuplicatePairs,    // Pairs found in more than one leaf
+  LeafCount,         // Non-empty leaves or cells in the broadphase
+  MaxLeafOccupancy,  // Particles in the fullest leaf or cell
+  Count
+};
+
+static constexpr u32 kStatCount = static_cast<u32>(Stat::Count);
+
+// The totals of one frame, see FrameStats::reduce.
+struct StatTotals
+{
+  std::array<u64, kStatCount> values{};
+  u64 operator[](Stat stat) const noexcept { return values[static_cast<u32>(stat)]; }
+};
+
+// Counters that every thread can bump without touching anyone else's cache line.
+//
+// Each thread gets its own 64 byte slot the first time it counts anything,
+// so a worker adding to its slot never invalidates another worker's line.
+// 'reduce' folds the slots together once per frame. Set
+// 'collect_frame_stats' to false and every call compiles to nothing.
+class FrameStats
+{
+public:
+  // More threads than this at once share slots and may lose counts, nothing worse.
+  static constexpr u32 kMaxThreads = 64;
+
+  void add(Stat stat, u64 value) noexcept
+  {
+    if constexpr (collect_frame_stats)
+    {
+      auto &slot = slots[thread_slot()].values[static_cast<u32>(stat)];
+      slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+  }
+
+  void max(Stat stat, u64 value) noexcept
+  {
+    if constexpr (collect_frame_stats)
+    {
+      auto &slot = slots[thread_slot()].values[static_cast<u32>(stat)];
+      if (value > slot.load(std::memory_order_relaxed)) slot.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  // Call between frames, when no one is counting.
+  void reset() noexcept
+  {
+    if constexpr (collect_frame_stats)
+    {
+      for (auto &slot : slots)
+        for (auto &value : slot.values) value.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // Sums every slot, except MaxLeafOccupancy which takes the largest.
+  StatTotals reduce() const noexcept
+  {
+    StatTotals totals{};
+    if constexpr (collect_frame_stats)
+    {
+      constexpr u32 max_stat = static_cast<u32>(Stat::MaxLeafOccupancy);
+      for (const auto &slot : slots)
+      {
+        for (u32 s = 0; s < kStatCount; ++s)
+        {
+          const u64 value = slot.values[s].load(std::memory_order_relaxed);
+          auto &total = totals.values[s];
+          total = (s == max_stat) ? std::max(total, value) : total + value;
+        }
+      }
+    }
+    return totals;
+  }
+
+private:
+  // Relaxed loads and stores compile to plain moves. They're atomic only so
+  // that 'reduce' may read a slot that is being written.
+  struct alignas(64) Slot
+  {
+    std::atomic<u64> values[kStatCount];
+  };
+
+  // A thread takes the lowest free slot and frees it again when it exits,
+  // so workers restarted by 'dispatch.resize' reuse the slots of the old
+  // ones instead of wrapping around onto a live thread's.
+  struct SlotClaim
+  {
+    u32 slot {0};
+    bool owned {false};
+
+    SlotClaim() noexcept
+    {
+      u64 used = used_slots.load(std::memory_order_relaxed);
+      while (~used != 0)
+      {
+        u32 free_slot = 0;
+        while (used & (u64{1} << free_slot)) ++free_slot;
+        if (used_slots.compare_exchange_weak(used, used | (u64{1} << free_slot), std::memory_order_relaxed))
+        {
+          slot = free_slot;
+          owned = true;
+          return;
+        }
+      }
+
+      // All taken, share one
+      slot = shared_slot.fetch_add(1, std::memory_order_relaxed) % kMaxThreads;
+    }
+
+    ~SlotClaim()
+    {
+      if (owned) used_slots.fetch_and(~(u64{1} << slot), std::memory_order_relaxed);
+    }
+  };
+
+  static_assert(kMaxThreads <= 64, "'used_slots' has one bit per slot");
+  static inline std::atomic<u64> used_slots{0};
+  static inline std::atomic<u32> shared_slot{0};
+
+  static u32 thread_slot() noexcept
+  {
+    static thread_local const SlotClaim claim;
+    return claim.slot;
+  }
+
+  std::array<Slot, collect_frame_stats ? kMaxThreads : 1> slots{};
+};
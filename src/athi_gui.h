@@ -26,11 +26,14 @@
 #include "athi_transform.h"  // Transform
 #include "athi_particle.h" // particle_system
 #include "athi_settings.h" // has_random_velocity, etc.
+#include "./Utility/athi_constant_globals.h" // kPI
 #include "./Renderer/athi_primitives.h" // draw_line, draw_rect, draw_circle
 #include "./Renderer/athi_camera.h" // camera
 #include "./Renderer/athi_text.h" // draw_text
 #include "athi_input.h" // mouse_pos
 #include "athi_resource.h" // resource_manager
+#include "athi_benchmark.h" // benchmark_quadtree_build, benchmark_narrowphase, benchmark_contact_solver, benchmark_barnes_hut, benchmark_nbody, benchmark_dispatch, benchmark_spawn
+#include "athi_narrowphase.h" // get_narrowphase_name
 
 
 #include "../dep/Universal/imgui.h"
@@ -45,6 +48,7 @@ static u32 my_font;
 static u32 ortho_loc;
 
 static bool show_benchmark_menu = false;
+static bool show_performance_menu = false;
 
 void gui_init(GLFWwindow *window, float px_scale);
 void gui_shutdown();
@@ -122,8 +126,22 @@ static void draw_custom_gui() noexcept
 
   label("GPU: " + std::to_string(smoothed_render_frametime) + "ms", text_color);
   label("CPU: " + std::to_string(smoothed_physics_frametime) + "ms", text_color);
+  if (use_gravitational_force && !use_barnes_hut)
+    label("N-body: " + std::to_string(nbody_interactions_per_second / 1e6) + "M interactions/s", text_color);
+  label("Reorder: " + std::to_string(reorder_time) + "ms", text_color);
+  if (dump_critical_path)
+    label("Critical path: " + frame_critical_path, text_color);
+  if constexpr (collect_frame_stats)
+  {
+    label("Pairs: " + std::to_string(frame_stats[Stat::CandidatePairs]) + " Hits: " + std::to_string(frame_stats[Stat::NarrowphaseHits]) +
+          " Resolved: " + std::to_string(frame_stats[Stat::ResolvedContacts]), text_color);
+    label("Duplicate pairs: " + std::to_string(frame_stats[Stat::DuplicatePairs]), text_color);
+    label("Leaves: " + std::to_string(frame_stats[Stat::LeafCount]) + " Fullest: " + std::to_string(frame_stats[Stat::MaxLeafOccupancy]), text_color);
+  }
   label("FPS: " + std::to_string(framerate) + "(" + std::to_string(frametime) + "ms)", (framerate < 60) ? pastel_red : pastel_green);
   label("Particles: " + std::to_string(particle_system.particle_count), text_color);
+  label("Expired: " + std::to_string(expired_particles) + " Pool: " + std::to_string(particle_high_water) +
+        " high-water, " + std::to_string(particle_pool_capacity) + " capacity", text_color);
   label("Resolution: " + std::to_string(framebuffer_width) + "x" + std::to_string(framebuffer_height), text_color);
 }
 
@@ -185,9 +203,12 @@ static void menu_debug() {
   ToggleButton("quadtree_show_only_occupied", &quadtree_show_only_occupied);
   ToggleButton("quadtree_active", &quadtree_active);
   ToggleButton("use_uniformgrid", &use_uniformgrid);
+  ToggleButton("use_sweep_and_prune", &use_sweep_and_prune);
   ToggleButton("vsync", &vsync);
   ToggleButton("use_gravitational_force", &use_gravitational_force);
+  ToggleButton("use_barnes_hut", &use_barnes_hut);
   ToggleButton("use_multithreading", &use_multithreading);
+  ToggleButton("dump_critical_path", &dump_critical_path);
   ToggleButton("use_libdispatch", &use_libdispatch);
   ToggleButton("openCL_active", &openCL_active);
   ToggleButton("post_processing", &post_processing);
@@ -222,6 +243,137 @@ static void menu_resource_viewer()
   ImGui::End();
 }
 
+static void menu_benchmarks()
+{
+  ImGui::Begin("Benchmarks", &show_benchmark_menu, ImGuiWindowFlags_AlwaysAutoResize);
+  ImGui::Text("Results are printed to the console.");
+
+  if (ImGui::Button("Quadtree build")) benchmark_quadtree_build();
+  if (ImGui::Button("Narrowphase")) benchmark_narrowphase();
+  if (ImGui::Button("Contact solver")) benchmark_contact_solver();
+  if (ImGui::Button("Barnes-Hut")) benchmark_barnes_hut();
+  if (ImGui::Button("N-body kernel")) benchmark_nbody();
+  if (ImGui::Button("Dispatch")) benchmark_dispatch();
+  if (ImGui::Button("Spawn")) benchmark_spawn();
+  ImGui::Text("Narrowphase kernel: %s", get_narrowphase_name());
+
+  ImGui::End();
+}
+
+static constexpr ImU32 frame_lane_colors[kFrameLaneCount] = {
+  IM_COL32(150, 110, 200, 255), // reorder
+  IM_COL32( 80, 160, 230, 255), // tree_build
+  IM_COL32( 90, 200, 120, 255), // integrate
+  IM_COL32(230, 200,  70, 255), // broadphase
+  IM_COL32(240, 140,  60, 255), // narrowphase
+  IM_COL32(110, 130, 150, 255), // color
+  IM_COL32(220,  80,  80, 255), // resolve
+  IM_COL32(200,  90, 170, 255), // n_body
+  IM_COL32( 70, 200, 200, 255), // gpu_upload
+  IM_COL32(170, 170, 170, 255), // draw
+};
+static constexpr ImU32 frame_rest_color = IM_COL32(70, 70, 70, 255);
+
+static void frame_breakdown(const FrameHistory::Frame &frame)
+{
+  ImGui::Text("frame %llu: %.2f ms", static_cast<unsigned long long>(frame.index), frame.total_ms);
+  for (u32 lane = 0; lane < kFrameLaneCount; ++lane) {
+    ImGui::TextColored(ImGui::ColorConvertU32ToFloat4(frame_lane_colors[lane]), "%-12s %.3f ms", frame_lane_name(lane), frame.ms[lane]);
+  }
+}
+
+// One bar per frame, newest on the right. Each bar stacks the lanes from
+// the bottom up, and whatever the lanes don't cover (input, gui, waiting
+// on vsync) is the grey on top.
+static void frame_timeline(f32 scale_ms)
+{
+  const f32 bar_width = 2.0f;
+  const f32 height = 120.0f;
+  const f32 width = ImGui::GetContentRegionAvailWidth();
+  const ImVec2 origin = ImGui::GetCursorScreenPos();
+  ImGui::InvisibleButton("##timeline", ImVec2(width, height));
+  const bool hovered = ImGui::IsItemHovered();
+
+  auto *draw_list = ImGui::GetWindowDrawList();
+  draw_list->AddRectFilled(origin, ImVec2(origin.x + width, origin.y + height), IM_COL32(20, 20, 20, 255));
+
+  const f32 bottom = origin.y + height;
+  const f32 px_per_ms = height / scale_ms;
+  const u32 bars = std::min(frame_history.size(), static_cast<u32>(width / bar_width));
+  for (u32 age = 0; age < bars; ++age) {
+    const auto &frame = frame_history.frame(age);
+    const f32 x1 = origin.x + width - static_cast<f32>(age) * bar_width;
+    const f32 x0 = x1 - bar_width;
+    f32 y = bottom;
+    for (u32 lane = 0; lane < kFrameLaneCount; ++lane) {
+      const f32 top = std::max(origin.y, y - frame.ms[lane] * px_per_ms);
+      if (top < y) draw_list->AddRectFilled(ImVec2(x0, top), ImVec2(x1, y), frame_lane_colors[lane]);
+      y = top;
+    }
+    const f32 total_top = std::max(origin.y, bottom - frame.total_ms * px_per_ms);
+    if (total_top < y) draw_list->AddRectFilled(ImVec2(x0, total_top), ImVec2(x1, y), frame_rest_color);
+  }
+
+  // The frame budget
+  const f32 budget_y = bottom - static_cast<f32>(frame_budget * 1000.0) * px_per_ms;
+  if (budget_y > origin.y) {
+    draw_list->AddLine(ImVec2(origin.x, budget_y), ImVec2(origin.x + width, budget_y), IM_COL32(255, 255, 255, 160));
+  }
+
+  if (hovered) {
+    const u32 age = static_cast<u32>((origin.x + width - ImGui::GetIO().MousePos.x) / bar_width);
+    if (age < bars) {
+      ImGui::BeginTooltip();
+      frame_breakdown(frame_history.frame(age));
+      ImGui::EndTooltip();
+    }
+  }
+}
+
+static void menu_performance()
+{
+  static f32 scale_ms = 33.3f;
+
+  ImGui::Begin("Performance", &show_performance_menu);
+
+  ImGui::SliderFloat("scale (ms)", &scale_ms, 1.0f, 100.0f);
+  frame_timeline(scale_ms);
+
+  ImGui::Text("last %u frames", frame_history.size());
+  ImGui::Columns(5, "percentiles");
+  ImGui::Text("stage"); ImGui::NextColumn();
+  ImGui::Text("last"); ImGui::NextColumn();
+  ImGui::Text("p50"); ImGui::NextColumn();
+  ImGui::Text("p95"); ImGui::NextColumn();
+  ImGui::Text("p99"); ImGui::NextColumn();
+  ImGui::Separator();
+  const bool has_frames = frame_history.size() > 0;
+  for (u32 lane = 0; lane <= kFrameLaneCount; ++lane) {
+    const bool total = lane == kFrameLaneCount;
+    const auto p = frame_history.percentiles(lane);
+    const f32 last = !has_frames ? 0.0f : total ? frame_history.frame(0).total_ms : frame_history.frame(0).ms[lane];
+    const auto color = ImGui::ColorConvertU32ToFloat4(total ? frame_rest_color : frame_lane_colors[lane]);
+    ImGui::ColorButton(total ? "frame" : frame_lane_name(lane), color, ImGuiColorEditFlags_NoTooltip, ImVec2(10, 10));
+    ImGui::SameLine();
+    ImGui::Text("%s", total ? "frame" : frame_lane_name(lane)); ImGui::NextColumn();
+    ImGui::Text("%.3f", last); ImGui::NextColumn();
+    ImGui::Text("%.3f", p.p50); ImGui::NextColumn();
+    ImGui::Text("%.3f", p.p95); ImGui::NextColumn();
+    ImGui::Text("%.3f", p.p99); ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::Separator();
+
+  if (const auto *worst = frame_history.worst()) {
+    ImGui::Text("Worst frame");
+    ImGui::SameLine();
+    if (ImGui::Button("Reset")) frame_history.reset_worst();
+    frame_breakdown(*worst);
+  }
+
+  ImGui::End();
+}
+
 static void renderer_submenu()
 {
     ImGui::Checkbox("VSync", &vsync);
@@ -236,6 +388,9 @@ static void simulation_submenu()
 {
     ImGui::InputInt("Physics samples", &physics_samples);
     if (physics_samples < 1) physics_samples = 1;
+    ImGui::SliderInt("Physics tick rate", &physics_tick_rate, 10, 240);
+    ImGui::SliderInt("Max substeps", &max_substeps, 1, 16);
+    ImGui::Checkbox("Interpolate positions", &interpolate_positions);
     ImGui::Checkbox("Multithreaded particle update", &multithreaded_particle_update);
     ImGui::Checkbox("Particle intercollision", &circle_collision);
     ImGui::SameLine();
@@ -244,6 +399,10 @@ static void simulation_submenu()
     ImGui::SliderFloat(" ", &gravity, 0.01f, 20.0f);
 
     ImGui::Checkbox("gravitational force", &use_gravitational_force);
+    ImGui::SameLine();
+    ImGui::Checkbox("Barnes-Hut", &use_barnes_hut);
+    ImGui::SliderFloat("Barnes-Hut theta", &barnes_hut_theta, 0.0f, 1.5f);
+    ImGui::SliderInt("reorder interval", &reorder_interval, 0, 600);
 }
 
 static int vertices_to_be_applied = 36;
@@ -289,6 +448,8 @@ static void menu_settings() {
     ImGui::InputInt("", &variable_thread_count);
     if (variable_thread_count < 0)
       variable_thread_count = 0;
+
+    ImGui::Checkbox("dump critical path", &dump_critical_path);
   }
 
   if (ImGui::CollapsingHeader("quadtree options")) {
@@ -297,7 +458,9 @@ static void menu_settings() {
     ImGui::SliderInt("capacity", &quadtree_capacity, 0, 100);
   }
   if (ImGui::CollapsingHeader("uniform grid options")) {
-    ImGui::SliderInt("nodes", &uniformgrid_parts, 4, 1024);
+    const auto &grid = particle_system.uniformgrid;
+    ImGui::Text("cells: %dx%d", grid.cells_x, grid.cells_y);
+    ImGui::Text("cell size: %.2f", grid.cell_size);
   }
 
   if (ImGui::CollapsingHeader("particle options")) {
@@ -308,6 +471,9 @@ static void menu_settings() {
     if (has_random_velocity)
       ImGui::SliderFloat("random starting force", &random_velocity_force, 0.1f, 10.0f);
 
+    // 0 lives forever
+    ImGui::SliderFloat("lifetime (s)", &particle_lifetime, 0.0f, 30.0f);
+
 
     // Color changed by acceleration
     ImGui::Checkbox("colored by acceleration", &is_particles_colored_by_acc);
@@ -336,8 +502,10 @@ static void menu_settings() {
     ImGui::Text("particle color");
     ImGui::SameLine();
     if (ImGui::SmallButton("Color: Apply to all")) {
-      for (auto &p : particle_system.particles)
-        particle_system.color[p.id] = circle_color;
+      const auto color = circle_color;
+      particle_system.buffered_call([color]() {
+        for (auto &c : particle_system.particles.color) c = color;
+      });
     }
     ImGui::ColorPicker4("##particle", (float *)&circle_color);
 
@@ -351,10 +519,15 @@ static void menu_settings() {
     ImGui::SliderFloat("radius", &circle_size, 0.1f, 10.0f);
     ImGui::SameLine();
     if (ImGui::SmallButton("Radius: Apply to all")) {
-      for (auto &p : particle_system.particles) {
-        p.radius = circle_size;
-        // particle_system.transforms[p.id].scale = glm::vec3(circle_size, circle_size, 0);
-      }
+      const f32 r = circle_size;
+      particle_system.buffered_call([r]() {
+        auto &particles = particle_system.particles;
+        const f32 m = particle_system.particle_density * kPI * r * r;
+        for (size_t i = 0; i < particles.size(); ++i) {
+          particles.radius[i] = r;
+          particles.mass[i] = m;
+        }
+      });
     }
   }
   if (ImGui::CollapsingHeader("color options")) {
@@ -376,6 +549,8 @@ void gui_render() {
   if (ImGui::BeginMainMenuBar()) {
     if (ImGui::BeginMenu("Menu")) {
       ImGui::MenuItem("Settings", NULL, &open_settings);
+      ImGui::MenuItem("Benchmarks", NULL, &show_benchmark_menu);
+      ImGui::MenuItem("Performance", NULL, &show_performance_menu);
 
       if constexpr (DEBUG_MODE) {
         ImGui::MenuItem("Resource viewer", NULL, &open_resource_viewer);
@@ -385,6 +560,26 @@ void gui_render() {
       ImGui::EndMenu();
     }
 
+      ImGui::SameLine();
+      if (ImGui::Button("Tree Options"))
+      {
+          ImGui::OpenPopup("treepicker");
+      }
+
+     if (ImGui::BeginPopup("treepicker"))
+      {
+        ImGui::RadioButton("Quadtree", &tree_radio_option, 0);
+        ImGui::RadioButton("Uniform Grid", &tree_radio_option, 1);
+        ImGui::RadioButton("Sweep and Prune", &tree_radio_option, 2);
+        ImGui::RadioButton("None", &tree_radio_option, 3);
+
+        // update_inputs works out the tree type from these at the start of the next frame.
+        quadtree_active = (TreeType)tree_radio_option == TreeType::Quadtree;
+        use_uniformgrid = (TreeType)tree_radio_option == TreeType::UniformGrid;
+        use_sweep_and_prune = (TreeType)tree_radio_option == TreeType::SweepAndPrune;
+    ImGui::EndPopup();
+    }
+
       ImGui::SameLine();
       bool open_popup = ImGui::Button("Mouse Options");
       if (open_popup)
@@ -412,7 +607,7 @@ void gui_render() {
 
     const auto yellow = ImVec4(0.1f, 8.0f, 0.8f, 1.0f);
     ImGui::PushStyleColor(ImGuiCol_Text, yellow);
-    ImGui::Text("Particles: %lu", particle_system.particles.size());
+    ImGui::Text("Particles: %u", particle_system.particle_count);
     ImGui::PopStyleColor();
     ImGui::SameLine();
 
@@ -428,6 +623,12 @@ void gui_render() {
     ImGui::PopStyleColor();
     ImGui::SameLine();
 
+    if (use_gravitational_force && !use_barnes_hut)
+    {
+      ImGui::Text("N-body: %.1fM interactions/s", nbody_interactions_per_second / 1e6);
+      ImGui::SameLine();
+    }
+
     ImGui::PushStyleColor(ImGuiCol_Text,  ImVec4(1.0f, 1.0f, 1.0f, 1.0f));
     ImGui::Text("GPU: %f", smoothed_render_frametime);
     ImGui::PopStyleColor();
@@ -437,6 +638,10 @@ void gui_render() {
 
   if (open_settings)
     menu_settings();
+  if (show_benchmark_menu)
+    menu_benchmarks();
+  if (show_performance_menu)
+    menu_performance();
   if constexpr (DEBUG_MODE) {
     if (open_resource_viewer) menu_resource_viewer();
     if (open_debug_menu) menu_debug();
@@ -0,0 +1,92 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <deque> // std::deque
+
+// Maps particle handles to where the particles currently sit in the arrays.
+//
+// Particles move around: reordering sorts them and removal swaps the last
+// one into the gap. Anything that holds on to a particle keeps a handle
+// instead, which stays valid until that particle is removed. A handle is a
+// slot in this table in the low bits and the slot's generation in the high
+// bits. Removing a particle bumps the generation, so old handles to a reused
+// slot are told apart from the new particle.
+class HandleTable
+{
+public:
+  static constexpr u32 kSlotBits = 24;
+  static constexpr u32 kSlotMask = (1u << kSlotBits) - 1;
+  static constexpr u32 kGenerationMask = 0x7F;  // Keeps handles positive as s32
+
+  // A handle for a new particle at 'index'
+  s32 create(u32 index)
+  {
+    u32 slot;
+    if (free_slots.empty())
+    {
+      slot = static_cast<u32>(slot_index.size());
+      slot_index.emplace_back(index);
+      generation.emplace_back(0);
+    }
+    else
+    {
+      // Oldest first, so a slot takes as long as possible to come back
+      slot = free_slots.front();
+      free_slots.pop_front();
+      slot_index[slot] = index;
+    }
+    return static_cast<s32>((generation[slot] << kSlotBits) | slot);
+  }
+
+  void destroy(s32 handle)
+  {
+    const u32 slot = static_cast<u32>(handle) & kSlotMask;
+    generation[slot] = (generation[slot] + 1) & kGenerationMask;
+    slot_index[slot] = kRemoved;
+    free_slots.emplace_back(slot);
+  }
+
+  // Where the particle is now, or -1 if it has been removed
+  s32 index_of(s32 handle) const noexcept
+  {
+    const u32 slot = static_cast<u32>(handle) & kSlotMask;
+    if (handle < 0 || slot >= slot_index.size()) return -1;
+    if (generation[slot] != (static_cast<u32>(handle) >> kSlotBits)) return -1;
+    return static_cast<s32>(slot_index[slot]);
+  }
+
+  // The particle with 'handle' moved to 'index'
+  void moved(s32 handle, u32 index) noexcept
+  {
+    slot_index[static_cast<u32>(handle) & kSlotMask] = index;
+  }
+
+private:
+  static constexpr u32 kRemoved = ~0u;
+
+  vector<u32> slot_index;
+  vector<u32> generation;
+  std::deque<u32> free_slots;
+};
@@ -0,0 +1,95 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#include "athi_headless.h"
+
+#include "athi_dispatch.h" // dispatch
+#include "athi_particle.h" // particle_system
+#include "athi_profiler.h" // profiler_frame, profiler_set_thread_name
+#include "athi_settings.h" // framebuffer_width, framebuffer_height
+#include "Utility/athi_config_parser.h" // init_variables
+#include "Utility/console.h" // console
+
+#include <algorithm> // std::max
+#include <cstdio> // fopen, fwrite
+
+void headless_init(bool load_config) noexcept
+{
+  if (!console)
+  {
+    spdlog::set_pattern("[%H:%M:%S] %v");
+    console = spdlog::stdout_color_mt("Athi");
+  }
+  profiler_set_thread_name("main");
+  dispatch.init();
+
+  if (load_config) init_variables();
+  particle_system.init();
+}
+
+void headless_spawn(const HeadlessScene &scene) noexcept
+{
+  framebuffer_width = scene.width;
+  framebuffer_height = scene.height;
+
+  const vec2 bounds(static_cast<f32>(scene.width), static_cast<f32>(scene.height));
+
+  EmitterParams params;
+  params.center = bounds * 0.5f;
+  params.size = bounds - 2.0f * std::max(scene.radius, scene.radius_max);
+  params.spacing = 2.0f * std::max(scene.radius, scene.radius_max);
+  params.radius = scene.radius;
+  params.radius_max = scene.radius_max;
+  params.speed = scene.speed;
+  params.seed = scene.seed;
+  particle_system.add_bulk(scene.particles, scene.shape, params);
+}
+
+void headless_step(f32 dt) noexcept
+{
+  particle_system.execute_buffered_calls();
+  particle_system.update(dt);
+  profiler_frame();
+}
+
+bool write_snapshot(const ParticleSnapshot &snapshot, const string &path) noexcept
+{
+  FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file)
+  {
+    console->error("[Headless] couldn't open {}", path);
+    return false;
+  }
+
+  constexpr u32 version = 1;
+  const u32 count = snapshot.particle_count;
+  bool ok = std::fwrite("ATHS", 1, 4, file) == 4;
+  ok = ok && std::fwrite(&version, sizeof(version), 1, file) == 1;
+  ok = ok && std::fwrite(&count, sizeof(count), 1, file) == 1;
+  ok = ok && std::fwrite(&snapshot.frame, sizeof(snapshot.frame), 1, file) == 1;
+  ok = ok && std::fwrite(snapshot.position.data(), sizeof(vec2), count, file) == count;
+  ok = ok && std::fwrite(snapshot.color.data(), sizeof(vec4), count, file) == count;
+  ok = ok && std::fwrite(snapshot.radius.data(), sizeof(f32), count, file) == count;
+  std::fclose(file);
+
+  if (!ok) console->error("[Headless] couldn't write {}", path);
+  return ok;
+}
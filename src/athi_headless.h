@@ -0,0 +1,61 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "athi_emitter.h" // EmitterShape
+#include "athi_snapshot.h" // ParticleSnapshot
+
+// Runs the simulation without a window, GPU or OpenCL. Builds with
+// ATHI_HEADLESS defined link only the simulation core, see athi_headless in
+// CMakeLists.txt. Everything here also works in the normal build.
+
+// What to spawn before the first frame.
+struct HeadlessScene
+{
+  u32           particles   {100000};
+  EmitterShape  shape       {EmitterShape::Rectangle};
+  f32           radius      {1.0f};
+  f32           radius_max  {0.0f};  // Above 'radius', radii are uniform in [radius, radius_max]
+  f32           speed       {0.0f};
+  s32           width       {1920};  // Size of the box the particles bounce around in
+  s32           height      {1080};
+  u64           seed        {1};
+};
+
+// Sets up logging, the config and the particle system. Without 'load_config'
+// every setting keeps its default from athi_settings.cpp, which is what
+// benchmarks want.
+void headless_init(bool load_config = true) noexcept;
+
+// Spawns 'scene' and sets the bounds. Takes effect with the next step.
+void headless_spawn(const HeadlessScene &scene) noexcept;
+
+// One frame: the buffered calls, then every stage of ParticleSystem::update.
+// Also counts as a frame for a running profiler capture.
+void headless_step(f32 dt) noexcept;
+
+// Writes the particle count, the frame and then the position, color and
+// radius arrays as raw little endian floats. Returns false if it couldn't.
+//
+//   char[4] "ATHS", u32 version, u32 count, u64 frame,
+//   vec2 position[count], vec4 color[count], f32 radius[count]
+bool write_snapshot(const ParticleSnapshot &snapshot, const string &path) noexcept;
@@ -23,7 +23,8 @@
 
 #include "./Utility/athi_constant_globals.h"
 #include "./Renderer/athi_primitives.h" // draw_hollow_circle, draw_line
-#include "athi_utility.h"  // profile
+#include "athi_utility.h"  // vec2, vec4
+#include "athi_profiler.h"  // ATHI_PROFILE, profiler_capture
 
 #include "athi_window.h" // open_profiler
 #include "./Renderer/athi_camera.h" // camera
@@ -102,44 +103,6 @@ s32 get_mouse_button_pressed(s32 button) {
   return false;
 }
 
-static void gravity_well(Particle &a, const vec2 &point) {
-  const f32 x1 = a.pos.x;
-  const f32 y1 = a.pos.y;
-  const f32 x2 = point.x;
-  const f32 y2 = point.y;
-  const f32 m1 = a.mass;
-  const f32 m2 = 1e11f;
-
-  const f32 dx = x2 - x1;
-  const f32 dy = y2 - y1;
-  const f32 d = sqrt(dx * dx + dy * dy);
-
-  const f32 angle = atan2(dy, dx);
-  const f64 G = kGravitationalConstant;
-  const f32 F = G * m1 * m2 / d * d;
-
-  a.acc.x += F * cos(angle);
-  a.acc.y += F * sin(angle);
-}
-
-void attraction_force(Particle &a, const vec2 &point) {
-  // Set up variables
-  const f32 x1 = a.pos.x;
-  const f32 y1 = a.pos.y;
-  const f32 x2 = point.x;
-  const f32 y2 = point.y;
-
-  // Get distance between balls.
-  const f32 dx = x2 - x1;
-  const f32 dy = y2 - y1;
-  const f32 d = sqrt(dx * dx + dy * dy);
-
-  const f32 angle = atan2(dy, dx);
-  a.acc.x += d * cos(angle);
-  a.acc.y += d * sin(angle);
-  a.acc *= 0.7f;
-}
-
 s32 mouse_attached_to_single{-1};
 enum { ATTACHED, PRESSED, NOTHING };
 bool mouse_pressed{false};
@@ -149,7 +112,7 @@ s32 id1, id2;
 bool found{false};
 bool attach{false};
 static bool is_dragging{false};
-static std::vector<s32> mouse_attached_to;
+static std::vector<s32> mouse_attached_to; // Particle ids, not indices
 
 void drag_color_or_destroy_with_mouse()
 {
@@ -178,14 +141,11 @@ void drag_color_or_destroy_with_mouse()
     is_dragging = true;
   }
 
-  Particle p;
-  p.pos = mouse_pos;
-  p.radius = mouse_size;
   std::vector<s32> particle_ids_in_circle;
 
   // Dont get all the ids if we're doing GravityWell
   if (mouse_option != MouseOption::GravityWell) {
-    particle_ids_in_circle = particle_system.get_particles_in_circle(p);
+    particle_ids_in_circle = particle_system.get_particles_in_circle(mouse_pos, mouse_size);
   }
 
   switch (mouse_option) {
@@ -208,22 +168,24 @@ void drag_color_or_destroy_with_mouse()
         }
       }
 
-      // Pull the particles towards the mouse
+      // Pull the particles towards the mouse, at the start of the next frame
+      particle_system.drag_towards(mouse_attached_to, mouse_pos);
+
       for (const auto particle_id : mouse_attached_to) {
-        attraction_force(particle_system.particles[particle_id], mouse_pos);
+        // The particle might have been removed since we grabbed it
+        const auto index = particle_system.handles.index_of(particle_id);
+        if (index < 0) continue;
 
         last_state = ATTACHED;
 
         // Debug lines from particle to mouse
         if (show_mouse_grab_lines) {
-          draw_line(mouse_pos, particle_system.particles[particle_id].pos, 1.0f, vec4(pastel_pink.x, pastel_pink.y, pastel_pink.z, 0.1));
+          draw_line(mouse_pos, particle_system.particles.position[index], 1.0f, vec4(pastel_pink.x, pastel_pink.y, pastel_pink.z, 0.1));
         }
       }
     } break;
     case MouseOption::Delete: {
-      // if (!selected_particle_ids.empty()) { // DOESNT WORK
-      // particle_system.remove_all_with_id(selected_particle_ids);
-      //}
+      particle_system.remove_all_with_id(particle_ids_in_circle);
     } break;
 
     case MouseOption::None: {
@@ -232,7 +194,21 @@ void drag_color_or_destroy_with_mouse()
   }
 }
 
+// The hotkeys, the GUI and the config only set the broadphase flags, so the
+// tree type is worked out from them here, once a frame.
+static void update_tree_type() noexcept
+{
+  if (quadtree_active) tree_type = TreeType::Quadtree;
+  else if (use_uniformgrid) tree_type = TreeType::UniformGrid;
+  else if (use_sweep_and_prune) tree_type = TreeType::SweepAndPrune;
+  else tree_type = TreeType::None;
+  tree_radio_option = static_cast<s32>(tree_type);
+}
+
 void update_inputs() {
+  ATHI_PROFILE("input");
+
+  update_tree_type();
 
   auto mouse_pos = athi_input_manager.mouse.pos;
   auto context = glfwGetCurrentContext();
@@ -243,68 +219,23 @@ void update_inputs() {
 
   // console->info("mouse_pos: {} : {}", mouse_pos.x, mouse_pos.y);
     if (glfwGetKey(context, GLFW_KEY_1) == GLFW_PRESS) {
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
-     particle_system.add(mouse_pos, 1.0f, circle_color);
+     particle_system.add(mouse_pos, 1.0f, circle_color, 10, particle_lifetime);
   }
 
   if (glfwGetKey(context, GLFW_KEY_2) == GLFW_PRESS) {
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
-     particle_system.add(mouse_pos, 2.5f, circle_color);
+     particle_system.add(mouse_pos, 2.5f, circle_color, 10, particle_lifetime);
   }
 
   if (glfwGetKey(context, GLFW_KEY_3) == GLFW_PRESS) {
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
-     particle_system.add(mouse_pos, 5.0f, circle_color);
+     particle_system.add(mouse_pos, 5.0f, circle_color, 10, particle_lifetime);
   }
 
   if (glfwGetKey(context, GLFW_KEY_4) == GLFW_PRESS) {
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
-     particle_system.add(mouse_pos, 10.0f, circle_color);
+     particle_system.add(mouse_pos, 10.0f, circle_color, 10, particle_lifetime);
   }
 
   if (glfwGetKey(context, GLFW_KEY_5) == GLFW_PRESS) {
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
-     particle_system.add(mouse_pos, mouse_size, circle_color);
+     particle_system.add(mouse_pos, mouse_size, circle_color, 10, particle_lifetime);
   }
 
   // Draw Mouse
@@ -357,7 +288,7 @@ void mouse_button_callback(GLFWwindow *window, s32 button, s32 action, s32 mods)
   vec2 mouse_pos = athi_input_manager.mouse.pos;
 
   if (button == GLFW_MOUSE_BUTTON_RIGHT && action == GLFW_PRESS) {
-    particle_system.add(mouse_pos, mouse_size, circle_color);
+    particle_system.add(mouse_pos, mouse_size, circle_color, 1, particle_lifetime);
   }
 }
 
@@ -476,6 +407,7 @@ void key_callback(GLFWwindow *window, s32 key, s32 scancode, s32 action, s32 mod
     if (!quadtree_active) {
       quadtree_active = true;
       use_uniformgrid = false;
+      use_sweep_and_prune = false;
     }
     else {
       quadtree_active = false;
@@ -500,6 +432,7 @@ void key_callback(GLFWwindow *window, s32 key, s32 scancode, s32 action, s32 mod
     if (!use_uniformgrid) {
       use_uniformgrid = true;
       quadtree_active = false;
+      use_sweep_and_prune = false;
     }
     else {
       use_uniformgrid = false;
@@ -507,35 +440,40 @@ void key_callback(GLFWwindow *window, s32 key, s32 scancode, s32 action, s32 mod
     console->info("UniformGrid: {}", use_uniformgrid ? "ON" : "OFF");
   }
 
-  if (quadtree_active) tree_type = TreeType::Quadtree;
-  else if (use_uniformgrid) tree_type = TreeType::UniformGrid;
-  else tree_type = TreeType::None;
-
-
-  if (key_pressed(GLFW_KEY_6) && uniformgrid_parts > 4) {
-    uniformgrid_parts *= 0.25f;
-  }
-
-  if (key_pressed(GLFW_KEY_7) && uniformgrid_parts < 512) {
-    uniformgrid_parts *= 4;
-  }
 
   // Benchmark 1
   if (key_pressed(GLFW_KEY_B)) {
-    for (s32 j = 250; j < 500; j += 2)
-      for (s32 k = 250; k < 500; k += 2)
-        particle_system.add(vec2(j, k), 1.0f, circle_color);
+    EmitterParams params;
+    params.size = vec2(250.0f, 250.0f);
+    params.radius = 1.0f;
+    params.color = circle_color;
+    params.speed = has_random_velocity ? random_velocity_force : 0.0f;
+    params.lifetime = particle_lifetime;
+
+    params.center = vec2(375.0f, 375.0f);
+    particle_system.add_bulk(125 * 125, EmitterShape::Grid, params);
 
-    for (s32 j = framebuffer_width - 250; j > framebuffer_width-500; j -= 2)
-      for (s32 k = framebuffer_height - 250; k > framebuffer_height-500; k -= 2)
-        particle_system.add(vec2(j, k), 1.0f, circle_color);
+    params.center = vec2(framebuffer_width - 375.0f, framebuffer_height - 375.0f);
+    params.seed = 1;
+    particle_system.add_bulk(125 * 125, EmitterShape::Grid, params);
   }
 
   // Benchmark 2
   if (key_pressed(GLFW_KEY_N)) {
-    for (s32 j = 0; j < framebuffer_width; j += 4)
-      for (s32 k = 0; k < framebuffer_height; k += 4)
-        particle_system.add(vec2(j, k), 1.0f, circle_color);
+    EmitterParams params;
+    params.center = vec2(framebuffer_width, framebuffer_height) * 0.5f;
+    params.size = vec2(framebuffer_width, framebuffer_height);
+    params.spacing = 4.0f;
+    params.radius = 1.0f;
+    params.color = circle_color;
+    params.speed = has_random_velocity ? random_velocity_force : 0.0f;
+    params.lifetime = particle_lifetime;
+    particle_system.add_bulk((framebuffer_width / 4) * (framebuffer_height / 4), EmitterShape::Grid, params);
+  }
+
+  // CAPTURE A TRACE, see athi_profiler.h
+  if (key_pressed(GLFW_KEY_F9)) {
+    profiler_capture(120, "../bin/athi_trace.json");
   }
 
   // ERASE ALL CIRCLES
@@ -0,0 +1,328 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "./Renderer/athi_rect.h" // draw_rect, Rect
+#include "./Utility/athi_morton.h" // morton_encode, radix_sort_by_key
+
+#include <algorithm> // std::lower_bound, std::max
+
+// A quadtree stored as flat arrays instead of a tree of heap nodes.
+//
+// Particles are sorted by the morton code of their position, which puts
+// every node's particles in one contiguous range. The tree is then carved out
+// of that range top-down. Like the pointer based Quadtree, a particle is
+// placed in every leaf its bounding box overlaps.
+//
+// All storage is kept between frames, so rebuilding the tree every frame
+// does not touch the heap once the buffers have grown to fit.
+class LinearQuadtree
+{
+public:
+
+  struct Node
+  {
+    vec2  min;
+    vec2  max;
+    s32   first_child {-1}; // The four children are stored contiguously
+    s32   leaf        {-1}; // Index into 'leaves' if this is a leaf
+    s32   level       {0};
+  };
+
+  // A range of 'indices' belonging to one leaf node.
+  struct Leaf
+  {
+    u32   begin {0};
+    u32   count {0};
+    s32   node  {0};
+  };
+
+  s32 max_depth     {5};
+  s32 max_capacity  {50};
+
+  vector<Node>  nodes;
+  vector<Leaf>  leaves;   // In morton order
+  vector<s32>   indices;  // Particle indices, grouped by leaf
+
+  LinearQuadtree() = default;
+
+  LinearQuadtree(const vec2 &min, const vec2 &max) noexcept
+  {
+    reset(min, max);
+  }
+
+  // Sets new bounds and throws away the previous tree. Keeps all storage.
+  void reset(const vec2 &min, const vec2 &max) noexcept
+  {
+    this->min = min;
+    this->max = max;
+    nodes.clear();
+    leaves.clear();
+    indices.clear();
+  }
+
+  void set_data(const vec2 *position, const f32 *radius) noexcept
+  {
+    this->position = position;
+    this->radius = radius;
+  }
+
+  void input_range(s32 begin, s32 end) noexcept
+  {
+    nodes.clear();
+    leaves.clear();
+    indices.clear();
+
+    if (end <= begin) return;
+
+    // Morton codes use 2 bits per level, so we can't go deeper than this.
+    const s32 depth = std::min(max_depth, static_cast<s32>(kMortonBits) - 1);
+
+    // Sort the particles by their morton code
+    {
+      vec2 extent = max - min;
+      extent.x = (extent.x > 1e-6f) ? extent.x : 1e-6f;
+      extent.y = (extent.y > 1e-6f) ? extent.y : 1e-6f;
+      const vec2 inv_extent = 1.0f / extent;
+
+      codes.resize(end - begin);
+      for (s32 i = begin; i < end; ++i)
+      {
+        const u64 code = morton_encode(position[i], min, inv_extent);
+        codes[i - begin] = (code << 32) | static_cast<u32>(i);
+      }
+      radix_sort_by_key(codes, scratch, 2 * kMortonBits);
+    }
+
+    // Build the nodes top-down from the sorted codes
+    Node root;
+    root.min = min;
+    root.max = max;
+    nodes.emplace_back(root);
+    code_begin.clear();
+    build(0, 0, codes.size(), depth);
+    code_begin.emplace_back(static_cast<u32>(codes.size()));
+
+    // Every leaf owns a run of the sorted codes. Most particles fit inside the
+    // leaf holding their center and go straight there, the rest walk the tree.
+    // Count how many particles land in each leaf..
+    for (size_t l = 0; l < leaves.size(); ++l)
+    {
+      for (u32 c = code_begin[l]; c < code_begin[l + 1]; ++c)
+      {
+        const s32 i = static_cast<s32>(static_cast<u32>(codes[c]));
+        if (inside_leaf(l, i))
+          ++leaves[l].count;
+        else
+          for_each_overlapping_leaf(position[i], radius[i], [this](s32 leaf) { ++leaves[leaf].count; });
+      }
+    }
+
+    // ..turn the counts into offsets..
+    u32 offset = 0;
+    cursor.resize(leaves.size());
+    for (size_t l = 0; l < leaves.size(); ++l)
+    {
+      leaves[l].begin = offset;
+      cursor[l] = offset;
+      offset += leaves[l].count;
+    }
+
+    // ..and scatter the particle indices into place.
+    indices.resize(offset);
+    for (size_t l = 0; l < leaves.size(); ++l)
+    {
+      for (u32 c = code_begin[l]; c < code_begin[l + 1]; ++c)
+      {
+        const s32 i = static_cast<s32>(static_cast<u32>(codes[c]));
+        if (inside_leaf(l, i))
+          indices[cursor[l]++] = i;
+        else
+          for_each_overlapping_leaf(position[i], radius[i], [this, i](s32 leaf) { indices[cursor[leaf]++] = i; });
+      }
+    }
+  }
+
+  const s32 *leaf_data(const Leaf &leaf) const noexcept
+  {
+    return indices.data() + leaf.begin;
+  }
+
+  // Calls 'f(a, b)' for every pair of particles in leaves [begin, end) whose
+  // bounding boxes overlap. A pair that shares more than one leaf is passed
+  // on by each of them, see ParticleSystem::find_pairs for dropping repeats.
+  template <class F>
+  void for_each_pair(size_t begin, size_t end, F &&f) const noexcept
+  {
+    for (size_t l = begin; l < end; ++l)
+    {
+      const auto &leaf = leaves[l];
+      const s32 *ids = leaf_data(leaf);
+
+      for (u32 i = 0; i < leaf.count; ++i)
+      {
+        const s32 a = ids[i];
+        const vec2 a_min = position[a] - radius[a];
+        const vec2 a_max = position[a] + radius[a];
+
+        for (u32 j = i + 1; j < leaf.count; ++j)
+        {
+          const s32 b = ids[j];
+          const vec2 b_min = position[b] - radius[b];
+          const vec2 b_max = position[b] + radius[b];
+
+          if (a_min.x >= b_max.x || a_max.x <= b_min.x ||
+              a_min.y >= b_max.y || a_max.y <= b_min.y) continue;
+
+          f(a, b);
+        }
+      }
+    }
+  }
+
+  void get_neighbours(vector<vector<s32>> &cont, const vec2 &position, f32 radius) const noexcept
+  {
+    if (nodes.empty()) return;
+    for_each_overlapping_leaf(position, radius, [this, &cont](s32 l)
+    {
+      const auto &leaf = leaves[l];
+      if (leaf.count != 0)
+        cont.emplace_back(leaf_data(leaf), leaf_data(leaf) + leaf.count);
+    });
+  }
+
+  void get(vector<vector<s32>> &cont) const noexcept
+  {
+    for (const auto &leaf: leaves)
+    {
+      if (leaf.count != 0)
+        cont.emplace_back(leaf_data(leaf), leaf_data(leaf) + leaf.count);
+    }
+  }
+
+  void draw_bounds(bool show_occupied_only, const vec4 &color) const noexcept
+  {
+    for (const auto &leaf: leaves)
+    {
+      if (show_occupied_only && leaf.count == 0) continue;
+      const auto &node = nodes[leaf.node];
+      draw_rect(node.min, node.max, color, true);
+    }
+  }
+
+private:
+
+  const vec2  *position {nullptr};
+  const f32   *radius   {nullptr};
+
+  vec2 min {0.0f, 0.0f};
+  vec2 max {0.0f, 0.0f};
+
+  // Scratch buffers kept around to avoid reallocating every frame
+  vector<u64> codes;
+  vector<u64> scratch;
+  vector<u32> cursor;
+  vector<u32> code_begin; // First code owned by each leaf
+
+  // Splits node 'n' which owns codes[begin, end).
+  void build(s32 n, size_t begin, size_t end, s32 depth) noexcept
+  {
+    const s32 level = nodes[n].level;
+
+    if (static_cast<s32>(end - begin) <= max_capacity || level >= depth)
+    {
+      Leaf leaf;
+      leaf.node = n;
+      nodes[n].leaf = static_cast<s32>(leaves.size());
+      leaves.emplace_back(leaf);
+      code_begin.emplace_back(static_cast<u32>(begin));
+      return;
+    }
+
+    const vec2 min = nodes[n].min;
+    const vec2 max = nodes[n].max;
+    const vec2 mid = (min + max) * 0.5f;
+
+    // Children in morton order: SW, SE, NW, NE
+    const s32 first = static_cast<s32>(nodes.size());
+    nodes[n].first_child = first;
+    for (s32 c = 0; c < 4; ++c)
+    {
+      Node child;
+      child.min = {(c & 1) ? mid.x : min.x, (c & 2) ? mid.y : min.y};
+      child.max = {(c & 1) ? max.x : mid.x, (c & 2) ? max.y : mid.y};
+      child.level = level + 1;
+      nodes.emplace_back(child);
+    }
+
+    // The two code bits that pick a child at this level
+    const u32 shift = 32 + 2 * (kMortonBits - 1 - level);
+    const u64 prefix = (shift + 2 < 64) ? (codes[begin] >> (shift + 2)) << (shift + 2) : 0;
+
+    size_t child_begin = begin;
+    for (s32 c = 0; c < 4; ++c)
+    {
+      const u64 upper = prefix + (static_cast<u64>(c + 1) << shift);
+      const size_t child_end = (c == 3) ? end
+        : std::lower_bound(codes.begin() + child_begin, codes.begin() + end, upper) - codes.begin();
+      build(first + c, child_begin, child_end, depth);
+      child_begin = child_end;
+    }
+  }
+
+  // True if particle 'i' lies entirely inside leaf 'l'.
+  bool inside_leaf(size_t l, s32 i) const noexcept
+  {
+    const auto &node = nodes[leaves[l].node];
+    const vec2 p = position[i];
+    const f32 r = radius[i];
+    return p.x - r >= node.min.x && p.x + r <= node.max.x &&
+           p.y - r >= node.min.y && p.y + r <= node.max.y;
+  }
+
+  // Calls 'f' with the leaf index of every leaf the circle's bounding box overlaps.
+  template <class F>
+  void for_each_overlapping_leaf(const vec2 &pos, f32 r, F &&f) const noexcept
+  {
+    // Depth is capped at kMortonBits, so this never overflows.
+    s32 stack[4 * kMortonBits];
+    s32 top = 0;
+    stack[top++] = 0;
+
+    while (top > 0)
+    {
+      const auto &node = nodes[stack[--top]];
+      if (node.first_child == -1)
+      {
+        f(node.leaf);
+        continue;
+      }
+      for (s32 c = 3; c >= 0; --c)
+      {
+        const auto &child = nodes[node.first_child + c];
+        if (pos.x - r < child.max.x && pos.x + r > child.min.x &&
+            pos.y - r < child.max.y && pos.y + r > child.min.y)
+          stack[top++] = node.first_child + c;
+      }
+    }
+  }
+};
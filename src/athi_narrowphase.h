@@ -0,0 +1,47 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+// Batched circle overlap tests for the narrowphase.
+//
+// Every kernel tests particle 'a' against 'count' candidate particles,
+// writes the candidates it overlaps to 'hits' in their original order and
+// returns how many there were. 'hits' must have room for 'count' entries.
+//
+// The SIMD kernels test 4 (SSE) or 8 (AVX2) candidates at a time. Apart from
+// rounding in the last bit they agree with the scalar one.
+using NarrowphaseKernel = u32 (*)(const vec2 *position, const f32 *radius,
+                                  s32 a, const s32 *candidates, u32 count,
+                                  s32 *hits) noexcept;
+
+u32 narrowphase_scalar(const vec2 *position, const f32 *radius, s32 a,
+                       const s32 *candidates, u32 count, s32 *hits) noexcept;
+
+// These return nullptr if the kernel wasn't compiled in or the CPU doesn't support it.
+NarrowphaseKernel get_narrowphase_sse() noexcept;
+NarrowphaseKernel get_narrowphase_avx2() noexcept;
+
+// The widest kernel this CPU supports: AVX2, then SSE, then scalar.
+NarrowphaseKernel get_narrowphase() noexcept;
+const char *get_narrowphase_name() noexcept;
@@ -0,0 +1,182 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#include "athi_nbody.h"
+
+#include "athi_dispatch.h" // dispatch
+#include "athi_utility.h" // get_begin_and_end
+
+#include <algorithm> // std::max, std::min, std::fill
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+  #define ATHI_X86 1
+  #include <immintrin.h> // SSE
+#else
+  #define ATHI_X86 0
+#endif
+
+// Adds the pull between every particle i in [i_begin, i_end) and every
+// particle j > i in [j_begin, j_end) to both of them.
+// @Hot
+static void nbody_tile(const f32 *x, const f32 *y, const f32 *m,
+                       u32 i_begin, u32 i_end, u32 j_begin, u32 j_end,
+                       f32 *fx, f32 *fy) noexcept
+{
+  const f32 G = static_cast<f32>(kGravitationalConstant);
+  const f32 softening_sqrd = kGravitySoftening * kGravitySoftening;
+
+  for (u32 i = i_begin; i < i_end; ++i)
+  {
+    const f32 xi = x[i];
+    const f32 yi = y[i];
+    const f32 gmi = G * m[i];
+    f32 fxi = 0.0f;
+    f32 fyi = 0.0f;
+
+    u32 j = std::max(j_begin, i + 1);
+
+#if ATHI_X86
+    const __m128 xi4 = _mm_set1_ps(xi);
+    const __m128 yi4 = _mm_set1_ps(yi);
+    const __m128 gmi4 = _mm_set1_ps(gmi);
+    const __m128 softening4 = _mm_set1_ps(softening_sqrd);
+    const __m128 one = _mm_set1_ps(1.0f);
+    __m128 fxi4 = _mm_setzero_ps();
+    __m128 fyi4 = _mm_setzero_ps();
+
+    for (; j + 4 <= j_end; j += 4)
+    {
+      const __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + j), xi4);
+      const __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + j), yi4);
+      const __m128 distance_sqrd = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), softening4);
+
+      // A full precision 1/sqrt. rsqrt is faster but off in the 12th bit.
+      const __m128 inv_distance = _mm_div_ps(one, _mm_sqrt_ps(distance_sqrd));
+      const __m128 inv_distance_cubed = _mm_mul_ps(inv_distance, _mm_mul_ps(inv_distance, inv_distance));
+      const __m128 s = _mm_mul_ps(_mm_mul_ps(gmi4, _mm_loadu_ps(m + j)), inv_distance_cubed);
+
+      const __m128 sx = _mm_mul_ps(s, dx);
+      const __m128 sy = _mm_mul_ps(s, dy);
+      fxi4 = _mm_add_ps(fxi4, sx);
+      fyi4 = _mm_add_ps(fyi4, sy);
+      _mm_storeu_ps(fx + j, _mm_sub_ps(_mm_loadu_ps(fx + j), sx));
+      _mm_storeu_ps(fy + j, _mm_sub_ps(_mm_loadu_ps(fy + j), sy));
+    }
+
+    alignas(16) f32 lanes_x[4];
+    alignas(16) f32 lanes_y[4];
+    _mm_store_ps(lanes_x, fxi4);
+    _mm_store_ps(lanes_y, fyi4);
+    fxi += (lanes_x[0] + lanes_x[1]) + (lanes_x[2] + lanes_x[3]);
+    fyi += (lanes_y[0] + lanes_y[1]) + (lanes_y[2] + lanes_y[3]);
+#endif
+
+    for (; j < j_end; ++j)
+    {
+      const f32 dx = x[j] - xi;
+      const f32 dy = y[j] - yi;
+      const f32 inv_distance = 1.0f / std::sqrt(dx * dx + dy * dy + softening_sqrd);
+      const f32 s = gmi * m[j] * inv_distance * inv_distance * inv_distance;
+
+      fxi += s * dx;
+      fyi += s * dy;
+      fx[j] -= s * dx;
+      fy[j] -= s * dy;
+    }
+
+    fx[i] += fxi;
+    fy[i] += fyi;
+  }
+}
+
+void NBody::compute(const vec2 *position, const f32 *mass, size_t count,
+                    vector<vec2> &pull, bool parallel) noexcept
+{
+  split_x.resize(count);
+  split_y.resize(count);
+  for (size_t i = 0; i < count; ++i)
+  {
+    split_x[i] = position[i].x;
+    split_y[i] = position[i].y;
+  }
+  compute(split_x.data(), split_y.data(), mass, count, pull, parallel);
+}
+
+void NBody::compute(const f32 *x, const f32 *y, const f32 *m, size_t count,
+                    vector<vec2> &pull, bool parallel) noexcept
+{
+  pull.resize(count);
+  interactions = static_cast<u64>(count) * (count > 0 ? count - 1 : 0) / 2;
+  if (count == 0) return;
+
+  const u32 tile_count = static_cast<u32>((count + kTileSize - 1) / kTileSize);
+  tiles.clear();
+  for (u32 I = 0; I < tile_count; ++I)
+    for (u32 J = I; J < tile_count; ++J)
+      tiles.emplace_back(I, J);
+
+  // One set of force arrays per worker. The tiles are split evenly between them.
+  const s32 workers = parallel ? dispatch.size() : 1;
+  fx.resize(workers);
+  fy.resize(workers);
+
+  const auto accumulate = [this, x, y, m, count, workers](size_t begin, size_t end)
+  {
+    for (size_t w = begin; w < end; ++w)
+    {
+      fx[w].assign(count, 0.0f);
+      fy[w].assign(count, 0.0f);
+
+      const auto [first, last] = get_begin_and_end(static_cast<s32>(w), tiles.size(), workers);
+      for (size_t t = first; t < last; ++t)
+      {
+        const auto [I, J] = tiles[t];
+        const u32 i_begin = I * kTileSize;
+        const u32 j_begin = J * kTileSize;
+        const u32 i_end = std::min(i_begin + kTileSize, static_cast<u32>(count));
+        const u32 j_end = std::min(j_begin + kTileSize, static_cast<u32>(count));
+        nbody_tile(x, y, m, i_begin, i_end, j_begin, j_end, fx[w].data(), fy[w].data());
+      }
+    }
+  };
+
+  // Sum up what every worker found
+  const auto reduce = [this, &pull, workers](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      vec2 sum{0.0f, 0.0f};
+      for (s32 w = 0; w < workers; ++w)
+        sum += vec2(fx[w][i], fy[w][i]);
+      pull[i] = sum;
+    }
+  };
+
+  if (parallel)
+  {
+    dispatch.parallel_for(0, static_cast<size_t>(workers), accumulate);
+    dispatch.parallel_for(0, count, reduce);
+  }
+  else
+  {
+    accumulate(0, 1);
+    reduce(0, count);
+  }
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "./Utility/athi_constant_globals.h" // kGravitationalConstant
+
+#include <cmath> // std::sqrt
+#include <utility> // std::pair
+
+// Plummer softening length. Gravity is computed as if every distance was
+// sqrt(d^2 + kGravitySoftening^2), so close and overlapping bodies pull
+// on each other finitely instead of blowing up.
+static constexpr f32 kGravitySoftening = 1.0f;
+
+// The gravitational pull on a body of mass 'm1' at 'p1' from a body of mass 'm2' at 'p2'.
+// @Hot
+inline vec2 gravitational_pull(const vec2 &p1, f32 m1, const vec2 &p2, f32 m2) noexcept
+{
+  const f32 dx = p2.x - p1.x;
+  const f32 dy = p2.y - p1.y;
+  const f32 distance_sqrd = dx * dx + dy * dy + kGravitySoftening * kGravitySoftening;
+  const f32 inv_distance = 1.0f / std::sqrt(distance_sqrd);
+
+  const f32 F = static_cast<f32>(kGravitationalConstant) * m1 * m2 * inv_distance * inv_distance * inv_distance;
+  return vec2(F * dx, F * dy);
+}
+
+// Exact n-body gravity, summed over every pair.
+//
+// Each pair is visited once and the pull is added to both particles with
+// opposite signs. The pairs are walked in square tiles of particles, so both
+// rows of a tile stay in cache, and every worker adds into its own force
+// arrays. Those are summed at the end, so there's no locking in the loop.
+//
+// Meant for up to a few ten thousand particles. Past that, use BarnesHut.
+class NBody
+{
+public:
+
+  static constexpr u32 kTileSize = 256;
+
+  // Interactions computed by the last call to 'compute'
+  u64 interactions {0};
+
+  // Writes the pull on each of the first 'count' particles to 'pull'.
+  void compute(const vec2 *position, const f32 *mass, size_t count,
+               vector<vec2> &pull, bool parallel) noexcept;
+
+  // Same, for positions that are already split into x and y arrays.
+  void compute(const f32 *x, const f32 *y, const f32 *mass, size_t count,
+               vector<vec2> &pull, bool parallel) noexcept;
+
+private:
+
+  // Positions split into separate arrays so the kernel can load four at a time
+  vector<f32> split_x;
+  vector<f32> split_y;
+
+  // One pair of force arrays per worker
+  vector<vector<f32>> fx;
+  vector<vector<f32>> fy;
+
+  // Every tile (I, J) with I <= J
+  vector<std::pair<u32, u32>> tiles;
+};
@@ -0,0 +1,114 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "athi_dispatch.h" // Dispatch
+#include "athi_utility.h" // get_begin_and_end
+#include "./Utility/athi_morton.h" // radix_sort_by_key
+
+#include <array> // std::array
+
+// One digit histogram per chunk, kept by the caller between sorts.
+using RadixHistograms = vector<std::array<size_t, 256>>;
+
+// Same as radix_sort_by_key, but every pass counts and scatters in parallel.
+// Each worker owns one contiguous chunk and its own histogram, and the chunk
+// offsets are laid out in order, so the sort stays stable and the result is
+// identical to the serial version. 'scratch' and 'histograms' keep their
+// storage, so sorting the same amount again allocates nothing.
+inline void parallel_radix_sort_by_key(Dispatch &pool, vector<u64> &items, vector<u64> &scratch, RadixHistograms &histograms,
+                                       u32 key_bits = 32, u32 key_shift = 32) noexcept
+{
+  // Below this the dispatch overhead costs more than the sort itself.
+  constexpr size_t kMinParallelCount = 1 << 14;
+
+  const size_t count = items.size();
+  const s32 chunk_count = pool.size();
+  if (count < kMinParallelCount || chunk_count < 2)
+  {
+    radix_sort_by_key(items, scratch, key_bits, key_shift);
+    return;
+  }
+
+  scratch.resize(count);
+
+  // One histogram per chunk. 'parallel_for_each' hands every worker
+  // exactly one of these when the container matches the pool size.
+  histograms.resize(chunk_count);
+
+  u64 *src = items.data();
+  u64 *dst = scratch.data();
+
+  const u32 passes = (key_bits + 7) / 8;
+  for (u32 pass = 0; pass < passes; ++pass)
+  {
+    const u32 shift = key_shift + pass * 8;
+
+    pool.parallel_for_each(histograms, [&](size_t begin, size_t end)
+    {
+      for (size_t c = begin; c < end; ++c)
+      {
+        auto &histogram = histograms[c];
+        histogram.fill(0);
+        const auto [first, last] = get_begin_and_end(static_cast<s32>(c), count, chunk_count);
+        for (size_t i = first; i < last; ++i)
+          ++histogram[(src[i] >> shift) & 0xff];
+      }
+    });
+
+    // Skip passes where every item has the same digit
+    const size_t digit = (src[0] >> shift) & 0xff;
+    size_t same = 0;
+    for (const auto &histogram: histograms) same += histogram[digit];
+    if (same == count) continue;
+
+    // Turn the counts into offsets, digit-major so chunks keep their order
+    size_t offset = 0;
+    for (size_t d = 0; d < 256; ++d)
+    {
+      for (auto &histogram: histograms)
+      {
+        const size_t c = histogram[d];
+        histogram[d] = offset;
+        offset += c;
+      }
+    }
+
+    pool.parallel_for_each(histograms, [&](size_t begin, size_t end)
+    {
+      for (size_t c = begin; c < end; ++c)
+      {
+        auto &histogram = histograms[c];
+        const auto [first, last] = get_begin_and_end(static_cast<s32>(c), count, chunk_count);
+        for (size_t i = first; i < last; ++i)
+          dst[histogram[(src[i] >> shift) & 0xff]++] = src[i];
+      }
+    });
+
+    std::swap(src, dst);
+  }
+
+  // Make sure the result ends up in 'items'
+  if (src != items.data())
+    std::memcpy(items.data(), src, count * sizeof(u64));
+}
@@ -28,62 +28,145 @@
 #include "athi_utility.h" // read_file, get_begin_and_end
 
 #include "athi_transform.h"  // Transform
+#include "./Utility/athi_morton.h" // morton_encode, radix_sort_by_key
+#include "athi_parallel_sort.h" // parallel_radix_sort_by_key
+#include "athi_narrowphase.h" // get_narrowphase
+#include "athi_contact.h" // resolve_contact
 
-#include <algorithm>  // std::min_element, std::max_element
+#include <algorithm>  // std::min_element, std::max_element, std::unique
+#include <cstring>  // memcpy
 
 ParticleSystem particle_system;
 
-void ParticleSystem::buffered_call(std::function<void()>&& f) noexcept
+void ParticleSystem::execute_buffered_calls() noexcept
 {
-  std::unique_lock<std::mutex> lock(buffered_call_mutex);
-  buffered_call_buffer.emplace_back(std::move(f));
+  if (command_queue.empty()) return;
+
+  Command *list = command_queue.take();
+  for (Command *c = list; c;)
+  {
+    switch (c->type)
+    {
+      case CommandType::Spawn: {
+        // Every spawn in a row goes in as one insert
+        u32 total = 0;
+        Command *last = c;
+        for (Command *s = c; s && s->type == CommandType::Spawn; s = s->next)
+        {
+          total += s->count;
+          last = s;
+        }
+        spawn(*c, total);
+        c = last;
+      } break;
+
+      case CommandType::EraseAll: {
+        // Bumps their generations, so ids held elsewhere stop working
+        for (u32 i = 0; i < particle_count; ++i) handles.destroy(particles.id[i]);
+
+        particle_count = 0;
+        resize_arrays(0);
+        sweep_and_prune.invalidate();
+      } break;
+
+      case CommandType::Recolor: {
+        for (u32 k = 0; k < c->count; ++k)
+        {
+          // Skip particles removed since the ids were picked
+          const s32 i = handles.index_of(c->ids()[k]);
+          if (i >= 0) particles.color[i] = c->color;
+        }
+      } break;
+
+      case CommandType::Impulse: {
+        for (u32 k = 0; k < c->count; ++k)
+        {
+          const s32 i = handles.index_of(c->ids()[k]);
+          if (i >= 0) particles.velocity[i] += c->vec;
+        }
+      } break;
+
+      case CommandType::Drag: {
+        // The distance to the point goes into the velocity, damped so they settle on it
+        for (u32 k = 0; k < c->count; ++k)
+        {
+          const s32 i = handles.index_of(c->ids()[k]);
+          if (i < 0) continue;
+          particles.velocity[i] += c->vec - particles.position[i];
+          particles.velocity[i] *= 0.7f;
+        }
+      } break;
+
+      case CommandType::Remove: {
+        remove_particles(c->ids(), c->count);
+      } break;
+
+      case CommandType::Call: {
+        c->run(c->payload);
+      } break;
+    }
+    c = c->next;
+  }
+  command_queue.release(list);
 }
 
-void ParticleSystem::execute_buffered_calls() noexcept
+// Appends 'total' particles, described by the run of spawn commands starting at 'first'.
+void ParticleSystem::spawn(const Command &first, u32 total) noexcept
 {
-  if (buffered_call_buffer.empty()) return;
-
-  std::unique_lock<std::mutex> lock(buffered_call_mutex);
+  const u32 begin = particle_count;
+  const u32 end = begin + total;
+  resize_arrays(end);
 
-  // Execute all stores callseq
-  for (auto &c : buffered_call_buffer)
+  u32 i = begin;
+  for (const Command *c = &first; i < end; c = c->next)
   {
-    c();
+    const f32 r = c->radius;
+    const f32 m = particle_density * kPI * r * r;
+    for (u32 k = 0; k < c->count; ++k, ++i)
+    {
+      particles.id[i] = handles.create(i);
+      particles.position[i] = c->vec;
+      particles.velocity[i] = has_random_velocity ? rand_vec2(-random_velocity_force, random_velocity_force) : vec2(0.0f, 0.0f);
+      particles.radius[i] = r;
+      particles.mass[i] = m;
+      particles.color[i] = c->color;
+      particles.age[i] = 0.0f;
+      particles.lifetime[i] = c->lifetime;
+    }
   }
 
-  // Clear the buffer for next frame
-  buffered_call_buffer.clear();
+  particle_count = end;
 }
 
 void ParticleSystem::update_particles(int begin, int end, f32 dt) noexcept
 {
   for (int i = begin; i < end; ++i)
   {
-    position[i].x += velocity[i].x * dt * time_scale * air_resistance;
-    position[i].y += velocity[i].y * dt * time_scale * air_resistance;
+    particles.position[i].x += particles.velocity[i].x * dt * time_scale * air_resistance;
+    particles.position[i].y += particles.velocity[i].y * dt * time_scale * air_resistance;
 
     // Border collision
     if (border_collision)
     {
-      if (position[i].x < 0 + radius[i])
+      if (particles.position[i].x < 0 + particles.radius[i])
       {
-        position[i].x = 0 + radius[i];
-        velocity[i].x = -velocity[i].x * collision_energy_loss;
+        particles.position[i].x = 0 + particles.radius[i];
+        particles.velocity[i].x = -particles.velocity[i].x * collision_energy_loss;
       }
-      if (position[i].x > framebuffer_width - radius[i])
+      if (particles.position[i].x > framebuffer_width - particles.radius[i])
       {
-        position[i].x = framebuffer_width - radius[i];
-        velocity[i].x = -velocity[i].x * collision_energy_loss;
+        particles.position[i].x = framebuffer_width - particles.radius[i];
+        particles.velocity[i].x = -particles.velocity[i].x * collision_energy_loss;
       }
-      if (position[i].y < 0 + radius[i])
+      if (particles.position[i].y < 0 + particles.radius[i])
       {
-        position[i].y = 0 + radius[i];
-        velocity[i].y = -velocity[i].y * collision_energy_loss;
+        particles.position[i].y = 0 + particles.radius[i];
+        particles.velocity[i].y = -particles.velocity[i].y * collision_energy_loss;
       }
-      if (position[i].y > framebuffer_height - radius[i])
+      if (particles.position[i].y > framebuffer_height - particles.radius[i])
       {
-        position[i].y = framebuffer_height - radius[i];
-        velocity[i].y = -velocity[i].y * collision_energy_loss;
+        particles.position[i].y = framebuffer_height - particles.radius[i];
+        particles.velocity[i].y = -particles.velocity[i].y * collision_energy_loss;
       }
     }
   }
@@ -91,14 +174,10 @@ void ParticleSystem::update_particles(int begin, int end, f32 dt) noexcept
 
 
 void ParticleSystem::init() noexcept {
-  // Print some debug info about particle sizes
-  console->info("Particle object size: {} bytes", sizeof(Particle));
-  console->info("Particles per cacheline(64 bytes): {} particles",
-                64 / sizeof(Particle));
-
   // Loads in any saved state
   load_state();
 
+#ifndef ATHI_HEADLESS
   // OpenCL
   opencl_init();
 
@@ -197,21 +276,24 @@ void ParticleSystem::init() noexcept {
 
     renderer.finish();
   }
+#endif
 }
 
+#ifndef ATHI_HEADLESS
 // Passes the commandbuffer to the renderer
 // @Hot:  Called every frame.
 // @GPU:  Uses the renderer.
 void ParticleSystem::draw() noexcept
 {
-  if (particle_count == 0) return;
+  ATHI_PROFILE("draw_particles");
+  if (drawn_count == 0) return;
 
   if constexpr (!use_textured_particles) {
     CommandBuffer cmd_buffer;
     cmd_buffer.type = primitive::triangle_fan;
     cmd_buffer.count = num_vertices_per_particle;
     // cmd_buffer.has_indices = true;
-    cmd_buffer.primitive_count = particle_count;
+    cmd_buffer.primitive_count = drawn_count;
 
     renderer.bind();
 
@@ -225,7 +307,7 @@ void ParticleSystem::draw() noexcept
     cmd_buffer.type = primitive::triangles;
     cmd_buffer.count = 6;
     // cmd_buffer.has_indices = true;
-    cmd_buffer.primitive_count = particle_count;
+    cmd_buffer.primitive_count = drawn_count;
 
     renderer.bind();
 
@@ -234,6 +316,7 @@ void ParticleSystem::draw() noexcept
     renderer.draw(cmd_buffer);
   }
 }
+#endif
 
 static vector<float> radii;
 
@@ -243,6 +326,12 @@ void ParticleSystem::update_data() noexcept
   // If there are any buffered calls, execute them
   execute_buffered_calls();
 
+  update_colors();
+}
+
+// @CPU
+void ParticleSystem::update_colors() noexcept
+{
   if (particle_count == 0) return;
 
   if (is_particles_colored_by_acc)
@@ -250,16 +339,16 @@ void ParticleSystem::update_data() noexcept
     // Update the buffers with the new data.
     if (multithreaded_particle_update && use_multithreading)
     {
-      dispatch.parallel_for_each(position, [this](size_t begin, size_t end)
+      dispatch.parallel_for_each(particles.position, [this](size_t begin, size_t end)
       {
        for (size_t i = begin; i < end; ++i)
           {
-            auto &p = position[i];
-            auto &v = velocity[i];
+            auto &p = particles.position[i];
+            auto &v = particles.velocity[i];
 
             const auto old = p - v;
             const auto pos_diff = p - old;
-            color[i] = color_by_acceleration(acceleration_color_min,
+            particles.color[i] = color_by_acceleration(acceleration_color_min,
                                              acceleration_color_max, pos_diff);
           }
         });
@@ -268,26 +357,91 @@ void ParticleSystem::update_data() noexcept
     {
       for (size_t i = 0; i < particle_count; ++i)
       {
-        auto &p = position[i];
-        auto &v = velocity[i];
+        auto &p = particles.position[i];
+        auto &v = particles.velocity[i];
 
         const auto old = p - v;
         const auto pos_diff = p - old;
-        color[i] = color_by_acceleration(acceleration_color_min,
+        particles.color[i] = color_by_acceleration(acceleration_color_min,
                                          acceleration_color_max, pos_diff);
       }
     }
   }
 }
 
+// Copies what the renderer needs into the next snapshot and hands it over.
+// Physics thread only, see Athi_Core::physics_loop.
+void ParticleSystem::publish_snapshot() noexcept
+{
+  auto &snapshot = snapshots.write_slot();
+  snapshot.particle_count = particle_count;
+  snapshot.frame = ++published_frames;
+  snapshot.published_at = get_time();
+  snapshot.step = timestep;
+
+  // The slots keep their storage, so this only allocates while the particle count grows
+  snapshot.position.assign(particles.position.begin(), particles.position.end());
+  snapshot.previous_position.assign(previous_position.begin(), previous_position.end());
+  snapshot.color.assign(particles.color.begin(), particles.color.end());
+  snapshot.radius.assign(particles.radius.begin(), particles.radius.end());
+
+  snapshots.publish();
+}
+
+#ifndef ATHI_HEADLESS
+// Fills 'out' with the positions 'alpha' of the way from 'previous' to 'current'.
+// Returns false if there is nothing to blend, and 'current' should be drawn as is.
+static bool interpolate_positions_into(vector<vec2> &out, const vec2 *previous, size_t previous_count,
+                                       const vec2 *current, u32 count, f32 alpha) noexcept
+{
+  if (!interpolate_positions || alpha >= 1.0f || previous_count != count) return false;
+
+  out.resize(count);
+  const f32 t = std::max(alpha, 0.0f);
+  for (u32 i = 0; i < count; ++i)
+  {
+    out[i] = previous[i] + (current[i] - previous[i]) * t;
+  }
+  return true;
+}
+
 // @GPU
 void ParticleSystem::gpu_buffer_update() noexcept
 {
-  // Update the gpu buffers incase of more particles..
-  if (!position.empty())  { renderer.update_buffer("position",  position); }
-  if (!color.empty())     { renderer.update_buffer("color",     color); }
-  if (!radius.empty())    { renderer.update_buffer("radius",    radius); }
+  ATHI_PROFILE("gpu_buffer_update");
+  if constexpr (multithreaded_engine)
+  {
+    // Physics is running on its own thread, so only touch the snapshot
+    auto &snapshot = snapshots.acquire();
+    drawn_count = snapshot.particle_count;
+    if (drawn_count == 0) return;
+
+    // Physics publishes a step at a time, so blend by how long ago this one came out
+    const f32 alpha = static_cast<f32>((get_time() - snapshot.published_at) / snapshot.step);
+    if (interpolate_positions_into(render_position, snapshot.previous_position.data(), snapshot.previous_position.size(),
+                                   snapshot.position.data(), drawn_count, alpha))
+      renderer.update_buffer("position", render_position);
+    else
+      renderer.update_buffer("position", snapshot.position);
+    renderer.update_buffer("color",    snapshot.color);
+    renderer.update_buffer("radius",   snapshot.radius);
+  }
+  else
+  {
+    drawn_count = particle_count;
+    if (drawn_count == 0) return;
+
+    // Straight from the store, unless it's between two steps, see Athi_Core::start
+    if (interpolate_positions_into(render_position, previous_position.data(), previous_position.size(),
+                                   particles.position.data(), drawn_count, render_alpha))
+      renderer.update_buffer("position", render_position);
+    else
+      renderer.update_buffer("position", particles.position);
+    renderer.update_buffer("color",    particles.color);
+    renderer.update_buffer("radius",   particles.radius);
+  }
 }
+#endif
 
 // @CPU
 void ParticleSystem::rebuild_vertices(u32 num_vertices) noexcept
@@ -316,15 +470,17 @@ void ParticleSystem::rebuild_vertices(u32 num_vertices) noexcept
     vertices[i] = {cos(cont), sin(cont)};
   }
 
+#ifndef ATHI_HEADLESS
   // Update the GPU buffers
   if constexpr (!use_textured_particles)
   {
     renderer.update_buffer("vertices", vertices);
     renderer.update_buffer("indices", indices);
   }
+#endif
 }
 
-auto get_min_and_max_pos(const vector<glm::vec2>& position)
+auto get_min_and_max_pos(Span<const vec2> position)
 {
   glm::vec2 max = {static_cast<float>(-INT_MAX),  static_cast<float>(-INT_MAX)};
   glm::vec2 min = {static_cast<float>( INT_MAX),  static_cast<float>( INT_MAX)};
@@ -338,48 +494,403 @@ auto get_min_and_max_pos(const vector<glm::vec2>& position)
   return std::tuple<glm::vec2, glm::vec2>(min, max);
 }
 
-void ParticleSystem::update_collisions() noexcept
+// Pair keys hold the lower index in the upper 32 bits.
+static u64 make_pair_key(s32 a, s32 b) noexcept
 {
-  // reset the values
-  comparisons = 0;
-  resolutions = 0;
+  const u64 lo = static_cast<u32>((a < b) ? a : b);
+  const u64 hi = static_cast<u32>((a < b) ? b : a);
+  return (lo << 32) | hi;
+}
 
-  if (openCL_active && particle_count >= 256) {
-    opencl_naive();
-    return;
+// Fills 'pairs' with every candidate pair from the active broadphase. Each
+// pair is in the list once, and the list is sorted, so the order does not
+// depend on how the work was split between threads.
+void ParticleSystem::find_pairs() noexcept
+{
+  if (tree_type == TreeType::SweepAndPrune)
+  {
+    // Cheap to keep sorted, so do it every sample instead of once per frame.
+    sweep_and_prune.set_data(particles.position.data(), particles.radius.data());
+    sweep_and_prune.update(particle_count);
+  }
+  else
+  {
+    // Not kept up to date while another broadphase runs
+    sweep_and_prune.invalidate();
   }
 
+  // A few buckets per thread, so filling them needs no locking and the
+  // workers can even out the load by taking buckets as they go.
+  const size_t bucket_count = use_multithreading ? dispatch.size() * Dispatch::kChunksPerThread : 1;
+  pair_buckets.resize(bucket_count);
+  bucket_bounds.resize(bucket_count + 1);
+
+  // A leaf costs about the square of its size, and leaf sizes vary a lot.
+  // Cells and the sweep are close enough to even.
   switch (tree_type)
   {
-    using Tree = TreeType;
-    case Tree::Quadtree: [[fallthrough]];
-    case Tree::UniformGrid: {
-      if (use_multithreading)
+    case TreeType::Quadtree: {
+      split_by_cost(0, quadtree.leaves.size(), [this](size_t l) {
+        const f64 count = quadtree.leaves[l].count;
+        return count * count;
+      }, bucket_count, bucket_bounds.data());
+    } break;
+    case TreeType::UniformGrid: {
+      split_by_cost(0, uniformgrid.cell_total(), [](size_t) { return 1.0; }, bucket_count, bucket_bounds.data());
+    } break;
+    case TreeType::SweepAndPrune: {
+      split_by_cost(0, sweep_and_prune.order.size(), [](size_t) { return 1.0; }, bucket_count, bucket_bounds.data());
+    } break;
+    case TreeType::None: {
+      std::fill(bucket_bounds.begin(), bucket_bounds.end(), 0);
+    } break;
+  }
+
+  const auto gather = [this](size_t begin, size_t end)
+  {
+    for (size_t c = begin; c < end; ++c)
+    {
+      auto &bucket = pair_buckets[c];
+      bucket.clear();
+
+      const auto emit = [&bucket](s32 a, s32 b) { bucket.emplace_back(make_pair_key(a, b)); };
+      const size_t first = bucket_bounds[c];
+      const size_t last = bucket_bounds[c + 1];
+
+      switch (tree_type)
       {
-        dispatch.parallel_for_each(tree_container, [this](size_t begin, size_t end)
-        {
-          collision_quadtree(tree_container, begin, end);
-        });
+        case TreeType::Quadtree: {
+          quadtree.for_each_pair(first, last, emit);
+        } break;
+
+        case TreeType::UniformGrid: {
+          uniformgrid.for_each_pair(first, last, [this, &emit](s32 a, s32 b) {
+            if (particles.position[a].x - particles.radius[a] < particles.position[b].x + particles.radius[b] &&
+                particles.position[a].x + particles.radius[a] > particles.position[b].x - particles.radius[b] &&
+                particles.position[a].y - particles.radius[a] < particles.position[b].y + particles.radius[b] &&
+                particles.position[a].y + particles.radius[a] > particles.position[b].y - particles.radius[b])
+              emit(a, b);
+          });
+        } break;
+
+        case TreeType::SweepAndPrune: {
+          sweep_and_prune.for_each_pair(first, last, emit);
+        } break;
+
+        case TreeType::None: {} break;
       }
-      else {
-        collision_quadtree(tree_container, 0, tree_container.size());
+    }
+  };
+
+  if (use_multithreading)
+    dispatch.parallel_for_each(pair_buckets, gather);
+  else
+    gather(0, bucket_count);
+
+  pairs.clear();
+  for (const auto &bucket: pair_buckets)
+    pairs.insert(pairs.end(), bucket.begin(), bucket.end());
+
+  if (use_multithreading)
+    parallel_radix_sort_by_key(dispatch, pairs, pairs_scratch, radix_histograms, 64, 0);
+  else
+    radix_sort_by_key(pairs, pairs_scratch, 64, 0);
+
+  // A pair that shares more than one leaf comes out of each, next to each other now
+  const auto unique_end = std::unique(pairs.begin(), pairs.end());
+  stats.add(Stat::DuplicatePairs, static_cast<u64>(pairs.end() - unique_end));
+  pairs.erase(unique_end, pairs.end());
+
+  stats.add(Stat::CandidatePairs, pairs.size());
+}
+
+// Drops the pairs whose circles don't overlap. The list is sorted, so all
+// pairs that share a first particle are tested in one narrowphase call.
+void ParticleSystem::filter_pairs() noexcept
+{
+  const auto narrowphase = get_narrowphase();
+  const s32 bucket_count = static_cast<s32>(pair_buckets.size());
+
+  const auto filter = [this, narrowphase, bucket_count](size_t begin, size_t end)
+  {
+    // Reused between frames
+    static thread_local vector<s32> candidates;
+    static thread_local vector<s32> hits;
+
+    for (size_t c = begin; c < end; ++c)
+    {
+      auto &bucket = pair_buckets[c];
+      bucket.clear();
+
+      const auto [first, last] = get_begin_and_end(static_cast<s32>(c), pairs.size(), bucket_count);
+
+      u64 bucket_hits = 0;
+      for (size_t k = first; k < last;)
+      {
+        const u64 a = pairs[k] >> 32;
+
+        candidates.clear();
+        for (; k < last && (pairs[k] >> 32) == a; ++k)
+          candidates.emplace_back(static_cast<s32>(static_cast<u32>(pairs[k])));
+
+        hits.resize(candidates.size());
+        const u32 hit_count = narrowphase(particles.position.data(), particles.radius.data(), static_cast<s32>(a),
+                                          candidates.data(), static_cast<u32>(candidates.size()), hits.data());
+
+        for (u32 h = 0; h < hit_count; ++h)
+          bucket.emplace_back((a << 32) | static_cast<u32>(hits[h]));
+        bucket_hits += hit_count;
       }
-    } break;
+      stats.add(Stat::NarrowphaseHits, bucket_hits);
+    }
+  };
+
+  if (use_multithreading)
+    dispatch.parallel_for_each(pair_buckets, filter);
+  else
+    filter(0, pair_buckets.size());
+
+  // Buckets hold consecutive slices, so the result is still sorted.
+  pairs.clear();
+  for (const auto &bucket: pair_buckets)
+    pairs.insert(pairs.end(), bucket.begin(), bucket.end());
+}
+
+// Without a broadphase every pair is a candidate, so rather than list them
+// all this tests them on the spot and fills 'pairs' with the ones that
+// overlap. Rows come out in order, so the list is sorted like filter_pairs
+// leaves it. Nothing is moved here, the contacts are resolved in batches
+// like the others.
+void ParticleSystem::find_all_contacts() noexcept
+{
+  // Not kept up to date while another broadphase runs
+  sweep_and_prune.invalidate();
+
+  const size_t bucket_count = use_multithreading ? dispatch.size() * Dispatch::kChunksPerThread : 1;
+  pair_buckets.resize(bucket_count);
+  bucket_bounds.resize(bucket_count + 1);
 
-    case Tree::None: {
-      if (use_multithreading) {
-        dispatch.parallel_for_each(position, [this](size_t begin, size_t end)
+  // Row 'i' checks every particle after it, so early rows cost the most
+  const size_t total = particle_count;
+  split_by_cost(0, total, [total](size_t i) { return static_cast<f64>(total - i); }, bucket_count, bucket_bounds.data());
+
+  const auto test = [this, total](size_t begin, size_t end)
+  {
+    for (size_t c = begin; c < end; ++c)
+    {
+      auto &bucket = pair_buckets[c];
+      bucket.clear();
+
+      const size_t first = bucket_bounds[c];
+      const size_t last = bucket_bounds[c + 1];
+      for (size_t i = first; i < last; ++i)
+        for (size_t j = i + 1; j < total; ++j)
+          if (collision_check(static_cast<s32>(i), static_cast<s32>(j)))
+            bucket.emplace_back(make_pair_key(static_cast<s32>(i), static_cast<s32>(j)));
+
+      // Every pair in the rows is a candidate
+      stats.add(Stat::CandidatePairs, (last - first) * (2 * total - first - last - 1) / 2);
+      stats.add(Stat::NarrowphaseHits, bucket.size());
+    }
+  };
+
+  if (use_multithreading)
+    dispatch.parallel_for_each(pair_buckets, test);
+  else
+    test(0, bucket_count);
+
+  pairs.clear();
+  for (const auto &bucket: pair_buckets)
+    pairs.insert(pairs.end(), bucket.begin(), bucket.end());
+}
+
+// Splits 'pairs' into batches where no particle shows up twice, so a batch
+// can be resolved in parallel without any locking. Pairs are given the
+// lowest color neither of their particles has used yet. The rare pair that
+// finds all colors taken goes into a last batch that runs on one thread.
+//
+// The particles are split into kColorRegions ranges of indices. Pairs with
+// both particles in one range only touch that range's masks, so the ranges
+// are colored in parallel. Thanks to the morton reorder most pairs are
+// like that, and the few that cross a range boundary are colored after, on
+// this thread. The region count doesn't depend on the thread count, so the
+// batches come out the same every run.
+void ParticleSystem::color_pairs() noexcept
+{
+  constexpr u32 overflow = kPairColors;
+  constexpr u32 regions = kColorRegions;
+
+  pair_color_mask.resize(particle_count);
+  pair_colors.resize(pairs.size());
+  region_color_count.resize(regions);
+  region_cross_pairs.resize(regions);
+
+  const auto first_particle = [this](u32 r) { return static_cast<u32>(static_cast<u64>(particle_count) * r / regions); };
+
+  // Pairs are sorted by their first particle, so each region's pairs are one slice
+  for (u32 r = 0; r <= regions; ++r)
+  {
+    const u64 key = static_cast<u64>(first_particle(r)) << 32;
+    region_pair_start[r] = static_cast<u32>(std::lower_bound(pairs.begin(), pairs.end(), key) - pairs.begin());
+  }
+
+  const auto pick_color = [this](u32 a, u32 b) noexcept
+  {
+    const u64 free = ~(pair_color_mask[a] | pair_color_mask[b]);
+    if (free == 0) return overflow;
+    const u32 c = count_trailing_zeros(free);
+    pair_color_mask[a] |= u64(1) << c;
+    pair_color_mask[b] |= u64(1) << c;
+    return c;
+  };
+
+  const auto color_regions = [&](size_t begin, size_t end)
+  {
+    for (size_t r = begin; r < end; ++r)
+    {
+      const u32 last_particle = first_particle(static_cast<u32>(r) + 1);
+      std::fill(pair_color_mask.begin() + first_particle(static_cast<u32>(r)), pair_color_mask.begin() + last_particle, 0);
+
+      auto &cross = region_cross_pairs[r];
+      auto &count = region_color_count[r];
+      cross.clear();
+      count.fill(0);
+      for (u32 k = region_pair_start[r]; k < region_pair_start[r + 1]; ++k)
+      {
+        const u32 a = static_cast<u32>(pairs[k] >> 32);
+        const u32 b = static_cast<u32>(pairs[k]);
+        if (b >= last_particle)
         {
-           collision_logNxN(particle_count, begin, end);
-        });
-      }
-      else {
-          collision_logNxN(particle_count, 0, particle_count);
+          cross.emplace_back(k);
+          continue;
+        }
+        const u32 c = pick_color(a, b);
+        pair_colors[k] = static_cast<u8>(c);
+        ++count[c];
       }
-    } break;
+    }
+  };
+
+  if (use_multithreading)
+    dispatch.parallel_for(0, regions, color_regions, 1);
+  else
+    color_regions(0, regions);
+
+  // The pairs between regions, in order
+  for (u32 r = 0; r < regions; ++r)
+  {
+    for (const u32 k : region_cross_pairs[r])
+    {
+      const u32 c = pick_color(static_cast<u32>(pairs[k] >> 32), static_cast<u32>(pairs[k]));
+      pair_colors[k] = static_cast<u8>(c);
+      ++region_color_count[r][c];
+    }
+  }
+
+  // Counting sort the pairs into their batches. Every region scatters its
+  // own slice, and a batch lists the regions in order, so each batch keeps
+  // the pairs sorted.
+  const auto scatter = [this](size_t begin, size_t end)
+  {
+    for (size_t r = begin; r < end; ++r)
+    {
+      auto &cursor = region_color_count[r];
+      for (u32 k = region_pair_start[r]; k < region_pair_start[r + 1]; ++k)
+        batched_pairs[cursor[pair_colors[k]]++] = pairs[k];
+    }
+  };
+
+  // Counts to offsets, color-major so the regions stay in order within a batch
+  u32 offset = 0;
+  for (u32 c = 0; c <= kPairColors; ++c)
+  {
+    batch_start[c] = offset;
+    for (auto &count : region_color_count)
+    {
+      const u32 n = count[c];
+      count[c] = offset;
+      offset += n;
+    }
+  }
+  batch_start[kPairColors + 1] = offset;
+
+  batched_pairs.resize(pairs.size());
+  if (use_multithreading)
+    dispatch.parallel_for(0, regions, scatter, 1);
+  else
+    scatter(0, regions);
+}
+
+void ParticleSystem::collision_pairs(size_t begin, size_t end) noexcept
+{
+  const vec2 bounds(framebuffer_width, framebuffer_height);
+
+  u64 hits = 0;
+  for (size_t k = begin; k < end; ++k)
+  {
+    const s32 a = static_cast<s32>(batched_pairs[k] >> 32);
+    const s32 b = static_cast<s32>(static_cast<u32>(batched_pairs[k]));
+    hits += resolve_contact(particles.position.data(), particles.velocity.data(), particles.radius.data(), particles.mass.data(),
+                            a, b, bounds, collision_energy_loss);
+  }
+
+  stats.add(Stat::ResolvedContacts, hits);
+}
+
+void ParticleSystem::update_collisions() noexcept
+{
+#ifndef ATHI_HEADLESS
+  if (openCL_active && particle_count >= 256) {
+    opencl_naive();
+    return;
+  }
+#endif
+
+  if (tree_type == TreeType::None)
+  {
+    ScopedStageTimer timer(stage_times, Stage::Narrowphase);
+    find_all_contacts();
+  }
+  else
+  {
+    {
+      ScopedStageTimer timer(stage_times, Stage::Broadphase);
+      find_pairs();
+    }
+    {
+      ScopedStageTimer timer(stage_times, Stage::Narrowphase);
+      filter_pairs();
+    }
+  }
+  {
+    ScopedStageTimer timer(stage_times, Stage::Color);
+    color_pairs();
+  }
+  if (on_contacts) on_contacts();
+
+  ScopedStageTimer timer(stage_times, Stage::Resolve);
+  for (u32 c = 0; c <= kPairColors; ++c)
+  {
+    const u32 begin = batch_start[c];
+    const u32 end = batch_start[c + 1];
+    if (begin == end) continue;
+
+    // The overflow batch can share particles, so it always runs serially.
+    // Small batches are run on this thread, see GrainSize
+    if (use_multithreading && c != kPairColors)
+    {
+      dispatch.parallel_for(begin, end, [this](size_t begin, size_t end)
+      {
+        collision_pairs(begin, end);
+      }, collision_grain);
+    }
+    else {
+      collision_pairs(begin, end);
+    }
   }
 }
 
+#ifndef ATHI_HEADLESS
 void ParticleSystem::draw_debug_nodes() noexcept {
   if (particle_count == 0) return;
 
@@ -390,8 +901,8 @@ void ParticleSystem::draw_debug_nodes() noexcept {
     for (int i = 0; i < particle_count; ++i) {
       draw_rect
       (
-        position[i] - radius[i], // min
-        position[i] + radius[i], // max
+        particles.position[i] - particles.radius[i], // min
+        particles.position[i] + particles.radius[i], // max
         debug_color,      // color
         true
       );
@@ -403,7 +914,10 @@ void ParticleSystem::draw_debug_nodes() noexcept {
       } break;
 
       case TreeType::UniformGrid: {
-        if (circle_collision && draw_nodes) uniformgrid.draw_bounds(debug_color);
+        if (circle_collision && draw_nodes) uniformgrid.draw_bounds(quadtree_show_only_occupied, debug_color);
+      } break;
+
+      case TreeType::SweepAndPrune: {
       } break;
 
       case TreeType::None: {
@@ -411,80 +925,164 @@ void ParticleSystem::draw_debug_nodes() noexcept {
     }
   }
 }
+#endif
 
 void ParticleSystem::update(float dt) noexcept
 {
-  // @Hack
-  if constexpr (multithreaded_engine)
-    std::unique_lock<std::mutex> lck(particles_mutex);
+  begin_frame();
+  expire(dt);
+  reorder_if_due();
+  simulate(dt);
+  if (use_gravitational_force) apply_n_body();
+  end_frame();
+}
+
+void ParticleSystem::begin_frame() noexcept
+{
+  // Counted over the whole frame
+  stats.reset();
+  stage_times.reset();
+}
 
+void ParticleSystem::end_frame() noexcept
+{
+  frame_stats = stats.reduce();
+  frame_times = stage_times;
+}
+
+// @CPU
+void ParticleSystem::expire(float dt) noexcept
+{
+  expired_particles = 0;
   if (particle_count == 0) return;
 
+  std::atomic<u32> expired{0};
+  const auto grow_older = [this, dt, &expired](size_t begin, size_t end)
+  {
+    u32 count = 0;
+    for (size_t i = begin; i < end; ++i)
+    {
+      particles.age[i] += dt;
+      count += (particles.lifetime[i] > 0.0f && particles.age[i] >= particles.lifetime[i]);
+    }
+    if (count) expired.fetch_add(count, std::memory_order_relaxed);
+  };
 
-  if (!circle_collision) return;
+  if (use_multithreading)
+    dispatch.parallel_for(0, particle_count, grow_older);
+  else
+    grow_older(0, particle_count);
+
+  if (expired == 0) return;
+
+  // Back to front, so the particle moved into a gap has already been looked at
+  for (u32 i = particle_count; i-- > 0;)
+  {
+    if (particles.lifetime[i] > 0.0f && particles.age[i] >= particles.lifetime[i]) remove_at(i);
+  }
+
+  resize_arrays(particle_count);
+  expired_particles = expired;
+}
+
+void ParticleSystem::reorder_if_due() noexcept
+{
+  if (particle_count == 0 || !circle_collision) return;
+
+  // Keep particles that are close in space close in memory
+  if (reorder_interval > 0 && ++frames_since_reorder >= reorder_interval)
+  {
+    ScopedStageTimer timer(stage_times, Stage::Reorder);
+    frames_since_reorder = 0;
+    reorder();
+  }
+}
+
+void ParticleSystem::build_tree() noexcept
+{
+  if (particle_count == 0 || !circle_collision) return;
+  ScopedStageTimer timer(stage_times, Stage::TreeBuild);
 
   // Get the optimal bounds for our tree
   vec2 min, max;
   if (tree_optimized_size) {
-    const auto[mi, ma] = get_min_and_max_pos(position);
+    const auto[mi, ma] = get_min_and_max_pos(particles.position);
     min = mi;
     max = ma;
   }
 
   // Use a tree to partition the data
-  tree_container.clear();
   switch (tree_type) {
     using Tree = TreeType;
     case Tree::None: {} break;
     case Tree::Quadtree: {
 
-      Quadtree::max_depth = quadtree_depth;
-      Quadtree::max_capacity = quadtree_capacity;
+      quadtree.max_depth = quadtree_depth;
+      quadtree.max_capacity = quadtree_capacity;
 
+      // The tree keeps its storage between frames, so only reset it.
       if (tree_optimized_size)
-        quadtree = Quadtree(min, max);
+        quadtree.reset(min, max);
       else
-        quadtree = Quadtree({0.0f, 0.0f}, {framebuffer_width, framebuffer_height});
+        quadtree.reset({0.0f, 0.0f}, {framebuffer_width, framebuffer_height});
 
-      {
-        quadtree.set_data(position, radius);
-        quadtree.input_range(0, particle_count);
-        quadtree.get(tree_container);
-      }
+      quadtree.set_data(particles.position.data(), particles.radius.data());
+      quadtree.input_range(0, particle_count);
     } break;
     case Tree::UniformGrid: {
-      // {
-
-      //   if (tree_optimized_size)
-      //     uniformgrid.init(min, max, uniformgrid_parts);
-      //   else
-      //     uniformgrid.reset();
-      // }
-      // {
-
-      //   uniformgrid.input(particles);
-      // }
-      // {
+      if (tree_optimized_size)
+        uniformgrid.reset(min, max);
+      else
+        uniformgrid.reset({0.0f, 0.0f}, {framebuffer_width, framebuffer_height});
 
-      //   uniformgrid.get(tree_container);
-      // }
+      uniformgrid.set_data(particles.position.data(), particles.radius.data());
+      uniformgrid.input_range(0, particle_count);
     } break;
+    case Tree::SweepAndPrune: {} break;
   }
+}
+
+void ParticleSystem::count_tree_leaves() noexcept
+{
+  if constexpr (collect_frame_stats)
+  {
+    const auto count_leaf = [this](u64 occupancy) {
+      if (occupancy == 0) return;
+      stats.add(Stat::LeafCount, 1);
+      stats.max(Stat::MaxLeafOccupancy, occupancy);
+    };
+    if (tree_type == TreeType::Quadtree)
+      for (const auto &leaf : quadtree.leaves) count_leaf(leaf.count);
+    else if (tree_type == TreeType::UniformGrid)
+      for (const auto count : uniformgrid.cell_count) count_leaf(count);
+  }
+}
+
+void ParticleSystem::simulate(float dt) noexcept
+{
+  // Where the particles were before this step, so drawing can land between
+  // steps. Taken here since expiring and reordering move particles around.
+  previous_position.assign(particles.position.begin(), particles.position.end());
+
+  if (particle_count == 0 || !circle_collision) return;
 
   // Check for collisions and resolve if needed
 
   for (s32 j = 0; j < physics_samples; ++j)
   {
+    {
+      ScopedStageTimer timer(stage_times, Stage::Integrate);
+
       // Update particles positions
       if (multithreaded_particle_update)
       {
-        dispatch.parallel_for_each(position, [dt, this](size_t begin, size_t end)
+        dispatch.parallel_for_each(particles.position, [dt, this](size_t begin, size_t end)
         {
           for (size_t i = begin; i < end; ++i)
           {
-            velocity[i].y -= gravity * mass[i];
-            update_particles(begin, end, dt);
+            particles.velocity[i].y -= gravity * particles.mass[i];
           }
+          update_particles(begin, end, dt);
         });
 
       }
@@ -492,50 +1090,159 @@ void ParticleSystem::update(float dt) noexcept
       {
           for (size_t i = 0; i < particle_count; ++i)
           {
-            velocity[i].y -= gravity * mass[i];
+            particles.velocity[i].y -= gravity * particles.mass[i];
           }
           update_particles(0, particle_count, dt);
       }
+    }
+
+    // Built from the positions the pairs are tested at. A tree from before
+    // the particles moved misses pairs that have come into reach since.
+    build_tree();
     update_collisions();
   }
+  count_tree_leaves();
+}
+
+// Moves 'data[codes[i]]' to 'data[i]', where the index sits in the lower 32 bits of each code.
+// 'scratch' holds the reordered bytes on the way and is reused between calls.
+template <class T>
+static void permute(Span<T> data, const vector<u64> &codes, vector<u8> &scratch) noexcept
+{
+  scratch.resize(data.size() * sizeof(T));
+  u8 *reordered = scratch.data();
+
+  const auto gather = [data, &codes, reordered](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; ++i)
+      std::memcpy(reordered + i * sizeof(T), &data[static_cast<u32>(codes[i])], sizeof(T));
+  };
+
+  // The store can't swap arrays with a vector, so copy it back instead.
+  const auto copy_back = [data, reordered](size_t begin, size_t end)
+  {
+    std::memcpy(data.data() + begin, reordered + begin * sizeof(T), (end - begin) * sizeof(T));
+  };
+
+  if (use_multithreading)
+  {
+    dispatch.parallel_for_each(data, gather);
+    dispatch.parallel_for_each(data, copy_back);
+  }
+  else
+  {
+    gather(0, data.size());
+    copy_back(0, data.size());
+  }
 }
 
 // @CPU
-void ParticleSystem::add(const glm::vec2 &pos, float radius, const glm::vec4 &color) noexcept
+void ParticleSystem::reorder() noexcept
 {
-  buffered_call([this, pos, radius, color]()
+  if (particle_count < 2) return;
+
+  const auto start = get_time();
+
+  const auto [min, max] = get_min_and_max_pos(particles.position);
+  vec2 extent = max - min;
+  extent.x = (extent.x > 1e-6f) ? extent.x : 1e-6f;
+  extent.y = (extent.y > 1e-6f) ? extent.y : 1e-6f;
+  const vec2 inv_extent = 1.0f / extent;
+
+  reorder_codes.resize(particle_count);
+  const auto encode = [this, min = min, inv_extent](size_t begin, size_t end)
   {
-    glm::vec2 vel;
-    if (has_random_velocity)
-      vel = rand_vec2(-random_velocity_force, random_velocity_force);
+    for (size_t i = begin; i < end; ++i)
+    {
+      const u64 code = morton_encode(particles.position[i], min, inv_extent);
+      reorder_codes[i] = (code << 32) | static_cast<u32>(i);
+    }
+  };
+
+  if (use_multithreading)
+  {
+    dispatch.parallel_for_each(particles.position, encode);
+    parallel_radix_sort_by_key(dispatch, reorder_codes, reorder_scratch, radix_histograms, 2 * kMortonBits);
+  }
+  else
+  {
+    encode(0, particle_count);
+    radix_sort_by_key(reorder_codes, reorder_scratch, 2 * kMortonBits);
+  }
+
+  permute(particles.id, reorder_codes, reorder_bytes);
+  permute(particles.position, reorder_codes, reorder_bytes);
+  permute(particles.velocity, reorder_codes, reorder_bytes);
+  permute(particles.radius, reorder_codes, reorder_bytes);
+  permute(particles.mass, reorder_codes, reorder_bytes);
+  permute(particles.color, reorder_codes, reorder_bytes);
+  permute(particles.age, reorder_codes, reorder_bytes);
+  permute(particles.lifetime, reorder_codes, reorder_bytes);
+
+  for (size_t i = 0; i < particle_count; ++i)
+    handles.moved(particles.id[i], static_cast<u32>(i));
 
+  // Every index changed
+  sweep_and_prune.renumber(reorder_codes);
+
+  reorder_time = (get_time() - start) * 1000.0;
+}
+
+// @CPU
+void ParticleSystem::add(const glm::vec2 &pos, float radius, const glm::vec4 &color, u32 count, f32 lifetime) noexcept
+{
+  command_queue.spawn(pos, radius, color, count, lifetime);
+}
+
+void ParticleSystem::add_bulk(u32 count, EmitterShape shape, const EmitterParams &params) noexcept
+{
+  if (count == 0) return;
+  command_queue.call([this, count, shape, params]() { spawn_bulk(count, shape, params); });
+}
+
+// @CPU
+void ParticleSystem::spawn_bulk(u32 count, EmitterShape shape, const EmitterParams &params) noexcept
+{
+  const u32 begin = particle_count;
+  const u32 end = begin + count;
+  resize_arrays(end);
+
+  // The handle table isn't thread safe, so the ids are made up front
+  for (u32 i = begin; i < end; ++i) particles.id[i] = handles.create(i);
+
+  const auto fill = [&](size_t first, size_t last)
+  {
+    for (size_t i = first; i < last; ++i)
     {
-      // @Hack
-      if constexpr (multithreaded_engine)
-        std::unique_lock<std::mutex> lck(particles_mutex);
-
-      id.emplace_back(particle_count);
-      position.emplace_back(pos);
-      velocity.emplace_back(vel);
-      this->radius.emplace_back(radius);
-      mass.emplace_back(particle_density * kPI * radius * radius);
-      this->color.emplace_back(color);
-
-      ++particle_count;
+      const u32 k = static_cast<u32>(i - begin);
+      const f32 r = emit_radius(params, k);
+      emit_particle(shape, params, k, particles.position[i], particles.velocity[i]);
+      particles.radius[i] = r;
+      particles.mass[i] = particle_density * kPI * r * r;
+      particles.color[i] = params.color;
+      particles.age[i] = 0.0f;
+      particles.lifetime[i] = params.lifetime;
     }
-  });
+  };
+
+  if (use_multithreading)
+    dispatch.parallel_for(begin, end, fill);
+  else
+    fill(begin, end);
+
+  particle_count = end;
 }
 
 // @Hot
 bool ParticleSystem::collision_check(int a, int b) const noexcept
 {
   // Local variables
-  const float ax = position[a].x;
-  const float ay = position[a].y;
-  const float bx = position[b].x;
-  const float by = position[b].y;
-  const float ar = radius[a];
-  const float br = radius[b];
+  const float ax = particles.position[a].x;
+  const float ay = particles.position[a].y;
+  const float bx = particles.position[b].x;
+  const float by = particles.position[b].y;
+  const float ar = particles.radius[a];
+  const float br = particles.radius[b];
 
   // square collision check
   if (ax - ar < bx + br &&
@@ -561,157 +1268,64 @@ bool ParticleSystem::collision_check(int a, int b) const noexcept
 // Collisions response between two circles with varying radius and mass.
 void ParticleSystem::collision_resolve(int a, int b) noexcept
 {
-  // Local variables
-  auto dx = position[b].x - position[a].x;
-  auto dy = position[b].y - position[a].y;
-  const auto vdx = velocity[b].x - velocity[a].x;
-  const auto vdy = velocity[b].y - velocity[a].y;
-  const auto a_vel = velocity[a];
-  const auto b_vel = velocity[b];
-  const auto m1 = mass[a];
-  const auto m2 = mass[b];
-
-  // Should the circles intersect. Seperate them. If not the next
-  // calculated values will be off.
-  separate(a, b);
-
-  // A negative 'd' means the circles velocities are in opposite directions
-  const auto d = dx * vdx + dy * vdy;
-
-  // And we don't resolve collisions between circles moving away from eachother
-  if (d < 1e-11f)
-  {
-    const auto norm = glm::normalize(glm::vec2(dx, dy));
-    const auto tang = glm::vec2{norm.y * -1.0, norm.x};
-    const auto scal_norm_1 = glm::dot(norm, a_vel);
-    const auto scal_norm_2 = glm::dot(norm, b_vel);
-    const auto scal_tang_1 = glm::dot(tang, a_vel);
-    const auto scal_tang_2 = glm::dot(tang, b_vel);
-
-    const auto scal_norm_1_after = (scal_norm_1 * (m1 - m2) + 2.0f * m2 * scal_norm_2) / (m1 + m2);
-    const auto scal_norm_2_after = (scal_norm_2 * (m2 - m1) + 2.0f * m1 * scal_norm_1) / (m1 + m2);
-    const auto scal_norm_1_after_vec = norm * scal_norm_1_after;
-    const auto scal_norm_2_after_vec = norm * scal_norm_2_after;
-    const auto scal_norm_1_vec = tang * scal_tang_1;
-    const auto scal_norm_2_vec = tang * scal_tang_2;
-
-    // Update velocities
-    velocity[a] = (scal_norm_1_vec + scal_norm_1_after_vec) * collision_energy_loss;
-    velocity[b] = (scal_norm_2_vec + scal_norm_2_after_vec) * collision_energy_loss;
-  }
-}
-
-// Separates two intersecting circles.
-void ParticleSystem::separate(int a, int b) noexcept
-{
-  // Local variables
-  const glm::vec2 a_pos = position[a];
-  const glm::vec2 b_pos = position[b];
-  const f32 ar = radius[a];
-  const f32 br = radius[b];
-
-  const f32 collision_depth = (ar + br) - glm::distance(b_pos, a_pos);
-
-  if (collision_depth < 1e-11f) return;
-
-  const f32 dx = b_pos.x - a_pos.x;
-  const f32 dy = b_pos.y - a_pos.y;
-
-  // contact angle
-  const f32 collision_angle = atan2(dy, dx);
-  const f32 cos_angle = cos(collision_angle);
-  const f32 sin_angle = sin(collision_angle);
-
-  glm::vec2 a_move = { -collision_depth * 0.5f * cos_angle,  -collision_depth * 0.5f * sin_angle};
-  glm::vec2 b_move = {  collision_depth * 0.5f * cos_angle,   collision_depth * 0.5f * sin_angle};
-
-  // stores the position offsets
-  glm::vec2 a_pos_move{0.0f};
-  glm::vec2 b_pos_move{0.0f};
-
-  // Make sure they dont moved beyond the border
-  // This will become not needed when borders are
-  //  segments instead of hardcoded.
-  if (a_pos.x + a_move.x >= 0.0f + ar &&
-      a_pos.x + a_move.x <= framebuffer_width - ar)
-    a_pos_move.x += a_move.x;
-  if (a_pos.y + a_move.y >= 0.0f + ar &&
-      a_pos.y + a_move.y <= framebuffer_height - ar)
-    a_pos_move.y += a_move.y;
-  if (b_pos.x + b_move.x >= 0.0f + br &&
-      b_pos.x + b_move.x <= framebuffer_width - br)
-    b_pos_move.x += b_move.x;
-  if (b_pos.y + b_move.y >= 0.0f + br &&
-      b_pos.y + b_move.y <= framebuffer_height - br)
-    b_pos_move.y += b_move.y;
-
-  // Update positions
-  position[a] += a_pos_move;
-  position[b] += b_pos_move;
-}
-
-void ParticleSystem::gravitational_force(int a, int b) noexcept
-{
-  const f32 x1 = position[a].x;
-  const f32 y1 = position[a].y;
-  const f32 x2 = position[b].x;
-  const f32 y2 = position[b].y;
-  const f32 m1 = mass[a];
-  const f32 m2 = mass[b];
-
-  const f32 dx = x2 - x1;
-  const f32 dy = y2 - y1;
-  const f32 d = sqrt(dx * dx + dy * dy);
-
-  const f32 angle = atan2(dy, dx);
-  const f64 G = kGravitationalConstant;
-  const f32 F = G * m1 * m2 / d * d;
-
-  velocity[a].x += F * cos(angle);
-  velocity[a].y += F * sin(angle);
+  const vec2 bounds(framebuffer_width, framebuffer_height);
+  resolve_contact(particles.position.data(), particles.velocity.data(), particles.radius.data(), particles.mass.data(), a, b, bounds, collision_energy_loss);
 }
 
 void ParticleSystem::apply_n_body() noexcept {
-  for (size_t i = 0; i < particle_count; ++i) {
-    for (size_t j = 0; j < particle_count; ++j) {
-      gravitational_force(i, j);
-    }
+  ScopedStageTimer timer(stage_times, Stage::NBody);
+  if (use_barnes_hut) {
+    apply_barnes_hut();
+    return;
   }
-}
 
-// (N-1)*N/2
-void ParticleSystem::collision_logNxN(size_t total, size_t begin, size_t end) noexcept {
-  for (size_t i = begin; i < end; ++i) {
-    for (size_t j = 1 + i; j < total; ++j) {
-      if (collision_check(i, j)) {
-        collision_resolve(i, j);
-      }
-    }
-  }
+  const auto start = get_time();
+
+  // The kernel wants x and y in separate arrays, so let the store keep a split copy
+  particles.set_split_xy(true);
+  if (use_multithreading)
+    dispatch.parallel_for_each(particles.position, [this](size_t begin, size_t end) { particles.split_positions(begin, end); });
+  else
+    particles.split_positions(0, particle_count);
+
+  nbody.compute(particles.x.data(), particles.y.data(), particles.mass.data(), particle_count, nbody_pull, use_multithreading);
+  for (size_t i = 0; i < particle_count; ++i)
+    particles.velocity[i] += nbody_pull[i];
+
+  const f64 time = get_time() - start;
+  nbody_interactions_per_second = (time > 0.0) ? nbody.interactions / time : 0.0;
 }
 
-void ParticleSystem::collision_quadtree(const vector<vector<s32>> &tree_container, size_t begin, size_t end) noexcept
+void ParticleSystem::apply_barnes_hut() noexcept
 {
-  for (size_t k = begin; k < end; ++k) {
-    for (size_t i = 0; i < tree_container[k].size(); ++i) {
-      for (size_t j = i + 1; j < tree_container[k].size(); ++j) {
-        if (collision_check(tree_container[k][i], tree_container[k][j])){
-          collision_resolve(tree_container[k][i], tree_container[k][j]);
-        }
-      }
+  barnes_hut.build(particles.position.data(), particles.mass.data(), particle_count);
+
+  // Walk the particles in tree order, so neighbouring particles open the same nodes.
+  const auto apply = [this](size_t begin, size_t end)
+  {
+    const f32 theta = barnes_hut_theta;
+    for (size_t k = begin; k < end; ++k)
+    {
+      const s32 i = barnes_hut.order[k];
+      particles.velocity[i] += barnes_hut.pull_on(i, theta);
     }
-  }
-}
+  };
 
+  if (use_multithreading)
+    dispatch.parallel_for(0, particle_count, apply);
+  else
+    apply(0, particle_count);
+}
 
-vector<s32> ParticleSystem::get_neighbours(const Particle& p) const noexcept
+vector<s32> ParticleSystem::get_neighbours(const vec2 &position, f32 radius) const noexcept
 {
   vector<vector<s32>> nodes;
 
   switch (tree_type)
   {
-    case TreeType::Quadtree: {quadtree.get_neighbours(nodes, p.pos, p.radius);} break;
-    case TreeType::UniformGrid: {uniformgrid.get_neighbours(nodes, p);} break;
+    case TreeType::Quadtree: {quadtree.get_neighbours(nodes, position, radius);} break;
+    case TreeType::UniformGrid: {uniformgrid.get_neighbours(nodes, position, radius);} break;
+    case TreeType::SweepAndPrune: [[fallthrough]];
     case TreeType::None: { /* Do Nothing */ } break;
   }
 
@@ -727,75 +1341,43 @@ vector<s32> ParticleSystem::get_neighbours(const Particle& p) const noexcept
 }
 
 
-// Returns a vector of ids of particles colliding with the input rectangle.
-vector<s32> get_particles_in_rect_basic(const vector<Particle> &particles,
-                                        const vec2 &min,
-                                        const vec2 &max) noexcept {
-  vector<s32> vector_of_ids;
+// Returns a vector of ids of particles colliding with the input circle.
+vector<s32> ParticleSystem::get_particles_in_circle(const vec2 &position, f32 radius) noexcept {
 
-  // @Performance: Check for available tree structure used and use that instead.
-  // Go through all the particles..
-  for (const auto &particle : particles) {
-    const auto o = particle.pos;
-
-    // If the particle is inside the rectangle, add it to the output vector.
-    if (o.x < max.x && o.x > min.x && o.y < max.y && o.y > min.y) {
-      vector_of_ids.emplace_back(particle.id);
-    }
-  }
+  vector<s32> ids;
 
-  return vector_of_ids;
-}
+  const auto overlaps = [this, &position, radius](s32 i) {
+    const f32 dx = particles.position[i].x - position.x;
+    const f32 dy = particles.position[i].y - position.y;
+    const f32 r = particles.radius[i] + radius;
+    return dx * dx + dy * dy < r * r;
+  };
 
-// Returns a vector of ids of particles colliding with the input rectangle.
-vector<s32> get_particles_in_rect(const vector<Particle> &particles,
-                                  const vec2 &min, const vec2 &max) noexcept {
+  // Using a tree
+  if ((tree_type == TreeType::Quadtree || tree_type == TreeType::UniformGrid) && circle_collision)
+  {
+    for (const auto i : get_neighbours(position, radius)) {
+      if (i < static_cast<s32>(particle_count) && overlaps(i)) {
+        ids.emplace_back(particles.id[i]);
+      }
+    }
 
-  // @Performance: Check for available tree structure used and use that instead.
-  vector<s32> ids;
-  // Go through all the particles..
-  for (const auto &particle : particles) {
-    const auto o = particle.pos;
-    const auto r = particle.radius;
-
-    // If the particle is inside the rectangle, add it to the output vector.
-    if (o.x - r < max.x && o.x + r > min.x && o.y - r < max.y &&
-        o.y + r > min.y) {
-      ids.emplace_back(particle.id);
+    // A particle can sit in more than one node
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+  } else {
+    // Brute-force
+    for (s32 i = 0; i < static_cast<s32>(particle_count); ++i) {
+      if (overlaps(i)) {
+        ids.emplace_back(particles.id[i]);
+      }
     }
   }
 
   return ids;
 }
 
-// Returns a vector of ids of particles colliding with the input rectangle.
-vector<s32> ParticleSystem::get_particles_in_circle(const Particle &p) noexcept {
-
-  vector<s32> ids;
-
- //  // Using a tree
- //  if (tree_type != TreeType::None && circle_collision)
- //  {
- //    vector<s32> potential_collisions;
- //    potential_collisions = get_neighbours(p);
-	// if (!potential_collisions.empty())
- //    for (const auto &i : potential_collisions) {
- //      if (collision_check(particles[i], p)) {
- //        ids.emplace_back(i);
- //      }
- //    }
- //  } else {
- //    // Brute-force
- //    for (const auto &i : particles) {
- //      if (collision_check(i, p)) {
- //        ids.emplace_back(i.id);
- //      }
- //    }
- //  }
-
-  return ids;
-}
-
+#ifndef ATHI_HEADLESS
 void ParticleSystem::opencl_init() noexcept {
   // Read in the kernel source
   read_file("../Resources/Kernels/particle_collision.cl", &kernel_source);
@@ -967,35 +1549,61 @@ void ParticleSystem::opencl_naive() noexcept {
   //     }
   // }
 }
+#endif
 
 void ParticleSystem::remove_all_with_id(const vector<s32> &ids) noexcept {
-  for (const auto id : ids)
+  if (ids.empty()) return;
+  command_queue.remove(ids.data(), static_cast<u32>(ids.size()));
+}
+
+// @CPU
+void ParticleSystem::remove_particles(const s32 *ids, u32 count) noexcept
+{
+  const u32 count_before = particle_count;
+  for (u32 k = 0; k < count; ++k)
   {
-    this->id.erase(this->id.begin() + id);
-    position.erase(position.begin() + id);
-    velocity.erase(velocity.begin() + id);
-    radius.erase(radius.begin() + id);
-    color.erase(color.begin() + id);
-    mass.erase(mass.begin() + id);
+    const s32 index = handles.index_of(ids[k]);
+    if (index >= 0) remove_at(static_cast<u32>(index));
   }
-  particle_count = position.size();
+  if (particle_count == count_before) return;
+
+  resize_arrays(particle_count);
 }
 
-void ParticleSystem::erase_all() noexcept {
-  buffered_call([this]()
+// Removes the particle at 'index' by moving the last one into its place.
+// The arrays keep their size until 'resize_arrays'.
+void ParticleSystem::remove_at(u32 index) noexcept
+{
+  const s32 removed = particles.id[index];
+  const u32 last = particle_count - 1;
+  if (index != last)
   {
-    if constexpr (multithreaded_engine)
-      std::unique_lock<std::mutex> lck(particles_mutex);
-
-    id.clear();
-    position.clear();
-    velocity.clear();
-    radius.clear();
-    color.clear();
-    mass.clear();
-
-    particle_count = 0;
-  });
+    particles.id[index] = particles.id[last];
+    particles.position[index] = particles.position[last];
+    particles.velocity[index] = particles.velocity[last];
+    particles.radius[index] = particles.radius[last];
+    particles.mass[index] = particles.mass[last];
+    particles.color[index] = particles.color[last];
+    particles.age[index] = particles.age[last];
+    particles.lifetime[index] = particles.lifetime[last];
+    handles.moved(particles.id[index], index);
+  }
+  sweep_and_prune.removed(static_cast<s32>(index), static_cast<s32>(last));
+  handles.destroy(removed);
+  --particle_count;
+}
+
+void ParticleSystem::resize_arrays(u32 count) noexcept
+{
+  particles.resize(count);
+
+  high_water = std::max(high_water, count);
+  particle_high_water = high_water;
+  particle_pool_capacity = static_cast<u32>(particles.capacity());
+}
+
+void ParticleSystem::erase_all() noexcept {
+  command_queue.erase_all();
 }
 
 void ParticleSystem::save_state() noexcept
@@ -1036,47 +1644,24 @@ void ParticleSystem::load_state() noexcept
   // });
 }
 
-void ParticleSystem::set_particles_color(vector<s32> ids, const vec4& color) noexcept
+void ParticleSystem::set_particles_color(const vector<s32> &ids, const vec4& color) noexcept
 {
-  // buffered_call([this, ids, color]()
-  // {
-  //   for (auto i: ids)
-  //   {
-  //     colors[i] = color;
-  //   }
-  // });
+  command_queue.recolor(ids.data(), static_cast<u32>(ids.size()), color);
 }
 
-static void gravity_well(Particle &a, const vec2 &point) {
-  // const f32 x1 = a.pos.x;
-  // const f32 y1 = a.pos.y;
-  // const f32 x2 = point.x;
-  // const f32 y2 = point.y;
-  // const f32 m1 = a.mass;
-  // const f32 m2 = 1e6f;
-
-  // const f32 dx = x2 - x1;
-  // const f32 dy = y2 - y1;
-  // const f32 d = sqrt(dx * dx + dy * dy);
-
-  // const f32 angle = atan2(dy, dx);
-  // const f64 G = kGravitationalConstant;
-  // const f32 F = G * m1 * m2 / d * d;
+void ParticleSystem::apply_impulse(const vector<s32> &ids, const vec2& impulse) noexcept
+{
+  command_queue.impulse(ids.data(), static_cast<u32>(ids.size()), impulse);
+}
 
-  // a.acc.x += F * cos(angle);
-  // a.acc.y += F * sin(angle);
+void ParticleSystem::drag_towards(const vector<s32> &ids, const vec2& point) noexcept
+{
+  if (ids.empty()) return;
+  command_queue.drag(ids.data(), static_cast<u32>(ids.size()), point);
 }
 
-void ParticleSystem::pull_towards_point(const vec2& point) noexcept
+void ParticleSystem::pull_towards_point(const vec2&) noexcept
 {
-    buffered_call([this, point]()
-    {
-      // dispatch.parallel_for_each(particles, [this, point](size_t begin, size_t end)
-      // {
-      //    for (size_t i = begin; i < end; ++i)
-      //     {
-      //       gravity_well(particles[i], point);
-      //     }
-      // });
-    });
+  // The gravity well was never ported off the old Particle struct, so the
+  // option does nothing for now.
 }
@@ -27,67 +27,128 @@
 // #include "athi_quadtree.h"  // Quadtree
 #include "athi_uniformgrid.h"  // UniformGrid
 
+#ifndef ATHI_HEADLESS
 #include "./Renderer/athi_renderer.h"  // Renderer
 #include "./Renderer/athi_texture.h"  // texture
-#include "athi_quadtree.h"  // texture
+#endif
+#include "athi_linear_quadtree.h"  // LinearQuadtree
+#include "athi_sweep_and_prune.h"  // SweepAndPrune
+#include "athi_barnes_hut.h"  // BarnesHut
+#include "athi_nbody.h"  // NBody
+#include "athi_snapshot.h"  // SnapshotBuffer
+#include "athi_command_queue.h"  // CommandQueue
+#include "athi_emitter.h"  // EmitterShape, EmitterParams
+#include "athi_handles.h"  // HandleTable
+#include "athi_particle_store.h"  // ParticleStore
+#include "athi_frame_stats.h"  // FrameStats
+#include "athi_stage_times.h"  // StageTimes
+#include "athi_parallel_sort.h"  // RadixHistograms
 
 #include <mutex>  // mutex
 #include <functional>
 
+#ifndef ATHI_HEADLESS
 #ifdef __APPLE__
 #include <OpenCL/OpenCL.h>
 #else
 #include <CL/cl.h>
 #endif
+#endif
 
+#include <array>  // std::array
 #include <vector>  // std::vector
 #include <glm/vec2.hpp>  // glm::vec2
 #include <glm/vec4.hpp>  // glm::vec4
 
-struct Particle
-{
-  s32        id          {0};
-  glm::vec2  pos         {0.0f, 0.0f};
-  glm::vec2  vel         {0.0f, 0.0f};
-  glm::vec2  acc         {0.0f, 0.0f};
-  f32        mass        {0.0f};
-  f32        radius      {0.0f};
-
-  void update(f32 dt) noexcept;
-};
-
 struct ParticleSystem
 {
   u32   particle_count    {0};
   f32   particle_density  {1.0f};
 
-  std::vector<Particle>  particles;
   std::vector<glm::vec2>  vertices;
   std::vector<u16>        indices;
 
-  // Particle Data
-  std::vector<s32>        id;
-  std::vector<glm::vec2>  position;
-  std::vector<glm::vec2>  velocity;
-  std::vector<f32>        radius;
-  std::vector<f32>        mass;
-  std::vector<glm::vec4>  color;
+  // Particle Data, see ParticleStore
+  ParticleStore           particles;
+
+  // Particles move around in the arrays when they are reordered or removed,
+  // so anything that holds on to a particle should keep its id.
+  HandleTable             handles;
 
   // Data information
   size_t particles_vertices_size{0};
 
+  // With the multithreaded engine, held by the physics thread for a whole
+  // step and by the render thread while it handles input.
   std::mutex              particles_mutex;
 
-  std::vector<std::vector<s32>> tree_container;
+  // What physics hands to the render thread, see publish_snapshot.
+  // 'drawn_count' is how many particles the GPU buffers hold.
+  SnapshotBuffer          snapshots;
+  u64                     published_frames{0};
+  u32                     drawn_count{0};
 
+  // Positions before the last step, and the ones drawn when blending between
+  // them and the current ones. 'render_alpha' is how far along to blend,
+  // set each frame by Athi_Core::start.
+  std::vector<glm::vec2>  previous_position;
+  std::vector<glm::vec2>  render_position;
+  f32                     render_alpha{1.0f};
+
+#ifndef ATHI_HEADLESS
   Renderer    renderer;
   Texture     tex;
+#endif
 
   Dispatch    pool;
 
-  Quadtree    quadtree;
-  UniformGrid<Particle>   uniformgrid;
-
+  LinearQuadtree          quadtree;
+  UniformGrid             uniformgrid;
+  SweepAndPrune           sweep_and_prune;
+  BarnesHut               barnes_hut;
+  NBody                   nbody;
+  vector<vec2>            nbody_pull;
+
+  // Candidate pairs from the broadphase, see find_pairs
+  std::vector<std::vector<u64>> pair_buckets;
+  std::vector<size_t>     bucket_bounds;  // Broadphase cells/leaves [bounds[c], bounds[c + 1]) go to bucket 'c'
+  std::vector<u64>        pairs;
+  std::vector<u64>        pairs_scratch;
+
+  // The same pairs split into conflict free batches, see color_pairs.
+  // Batch 'c' is batched_pairs[batch_start[c], batch_start[c + 1]) and the
+  // last batch holds the pairs that didn't get a color.
+  static constexpr u32    kPairColors = 64;
+  std::vector<u64>        pair_color_mask;
+  std::vector<u8>         pair_colors;
+  std::vector<u64>        batched_pairs;
+  std::array<u32, kPairColors + 2> batch_start;
+
+  // Coloring splits the particles into this many index ranges, see color_pairs
+  static constexpr u32    kColorRegions = 64;
+  std::array<u32, kColorRegions + 1> region_pair_start;
+  std::vector<std::vector<u32>> region_cross_pairs;
+  std::vector<std::array<u32, kPairColors + 1>> region_color_count;
+  GrainSize               collision_grain;
+
+  // Called every physics sample once 'pairs' and the batches are ready,
+  // before any contact is resolved. The checks in athi_benchmark.cpp
+  // compare them against testing every pair here.
+  std::function<void()>   on_contacts;
+
+  // Collision counters, summed into 'frame_stats' by end_frame
+  FrameStats              stats;
+
+  // Time spent in each stage this frame, copied to 'frame_times' by end_frame
+  StageTimes              stage_times;
+
+  s32                     frames_since_reorder{0};
+  std::vector<u64>        reorder_codes;
+  std::vector<u64>        reorder_scratch;
+  std::vector<u8>         reorder_bytes;  // One particle array at a time, see reorder
+  RadixHistograms         radix_histograms;  // For parallel_radix_sort_by_key, in reorder and find_pairs
+
+#ifndef ATHI_HEADLESS
   // OPENCL
   // ///////////////////////////////////////////////////////
   s32 err;  // error code returned from api calls
@@ -96,7 +157,6 @@ struct ParticleSystem
   size_t local;       // local domain size for our calculation
 
   static constexpr bool gpu{true};
-  std::vector<Particle> results;
 
   cl_device_id device_id;     // compute device id
   cl_context context;         // compute context
@@ -104,58 +164,90 @@ struct ParticleSystem
   cl_program program;         // compute program
   cl_kernel kernel;           // compute kernel
   //////////////////////////////////////////////////////////
+#endif
 
   void init() noexcept;
   void save_state() noexcept;
   void load_state() noexcept;
   void refresh_vertices() noexcept;
   void update(float dt) noexcept;
+  void reorder() noexcept;
+
+  // The stages of 'update', in order. Athi_Core runs them as a TaskGraph.
+  void begin_frame() noexcept;
+  void expire(float dt) noexcept;
+  void reorder_if_due() noexcept;
+  void simulate(float dt) noexcept;
+  void end_frame() noexcept;
+
+  // Every physics sample of 'simulate' builds the tree anew
+  void build_tree() noexcept;
+  void count_tree_leaves() noexcept;
+
   void rebuild_vertices(u32 num_vertices) noexcept;
+#ifndef ATHI_HEADLESS
   void draw() noexcept;
   void opencl_init() noexcept;
   void draw_debug_nodes() noexcept;
-  void update_data() noexcept;
   void gpu_buffer_update() noexcept;
+  void opencl_naive() noexcept;
+#endif
+  void update_data() noexcept;
+  void update_colors() noexcept;
+  void publish_snapshot() noexcept;
   void update_collisions() noexcept;
   void update_particles(int begin, int end, f32 dt) noexcept;
-  void opencl_naive() noexcept;
   void apply_n_body() noexcept;
+  void apply_barnes_hut() noexcept;
   void threaded_buffer_update(size_t begin, size_t end) noexcept;
   bool collision_check(int a, int b) const noexcept;
   void collision_resolve(int a, int b) noexcept;
-  void separate(int a, int b) noexcept;
-  void collision_logNxN(size_t total, size_t begin, size_t end) noexcept;
-  void collision_quadtree(const std::vector<std::vector<s32>> &cont, size_t begin,
-                          size_t end) noexcept;
+  void find_pairs() noexcept;
+  void find_all_contacts() noexcept;
+  void filter_pairs() noexcept;
+  void color_pairs() noexcept;
+  void collision_pairs(size_t begin, size_t end) noexcept;
   void add(const glm::vec2 &pos, f32 radius,
-           const glm::vec4 &color = glm::vec4(1, 1, 1, 1)) noexcept;
+           const glm::vec4 &color = glm::vec4(1, 1, 1, 1), u32 count = 1, f32 lifetime = 0.0f) noexcept;
 
+  // Adds 'count' particles laid out by 'shape' in one go, see EmitterParams.
+  // Takes effect at the start of the next frame, like 'add'.
+  void add_bulk(u32 count, EmitterShape shape, const EmitterParams &params) noexcept;
+  void spawn_bulk(u32 count, EmitterShape shape, const EmitterParams &params) noexcept;
+
+  // Removes the particles with these ids at the start of the next frame.
+  // Ids that are already gone are skipped.
   void remove_all_with_id(const std::vector<s32> &ids) noexcept;
+  void remove_particles(const s32 *ids, u32 count) noexcept;
+  void remove_at(u32 index) noexcept;
+  void resize_arrays(u32 count) noexcept;
+
+  // Largest particle_count so far. The arrays never give memory back, so
+  // spawns after removals reuse it and steady state doesn't allocate.
+  u32 high_water{0};
   void erase_all() noexcept;
 
-  void gravitational_force(int a, int b) noexcept;
   void pull_towards_point(const glm::vec2& point) noexcept;
 
-  std::mutex buffered_call_mutex;
-  std::vector<std::function<void()>> buffered_call_buffer;
-  void buffered_call(std::function<void()>&& f) noexcept;
+  // Changes from other threads, run at the start of the next frame
+  CommandQueue command_queue;
+  template <class F>
+  void buffered_call(F&& f) noexcept { command_queue.call(std::forward<F>(f)); }
   void execute_buffered_calls() noexcept;
+  void spawn(const Command &first, u32 total) noexcept;
 
-  void set_particles_color(std::vector<s32> ids, const glm::vec4& color) noexcept;
+  void set_particles_color(const std::vector<s32> &ids, const glm::vec4& color) noexcept;
+  void apply_impulse(const std::vector<s32> &ids, const glm::vec2& impulse) noexcept;
 
-  std::vector<s32> get_neighbours(const Particle& p) const noexcept;
+  // Adds the distance to 'point' to the velocity of every particle in 'ids',
+  // then damps it, so they follow the mouse.
+  void drag_towards(const std::vector<s32> &ids, const glm::vec2& point) noexcept;
 
-  // Returns a std::vector of ids of particles colliding with the input particle.
-  std::vector<s32> get_particles_in_circle(const Particle &p) noexcept;
-};
+  // Returns the indices of the particles in the tree nodes the circle touches.
+  std::vector<s32> get_neighbours(const glm::vec2 &position, f32 radius) const noexcept;
 
-// Returns a std::vector of ids of particles colliding with the input rectangle.
-std::vector<s32> get_particles_in_rect_basic(const std::vector<Particle> &particles,
-                                        const glm::vec2 &min,
-                                        const glm::vec2 &max) noexcept;
-
-// Returns a std::vector of ids of particles colliding with the input rectangle.
-std::vector<s32> get_particles_in_rect(const std::vector<Particle> &particles,
-                                  const glm::vec2 &min, const glm::vec2 &max) noexcept;
+  // Returns a std::vector of ids of particles colliding with the input circle.
+  std::vector<s32> get_particles_in_circle(const glm::vec2 &position, f32 radius) noexcept;
+};
 
 extern ParticleSystem particle_system;
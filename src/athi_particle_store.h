@@ -0,0 +1,170 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "Utility/athi_span.h" // Span
+
+#include <cstring> // memcpy
+#include <new> // operator new, align_val_t
+#include <type_traits> // is_trivially_copyable
+
+// Every particle field in one block of memory.
+//
+// Each field starts on its own 64 byte boundary, so a field never shares a
+// cacheline with the one before it and aligned SIMD loads are safe from the
+// start of every array. All fields share one capacity, so growing is a
+// single allocation and a copy per field.
+//
+// With the split layout on, the store also holds the positions as separate
+// x and y arrays for kernels that want to load several x's at once. Those
+// are a copy, filled by 'split_positions', so the vec2 'position' array
+// stays the one everything else reads and writes.
+class ParticleStore
+{
+public:
+  static constexpr size_t kAlignment = 64;
+
+  // Views into the block. They go stale when the store grows, so read them
+  // again after a 'resize' instead of holding on to the pointers.
+  Span<s32>   id;        // Handle of each particle, see HandleTable
+  Span<vec2>  position;
+  Span<vec2>  velocity;
+  Span<f32>   radius;
+  Span<f32>   mass;
+  Span<vec4>  color;
+  Span<f32>   age;       // Seconds since it was added
+  Span<f32>   lifetime;  // Removed once 'age' reaches it, 0 lives forever
+
+  // Only there with the split layout on
+  Span<f32>   x;
+  Span<f32>   y;
+
+  ParticleStore() noexcept = default;
+  ~ParticleStore() noexcept { operator delete(block, std::align_val_t{kAlignment}); }
+
+  ParticleStore(const ParticleStore &) = delete;
+  ParticleStore &operator=(const ParticleStore &) = delete;
+
+  size_t size() const noexcept { return count; }
+  size_t capacity() const noexcept { return cap; }
+  size_t size_in_bytes() const noexcept { return block_size; }
+  bool split_xy() const noexcept { return split; }
+
+  // New particles are left uninitialized, the caller fills them in.
+  // Never gives memory back, so shrinking and growing again is free.
+  void resize(size_t new_count) noexcept
+  {
+    if (new_count > cap)
+    {
+      size_t new_cap = (cap < 64) ? 64 : cap;
+      while (new_cap < new_count) new_cap *= 2;
+      reallocate(new_cap);
+    }
+    count = new_count;
+    for_each_field([this](auto &field) { field = make_span(field.data(), count); });
+  }
+
+  void reserve(size_t new_cap) noexcept
+  {
+    if (new_cap > cap) reallocate(new_cap);
+  }
+
+  // Turns the x and y arrays on or off. Turning them on leaves them
+  // uninitialized, call 'split_positions' before reading them.
+  void set_split_xy(bool enabled) noexcept
+  {
+    if (enabled == split) return;
+    split = enabled;
+    x = Span<f32>();
+    y = Span<f32>();
+    if (cap > 0) reallocate(cap);
+  }
+
+  // Copies position[i] into x[i] and y[i] for every i in [begin, end).
+  void split_positions(size_t begin, size_t end) noexcept
+  {
+    for (size_t i = begin; i < end; ++i)
+    {
+      x[i] = position[i].x;
+      y[i] = position[i].y;
+    }
+  }
+
+private:
+  u8      *block{nullptr};
+  size_t  block_size{0};
+  size_t  count{0};
+  size_t  cap{0};
+  bool    split{false};
+
+  template <class T>
+  static Span<T> make_span(T *data, size_t size) noexcept { return Span<T>(data, size); }
+
+  static size_t align_up(size_t bytes) noexcept
+  {
+    return (bytes + kAlignment - 1) & ~(kAlignment - 1);
+  }
+
+  template <class F>
+  void for_each_field(F &&f) noexcept
+  {
+    f(id);
+    f(position);
+    f(velocity);
+    f(radius);
+    f(mass);
+    f(color);
+    f(age);
+    f(lifetime);
+    if (split)
+    {
+      f(x);
+      f(y);
+    }
+  }
+
+  void reallocate(size_t new_cap) noexcept
+  {
+    size_t total = 0;
+    for_each_field([&total, new_cap](auto &field) {
+      total += align_up(new_cap * sizeof(field[0]));
+    });
+
+    u8 *new_block = static_cast<u8 *>(operator new(total, std::align_val_t{kAlignment}));
+
+    // Fields that were just turned on have nothing to copy.
+    size_t offset = 0;
+    for_each_field([this, new_block, new_cap, &offset](auto &field) {
+      using T = std::remove_reference_t<decltype(field[0])>;
+      static_assert(std::is_trivially_copyable_v<T>, "fields are moved with memcpy");
+      T *data = reinterpret_cast<T *>(new_block + offset);
+      if (!field.empty()) std::memcpy(data, field.data(), field.size_in_bytes());
+      field = make_span(data, count);
+      offset += align_up(new_cap * sizeof(T));
+    });
+
+    operator delete(block, std::align_val_t{kAlignment});
+    block = new_block;
+    block_size = total;
+    cap = new_cap;
+  }
+};
@@ -0,0 +1,192 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#include "athi_profiler.h"
+
+#include "Utility/console.h" // console
+
+#include <algorithm> // std::max
+#include <array> // std::array
+#include <cstdio> // fopen, fprintf, snprintf
+#include <memory> // std::unique_ptr
+#include <mutex> // std::mutex
+
+std::atomic<bool> profiler_recording{false};
+
+// Zones of one thread. Only that thread writes, the capture reads up to 'head'.
+struct ThreadTrace
+{
+  static constexpr u64 kCapacity = 1 << 15;
+  static constexpr u64 kMask = kCapacity - 1;
+
+  struct Event
+  {
+    const char *name;
+    u64 begin;
+    u64 end;
+  };
+
+  std::array<Event, kCapacity> events;
+  std::atomic<u64> head {0};  // Events ever recorded. The newest kCapacity are kept.
+  u32 id {0};
+  char name[32] {};
+};
+
+// Threads that ever recorded a zone. Their traces are kept after they exit,
+// so the rows of finished threads still show up in the next capture.
+static constexpr u32 kMaxThreads = 128;
+static std::array<std::atomic<ThreadTrace *>, kMaxThreads> traces{};
+static std::atomic<u32> trace_count{0};
+
+static thread_local ThreadTrace *tls_trace{nullptr};
+static thread_local char tls_name[32]{};
+
+// Frame ends of the running capture, written by profiler_frame only
+static std::array<u64, 4096> frame_ends;
+static u32 frame_count{0};
+
+static std::mutex capture_mutex;
+static string capture_path;
+static u64 capture_begin{0};
+static u32 capture_frames{0};
+
+// Makes the calling thread's trace the first time it records something.
+static ThreadTrace *this_thread_trace() noexcept
+{
+  if (tls_trace) return tls_trace;
+
+  const u32 index = trace_count.fetch_add(1, std::memory_order_relaxed);
+  if (index >= kMaxThreads) return nullptr;
+
+  auto trace = std::make_unique<ThreadTrace>();
+  trace->id = index;
+  if (tls_name[0]) std::snprintf(trace->name, sizeof(trace->name), "%s", tls_name);
+  else std::snprintf(trace->name, sizeof(trace->name), "thread %u", index);
+
+  tls_trace = trace.release();
+  traces[index].store(tls_trace, std::memory_order_release);
+  return tls_trace;
+}
+
+void profiler_record(const char *name, u64 begin, u64 end) noexcept
+{
+  ThreadTrace *trace = this_thread_trace();
+  if (!trace) return;
+
+  const u64 head = trace->head.load(std::memory_order_relaxed);
+  trace->events[head & ThreadTrace::kMask] = {name, begin, end};
+  trace->head.store(head + 1, std::memory_order_release);
+}
+
+void profiler_set_thread_name(const char *name) noexcept
+{
+  std::snprintf(tls_name, sizeof(tls_name), "%s", name);
+  if (tls_trace) std::snprintf(tls_trace->name, sizeof(tls_trace->name), "%s", name);
+}
+
+// Chrome wants microseconds
+static f64 to_us(u64 ns, u64 origin) noexcept
+{
+  return static_cast<f64>(ns - origin) * 1e-3;
+}
+
+static bool write_trace(const string &path, u64 begin) noexcept
+{
+  FILE *file = std::fopen(path.c_str(), "w");
+  if (!file)
+  {
+    console->error("[Profiler] couldn't open {}", path);
+    return false;
+  }
+
+  std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  std::fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,\"args\":{\"name\":\"Athi\"}}");
+
+  size_t written = 0;
+  const u32 count = std::min(trace_count.load(std::memory_order_acquire), kMaxThreads);
+  for (u32 t = 0; t < count; ++t)
+  {
+    const ThreadTrace *trace = traces[t].load(std::memory_order_acquire);
+    if (!trace) continue;
+
+    std::fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%u,\"args\":{\"name\":\"%s\"}}", trace->id, trace->name);
+
+    // A thread may still be recording. It writes the slot after 'head', which
+    // once the buffer has wrapped is the oldest one, so stay clear of the end.
+    constexpr u64 kSlack = 256;
+    const u64 head = trace->head.load(std::memory_order_acquire);
+    const u64 first = (head > ThreadTrace::kCapacity - kSlack) ? head - (ThreadTrace::kCapacity - kSlack) : 0;
+    for (u64 e = first; e < head; ++e)
+    {
+      const auto &event = trace->events[e & ThreadTrace::kMask];
+      if (event.end < begin) continue;
+
+      // Zones that began before the capture are cut off at its start
+      const u64 event_begin = std::max(event.begin, begin);
+      std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        event.name, trace->id, to_us(event_begin, begin), to_us(event.end, event_begin));
+      ++written;
+    }
+  }
+
+  // Frame ends as lines across every thread
+  for (u32 f = 0; f < frame_count; ++f)
+    std::fprintf(file, ",\n{\"name\":\"frame\",\"ph\":\"i\",\"s\":\"g\",\"pid\":0,\"tid\":0,\"ts\":%.3f}", to_us(frame_ends[f], begin));
+
+  std::fprintf(file, "\n]}\n");
+  std::fclose(file);
+
+  console->info("[Profiler] wrote {} zones over {} frames to {}", written, frame_count, path);
+  return true;
+}
+
+void profiler_capture(u32 frames, const string &path) noexcept
+{
+  if constexpr (!use_profiler)
+  {
+    console->warn("[Profiler] use_profiler is off");
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(capture_mutex);
+  if (profiler_recording.load() || frames == 0) return;
+
+  capture_path = path;
+  capture_frames = std::min(frames, static_cast<u32>(frame_ends.size()));
+  frame_count = 0;
+  capture_begin = profiler_now();
+  profiler_recording.store(true);
+
+  console->info("[Profiler] capturing {} frames", capture_frames);
+}
+
+void profiler_frame() noexcept
+{
+  if (!profiler_recording.load(std::memory_order_relaxed)) return;
+
+  std::unique_lock<std::mutex> lock(capture_mutex);
+  frame_ends[frame_count++] = profiler_now();
+  if (frame_count < capture_frames) return;
+
+  // Zones still running on other threads finish after this and are left out.
+  profiler_recording.store(false);
+  write_trace(capture_path, capture_begin);
+}
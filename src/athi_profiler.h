@@ -0,0 +1,102 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "Utility/athi_constant_globals.h" // use_profiler
+
+#include <atomic> // std::atomic
+#include <chrono> // steady_clock
+
+// Scoped profiling zones, written out as a Chrome trace.
+//
+//   {
+//     ATHI_PROFILE("tree_build");
+//     ...
+//   }
+//
+// A zone records when it began and ended into a ring buffer owned by the
+// thread it ran on, so recording takes no locks and threads never share a
+// cache line. Zones nest just by running inside each other. Nothing is
+// recorded unless a capture is running, see profiler_capture, and then the
+// cost is two clock reads and a store. Set 'use_profiler' to false and
+// zones compile to nothing.
+//
+// Open the written file in chrome://tracing or https://ui.perfetto.dev.
+
+extern std::atomic<bool> profiler_recording;
+
+// Nanoseconds on the steady clock
+inline u64 profiler_now() noexcept
+{
+  return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// Adds a finished zone to the calling thread's buffer. 'name' must outlive
+// the capture, string literals and TaskGraph node names do.
+void profiler_record(const char *name, u64 begin, u64 end) noexcept;
+
+// Name of the calling thread's row in the trace. Copied, so any string will do.
+void profiler_set_thread_name(const char *name) noexcept;
+
+// Starts recording. After 'frames' calls to profiler_frame the trace is
+// written to 'path' and recording stops. Does nothing if a capture is running.
+void profiler_capture(u32 frames, const string &path) noexcept;
+
+// Marks the end of a frame. Call it once per frame from one thread.
+void profiler_frame() noexcept;
+
+class ProfileZone
+{
+public:
+  explicit ProfileZone(const char *name) noexcept
+  {
+    if constexpr (use_profiler)
+    {
+      if (profiler_recording.load(std::memory_order_relaxed))
+      {
+        this->name = name;
+        begin = profiler_now();
+      }
+    }
+  }
+
+  ~ProfileZone() noexcept
+  {
+    if constexpr (use_profiler)
+    {
+      if (name) profiler_record(name, begin, profiler_now());
+    }
+  }
+
+  ProfileZone(const ProfileZone &) = delete;
+  ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+  const char *name {nullptr};  // Null if the zone began outside a capture
+  u64 begin {0};
+};
+
+#define ATHI_PROFILE_CONCAT_(a, b) a##b
+#define ATHI_PROFILE_CONCAT(a, b) ATHI_PROFILE_CONCAT_(a, b)
+#define ATHI_PROFILE(name) ProfileZone ATHI_PROFILE_CONCAT(profile_zone_, __LINE__)(name)
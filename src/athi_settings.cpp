@@ -21,7 +21,9 @@
 
 #include "athi_settings.h"
 
+#ifndef ATHI_HEADLESS
 std::vector<FrameBuffer> framebuffers;
+#endif
 f64 frame_budget{1.0 / 60.0};
 
 // --------------
@@ -55,6 +57,7 @@ s32 num_vertices_per_particle = 36;
 bool is_particles_colored_by_acc = false;
 bool has_random_velocity = true;
 f32 random_velocity_force = 5.0f;
+f32 particle_lifetime = 0.0f;
 f32 color_by_velocity_threshold = 0.003f;
 
 float gButtonWidth{200.f};
@@ -75,6 +78,11 @@ f32 px_scale{1.0f};
 
 bool show_settings{true};
 bool use_gravitational_force{false};
+
+// Barnes-Hut approximates far away groups of particles as one body. Higher
+// theta is faster and less accurate, 0 is exact.
+bool use_barnes_hut{true};
+f32 barnes_hut_theta{0.5f};
 f32 gravity{9.81f};
 f32 gravitational_constant{6.674e-11f};
 f32 air_resistance{0.9f};
@@ -86,6 +94,15 @@ bool border_collision{true};
 bool multithreaded_particle_update{true};
 s32 physics_samples{8};
 
+// Physics runs in fixed steps of 1/physics_tick_rate seconds, and at most
+// 'max_substeps' of them per frame, see FixedStep.
+s32 physics_tick_rate{60};
+s32 max_substeps{8};
+
+// Draw the particles between the last two physics steps instead of at the
+// last one, so they move smoothly when the tick rate isn't the framerate.
+bool interpolate_positions{true};
+
 f32 circle_size{5.0f};
 vec4 circle_color{1.0f, 1.0f, 1.0f, 1.0f};
 
@@ -95,8 +112,11 @@ bool quadtree_active{true};
 s32 quadtree_depth{10};
 s32 quadtree_capacity{100};
 
+// Frames between sorting the particle data by position. 0 turns it off.
+s32 reorder_interval{60};
+
 bool use_uniformgrid{false};
-s32 uniformgrid_parts{256};
+bool use_sweep_and_prune{false};
 
 f32 time_scale{1.0f};
 bool vsync{true};
@@ -125,6 +145,7 @@ s32 framerate{0};
 s32 framerate_limit{0};
 
 f64 render_frametime{0.0};
+f64 gpu_upload_frametime{0.0};
 f64 smoothed_render_frametime{0.0};
 s32 render_framerate{0};
 s32 render_framerate_limit{0};
@@ -133,11 +154,18 @@ f64 timestep{0.0};
 f64 physics_frametime{0.0};
 f64 smoothed_physics_frametime{0.0};
 s32 physics_framerate{0};
-s32 physics_FPS_limit{0};
+
+f64 reorder_time{0.0};
+f64 nbody_interactions_per_second{0.0};
+u32 expired_particles{0};
+u32 particle_high_water{0};
+u32 particle_pool_capacity{0};
+bool dump_critical_path{false};
+string frame_critical_path;
 
 u16 monitor_refreshrate{60};
 
-bool app_is_running{true};
+std::atomic<bool> app_is_running{true};
 bool settings_changed{false};
 
 s32 cpu_cores{0};
@@ -146,8 +174,9 @@ string cpu_brand;
 s32 variable_thread_count;
 std::atomic<s32> universal_color_picker{0};
 
-std::atomic<u64> comparisons{0};
-std::atomic<u64> resolutions{0};
+StatTotals frame_stats;
+StageTimes frame_times;
+FrameHistory frame_history;
 
 s32 mouse_radio_options = static_cast<s32>(MouseOption::Drag);
 s32 tree_radio_option = 0;
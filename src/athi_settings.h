@@ -24,13 +24,18 @@
 #include "athi_typedefs.h"
 
 #include "./Utility/athi_constant_globals.h"
+#include "athi_frame_stats.h" // StatTotals
+#include "athi_stage_times.h" // StageTimes
+#include "athi_frame_history.h" // FrameHistory
+#ifndef ATHI_HEADLESS
 #include "./Renderer/athi_framebuffer.h"
 #include "imgui.h"
+#endif
 #include <atomic>
 
 extern string particle_texture;
 
-enum class TreeType { Quadtree, UniformGrid, None };
+enum class TreeType { Quadtree, UniformGrid, SweepAndPrune, None };
 extern TreeType tree_type;
 
 enum class MouseOption { Color, GravityWell, Drag, Delete, None };
@@ -50,6 +55,7 @@ extern s32 num_vertices_per_particle;
 extern bool is_particles_colored_by_acc;
 extern bool has_random_velocity;
 extern f32 random_velocity_force;
+extern f32 particle_lifetime;
 extern f32 color_by_velocity_threshold;
 
 extern bool post_processing;
@@ -71,6 +77,14 @@ extern f32 px_scale;
 
 extern bool show_settings;
 extern bool use_gravitational_force;
+extern bool use_barnes_hut;
+extern f32 barnes_hut_theta;
+extern f64 nbody_interactions_per_second;
+extern u32 expired_particles;
+extern u32 particle_high_water;
+extern u32 particle_pool_capacity;
+extern bool dump_critical_path;
+extern string frame_critical_path;
 extern f32 gravity;
 extern f32 gravitational_constant;
 extern f32 air_resistance;
@@ -80,13 +94,17 @@ extern bool border_collision;
 
 extern bool multithreaded_particle_update;
 extern s32 physics_samples;
+extern s32 physics_tick_rate;
+extern s32 max_substeps;
+extern bool interpolate_positions;
 extern s32 post_processing_samples;
 extern s32 blur_strength;
 
 extern f32 circle_size;
 extern vec4 circle_color;
-extern std::atomic<u64> comparisons;
-extern std::atomic<u64> resolutions;
+extern StatTotals frame_stats;  // Collision counters of the last frame, see FrameStats
+extern StageTimes frame_times;  // Stage timings of the last frame, see ParticleSystem::stage_times
+extern FrameHistory frame_history;  // Stage timings of the last few thousand frames, for the performance window
 
 extern bool draw_debug;
 
@@ -99,7 +117,7 @@ extern bool draw_nodes;
 extern bool show_fps_info;
 
 extern bool use_uniformgrid;
-extern s32 uniformgrid_parts;
+extern bool use_sweep_and_prune;
 
 extern bool tree_optimized_size;
 extern bool quadtree_show_only_occupied;
@@ -107,13 +125,16 @@ extern bool quadtree_active;
 extern s32 quadtree_depth;
 extern s32 quadtree_capacity;
 
+extern s32 reorder_interval;
+extern f64 reorder_time;
+
 extern f64 timestep;
 extern f64 physics_frametime;
 extern f64 smoothed_physics_frametime;
 extern s32 physics_framerate;
-extern s32 physics_FPS_limit;
 
 extern f64 render_frametime;
+extern f64 gpu_upload_frametime;
 extern f64 smoothed_render_frametime;
 extern s32 render_framerate;
 extern s32 render_framerate_limit;
@@ -139,7 +160,7 @@ extern string cpu_brand;
 
 extern bool openCL_active;
 
-extern bool app_is_running;
+extern std::atomic<bool> app_is_running;
 extern bool settings_changed;
 
 extern std::atomic<s32> universal_color_picker;
@@ -0,0 +1,80 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <array> // std::array
+#include <atomic> // std::atomic
+#include <glm/vec2.hpp> // glm::vec2
+#include <glm/vec4.hpp> // glm::vec4
+
+// What the renderer needs of one simulated frame.
+struct ParticleSnapshot
+{
+  u32                     particle_count {0};
+  u64                     frame {0};
+  vector<glm::vec2>       position;
+  vector<glm::vec2>       previous_position;  // Before the step, see ParticleSystem::previous_position
+  f64                     published_at {0.0};  // get_time() when published
+  f64                     step {1.0 / 60.0};  // Seconds the step simulated
+  vector<glm::vec4>       color;
+  vector<f32>             radius;
+};
+
+// Triple buffer handing snapshots from the physics thread to the render thread.
+//
+// One slot is being written, one is being read and the third holds the
+// newest finished frame. Publishing and acquiring swap a slot with that third
+// one in a single atomic exchange, so neither side ever waits for the other.
+// The renderer always gets the latest complete frame, and frames physics
+// produces faster than they're drawn are simply skipped.
+class SnapshotBuffer
+{
+public:
+  // Physics only. The slot to fill in before 'publish'.
+  ParticleSnapshot &write_slot() noexcept { return slots[writing]; }
+
+  // Physics only. Makes the written slot the newest frame.
+  void publish() noexcept
+  {
+    writing = ready.exchange(writing | kFresh, std::memory_order_acq_rel) & kIndexMask;
+  }
+
+  // Render only. The newest published frame, or the same one as last time
+  // if nothing new came in. Stays untouched until the next call.
+  ParticleSnapshot &acquire() noexcept
+  {
+    if (ready.load(std::memory_order_relaxed) & kFresh)
+      reading = ready.exchange(reading, std::memory_order_acq_rel) & kIndexMask;
+    return slots[reading];
+  }
+
+private:
+  static constexpr u32 kFresh = 4;  // Set on 'ready' when it holds a frame the renderer hasn't seen
+  static constexpr u32 kIndexMask = 3;
+
+  std::array<ParticleSnapshot, 3> slots;
+  u32 writing {0};
+  u32 reading {1};
+  std::atomic<u32> ready {2};
+};
@@ -0,0 +1,84 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#pragma once
+
+#include "athi_typedefs.h"
+#include "athi_profiler.h" // ProfileZone
+
+#include <array> // std::array
+#include <chrono> // steady_clock
+
+// The parts of a physics frame that get timed, in the order they run.
+enum class Stage : u32
+{
+  Reorder,      // Sorting the particle data by morton code
+  TreeBuild,    // Quadtree or grid
+  Integrate,    // Gravity and moving the particles
+  Broadphase,   // Finding candidate pairs
+  Narrowphase,  // Testing them
+  Color,        // Batching the contacts, see ParticleSystem::color_pairs
+  Resolve,      // Pushing overlapping particles apart
+  NBody,        // Gravity between particles
+  Count
+};
+
+static constexpr u32 kStageCount = static_cast<u32>(Stage::Count);
+
+inline const char *stage_name(Stage stage) noexcept
+{
+  constexpr const char *names[kStageCount] = {
+    "reorder", "tree_build", "integrate", "broadphase", "narrowphase", "color", "resolve", "n_body"
+  };
+  return names[static_cast<u32>(stage)];
+}
+
+// Seconds spent in each stage over one frame. Stages that run once per
+// physics sample add up over all samples.
+struct StageTimes
+{
+  std::array<f64, kStageCount> seconds{};
+  f64 operator[](Stage stage) const noexcept { return seconds[static_cast<u32>(stage)]; }
+  void reset() noexcept { seconds.fill(0.0); }
+};
+
+// Adds the time until the end of the scope to one stage. A stage is only
+// ever timed from the thread running it, so there's nothing to synchronize.
+// Also a profiler zone named after the stage.
+class ScopedStageTimer
+{
+public:
+  ScopedStageTimer(StageTimes &times, Stage stage) noexcept
+    : zone(stage_name(stage)), seconds(times.seconds[static_cast<u32>(stage)]), start(std::chrono::steady_clock::now()) {}
+
+  ~ScopedStageTimer() noexcept
+  {
+    seconds += std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  ScopedStageTimer(const ScopedStageTimer &) = delete;
+  ScopedStageTimer &operator=(const ScopedStageTimer &) = delete;
+
+private:
+  ProfileZone zone;
+  f64 &seconds;
+  std::chrono::steady_clock::time_point start;
+};
@@ -0,0 +1,235 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+#pragma once
+
+#include "athi_typedefs.h"
+
+#include <algorithm> // std::sort, std::merge
+#include <numeric> // std::iota
+
+// Sweep and prune along the x-axis.
+//
+// The particles are kept sorted by the left edge of their bounding box.
+// Unlike the trees the order survives between frames, and since particles
+// barely move from one frame to the next an insertion sort puts it back in
+// order in close to linear time.
+//
+// Added and removed particles are patched into the order instead of
+// sorting it all over again: removals are dropped in place, see 'removed',
+// and new particles are sorted on their own and merged in by 'update'.
+class SweepAndPrune
+{
+public:
+
+  vector<s32> order;  // Particle indices sorted by 'min_x'
+  vector<f32> min_x;  // Left edge of each particle in 'order'
+
+  void set_data(const vec2 *position, const f32 *radius) noexcept
+  {
+    this->position = position;
+    this->radius = radius;
+  }
+
+  // Forces a full sort on the next update.
+  void invalidate() noexcept
+  {
+    order.clear();
+    min_x.clear();
+    slot.clear();
+  }
+
+  // Particle 'index' was removed by moving particle 'last' into its place,
+  // see ParticleSystem::remove_at.
+  void removed(s32 index, s32 last) noexcept
+  {
+    if (order.empty()) return;
+
+    // Where each particle sits in 'order'. Built on the first removal after
+    // an update, since the insertion sort moves everything around.
+    if (slot.empty())
+    {
+      s32 highest = last;
+      for (const auto i : order) highest = std::max(highest, i);
+      slot.assign(highest + 1, -1);
+      for (size_t k = 0; k < order.size(); ++k)
+        if (order[k] >= 0) slot[order[k]] = static_cast<s32>(k);
+    }
+    if (slot.size() <= static_cast<size_t>(last)) slot.resize(last + 1, -1);
+
+    // Particles added since the last update aren't in 'order' yet, so they have no slot.
+    if (slot[index] >= 0) order[slot[index]] = -1;
+    slot[index] = -1;
+    if (index != last)
+    {
+      const s32 moved = slot[last];
+      if (moved >= 0) order[moved] = index;
+      slot[index] = moved;
+      slot[last] = -1;
+    }
+  }
+
+  // The particles were sorted into a new order, where the one at 'i' used to
+  // be at the lower 32 bits of 'codes[i]', see ParticleSystem::reorder.
+  // Their positions didn't change, so neither does the sweep order.
+  void renumber(const vector<u64> &codes) noexcept
+  {
+    if (order.empty()) return;
+    compact();
+
+    new_index.resize(codes.size());
+    for (size_t i = 0; i < codes.size(); ++i)
+      new_index[static_cast<u32>(codes[i])] = static_cast<s32>(i);
+
+    for (auto &index : order)
+    {
+      if (static_cast<size_t>(index) >= codes.size())
+      {
+        invalidate();
+        return;
+      }
+      index = new_index[index];
+    }
+  }
+
+  void update(s32 count) noexcept
+  {
+    compact();
+
+    // Anything that got past 'removed', like erasing everything
+    if (order.size() > static_cast<size_t>(count)) invalidate();
+
+    if (order.empty())
+    {
+      order.resize(count);
+      min_x.resize(count);
+      std::iota(order.begin(), order.end(), 0);
+      sort_by_min_x(order);
+      for (s32 k = 0; k < count; ++k)
+        min_x[k] = position[order[k]].x - radius[order[k]];
+      return;
+    }
+
+    min_x.resize(order.size());
+    for (size_t k = 0; k < order.size(); ++k)
+      min_x[k] = position[order[k]].x - radius[order[k]];
+
+    // Insertion sort
+    for (size_t k = 1; k < order.size(); ++k)
+    {
+      const f32 key = min_x[k];
+      const s32 index = order[k];
+      size_t j = k;
+      while (j > 0 && min_x[j - 1] > key)
+      {
+        min_x[j] = min_x[j - 1];
+        order[j] = order[j - 1];
+        --j;
+      }
+      min_x[j] = key;
+      order[j] = index;
+    }
+
+    if (order.size() != static_cast<size_t>(count)) merge_new(count);
+  }
+
+  // Calls 'f(a, b)' for every pair whose bounding boxes overlap, where 'a'
+  // is one of order[begin, end). Returns the number of pairs that
+  // overlapped on the x-axis.
+  template <class F>
+  size_t for_each_pair(size_t begin, size_t end, F &&f) const noexcept
+  {
+    size_t candidates = 0;
+    for (size_t k = begin; k < end; ++k)
+    {
+      const s32 a = order[k];
+      const f32 max_x = position[a].x + radius[a];
+      const f32 min_y = position[a].y - radius[a];
+      const f32 max_y = position[a].y + radius[a];
+
+      for (size_t m = k + 1; m < order.size() && min_x[m] < max_x; ++m)
+      {
+        ++candidates;
+        const s32 b = order[m];
+        if (position[b].y - radius[b] < max_y && position[b].y + radius[b] > min_y)
+          f(a, b);
+      }
+    }
+    return candidates;
+  }
+
+private:
+
+  // Drops the particles 'removed' left behind.
+  void compact() noexcept
+  {
+    if (slot.empty()) return;
+    order.erase(std::remove(order.begin(), order.end(), -1), order.end());
+    slot.clear();
+  }
+
+  void sort_by_min_x(vector<s32> &indices) const noexcept
+  {
+    std::sort(indices.begin(), indices.end(), [this](s32 a, s32 b) {
+      return position[a].x - radius[a] < position[b].x - radius[b];
+    });
+  }
+
+  // Sorts the particles below 'count' that aren't in 'order' and merges them in.
+  void merge_new(s32 count) noexcept
+  {
+    seen.assign(count, 0);
+    for (const auto index : order)
+    {
+      if (index >= count)
+      {
+        invalidate();
+        update(count);
+        return;
+      }
+      seen[index] = 1;
+    }
+
+    added.clear();
+    for (s32 i = 0; i < count; ++i)
+      if (!seen[i]) added.emplace_back(i);
+    sort_by_min_x(added);
+
+    merged.resize(order.size() + added.size());
+    std::merge(order.begin(), order.end(), added.begin(), added.end(), merged.begin(), [this](s32 a, s32 b) {
+      return position[a].x - radius[a] < position[b].x - radius[b];
+    });
+    order.swap(merged);
+
+    min_x.resize(order.size());
+    for (size_t k = 0; k < order.size(); ++k)
+      min_x[k] = position[order[k]].x - radius[order[k]];
+  }
+
+  const vec2  *position {nullptr};
+  const f32   *radius   {nullptr};
+
+  // Reused between updates
+  vector<s32> slot;       // slot[i] is where particle 'i' is in 'order', -1 if it isn't
+  vector<s32> new_index;
+  vector<u8>  seen;
+  vector<s32> added;
+  vector<s32> merged;
+};
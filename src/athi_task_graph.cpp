@@ -0,0 +1,160 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+#include "athi_task_graph.h"
+
+#include "athi_profiler.h" // ProfileZone
+
+#include <algorithm> // std::reverse
+#include <cassert> // assert
+#include <cstdio> // snprintf
+
+TaskGraph::Node TaskGraph::add(const char *name, std::function<void()> work)
+{
+  auto node = std::make_unique<NodeData>();
+  node->name = name;
+  node->work = std::move(work);
+  node->graph = this;
+  node->task.run = run_node;
+  node->task.context = node.get();
+  node->task.pending = &pending;
+
+  nodes.emplace_back(std::move(node));
+  path.reserve(nodes.size());
+  return static_cast<Node>(nodes.size() - 1);
+}
+
+void TaskGraph::depend(Node node, Node dependency)
+{
+  // Keeps the nodes in an order where every dependency comes first, which
+  // is also what the serial run and the critical path rely on.
+  assert(dependency < node && "Add the dependency before the node that depends on it.");
+  nodes[node]->dependencies.emplace_back(dependency);
+  nodes[dependency]->dependents.emplace_back(node);
+}
+
+f64 TaskGraph::now() const noexcept
+{
+  return std::chrono::duration<f64, std::milli>(std::chrono::steady_clock::now() - run_start).count();
+}
+
+void TaskGraph::run_node(void *context)
+{
+  auto &node = *static_cast<NodeData *>(context);
+  auto &graph = *node.graph;
+
+  ProfileZone zone(node.name);
+  node.start = graph.now();
+  node.work();
+  node.end = graph.now();
+
+  // The last dependency to finish starts the next stage. This happens before
+  // the task counts as done, so 'pending' can't reach zero with stages left.
+  for (const Node d : node.dependents)
+  {
+    auto &dependent = *graph.nodes[d];
+    if (dependent.waiting_for.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      graph.pool->submit(&dependent.task);
+  }
+}
+
+void TaskGraph::run(Dispatch &dispatch, bool parallel)
+{
+  run_start = std::chrono::steady_clock::now();
+
+  if (!parallel)
+  {
+    for (auto &node : nodes)
+    {
+      ProfileZone zone(node->name);
+      node->start = now();
+      node->work();
+      node->end = now();
+    }
+  }
+  else
+  {
+    pool = &dispatch;
+    roots.clear();
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+      auto &node = *nodes[i];
+      node.waiting_for.store(static_cast<s32>(node.dependencies.size()), std::memory_order_relaxed);
+      if (node.dependencies.empty()) roots.emplace_back(static_cast<Node>(i));
+    }
+    pending.store(static_cast<s32>(nodes.size()), std::memory_order_relaxed);
+
+    for (const Node r : roots) dispatch.submit(&nodes[r]->task);
+    dispatch.wait(pending);
+  }
+
+  total_time = now();
+  find_critical_path(parallel);
+}
+
+void TaskGraph::find_critical_path(bool parallel)
+{
+  path.clear();
+  if (nodes.empty()) return;
+
+  // One after the other, every stage is on the path
+  if (!parallel)
+  {
+    for (const auto &node : nodes) path.push_back({node->name, node->start, node->end});
+    return;
+  }
+
+  // Start from the stage that ended last and keep stepping back to whichever
+  // dependency ended last, since that's the one it was waiting on.
+  Node current = 0;
+  for (size_t i = 1; i < nodes.size(); ++i)
+    if (nodes[i]->end > nodes[current]->end) current = static_cast<Node>(i);
+
+  while (current >= 0)
+  {
+    const auto &node = *nodes[current];
+    path.push_back({node.name, node.start, node.end});
+
+    Node previous = -1;
+    for (const Node d : node.dependencies)
+      if (previous < 0 || nodes[d]->end > nodes[previous]->end) previous = d;
+    current = previous;
+  }
+
+  std::reverse(path.begin(), path.end());
+}
+
+std::string TaskGraph::critical_path_string() const
+{
+  std::string result;
+  f64 busy = 0.0;
+  char buffer[64];
+  for (const auto &stage : path)
+  {
+    if (!result.empty()) result += " > ";
+    std::snprintf(buffer, sizeof(buffer), "%s %.2f", stage.name, stage.end - stage.start);
+    result += buffer;
+    busy += stage.end - stage.start;
+  }
+  std::snprintf(buffer, sizeof(buffer), " (%.2f of %.2fms)", busy, total_time);
+  result += buffer;
+  return result;
+}
@@ -22,97 +22,223 @@
 #pragma once
 
 #include "athi_typedefs.h"
-#include "./Renderer/athi_rect.h"  // draw_rect, Rect
+#include "./Renderer/athi_rect.h"  // draw_rect
 
-template <class T>
-class UniformGrid {
- protected:
-  static vector<T> data;
+#include <cmath> // std::ceil, std::sqrt
 
- private:
-  struct Node : public UniformGrid {
-    Rect bounds;
-    vector<s32> index;
-    Node(const Rect &r) noexcept : bounds{r} {}
-    void insert(s32 id) noexcept { index.emplace_back(id); }
-    void get(vector<vector<s32>> &cont) const noexcept { cont.emplace_back(index); }
-    void draw_bounds(const vec4& color) const noexcept { draw_rect(bounds.min, bounds.max, color, true); }
-    bool contains(s32 id) const noexcept { return bounds.contains(this->data[id].pos, this->data[id].radius); }
-  };
+// A uniform grid over the SoA particle arrays.
+//
+// Each particle is binned by its center with a two-pass counting sort, so a
+// cell is just a range in 'indices'. The cell size is at least twice the
+// largest radius, which means overlapping particles are always in the same
+// or in adjacent cells. That only holds for the positions it was built
+// from, there's no room for motion, so build it right before testing.
+class UniformGrid
+{
+public:
 
+  // Upper bound on the number of cells. The cell size grows to stay under it.
+  s32 max_cells {1 << 20};
 
- public:
+  s32 cells_x   {0};
+  s32 cells_y   {0};
+  f32 cell_size {0.0f};
+
+  vector<u32> cell_start; // Offset into 'indices' for each cell
+  vector<u32> cell_count; // Number of particles in each cell
+  vector<s32> indices;    // Particle indices, grouped by cell
 
   UniformGrid() = default;
 
-  vector<Node> nodes;
+  // Sets new bounds and throws away the previous grid. Keeps all storage.
+  void reset(const vec2 &min, const vec2 &max) noexcept
+  {
+    this->min = min;
+    this->max = max;
+    cells_x = cells_y = 0;
+    cell_start.clear();
+    cell_count.clear();
+    indices.clear();
+  }
 
-  void init(const vec2& min, const vec2& max, s32 parts) noexcept {
-    nodes.clear();
+  void set_data(const vec2 *position, const f32 *radius) noexcept
+  {
+    this->position = position;
+    this->radius = radius;
+  }
 
-    const f32 sqrtGrid = sqrt(parts);
-    const f32 col = max.x / sqrtGrid;
-    const f32 row = max.y / sqrtGrid;
+  void input_range(s32 begin, s32 end) noexcept
+  {
+    cells_x = cells_y = 0;
+    cell_start.clear();
+    cell_count.clear();
+    indices.clear();
+
+    if (end <= begin) return;
+
+    max_radius = 0.0f;
+    for (s32 i = begin; i < end; ++i)
+      max_radius = (radius[i] > max_radius) ? radius[i] : max_radius;
+
+    // Pick the cell size from the largest particle, then grow it until
+    // the grid fits in 'max_cells'.
+    const vec2 extent = max - min;
+    cell_size = (2.0f * max_radius > 1e-3f) ? 2.0f * max_radius : 1e-3f;
+    for (;;)
+    {
+      const f32 cx = std::ceil(extent.x / cell_size);
+      const f32 cy = std::ceil(extent.y / cell_size);
+      cells_x = (cx > 1.0f) ? static_cast<s32>(cx) : 1;
+      cells_y = (cy > 1.0f) ? static_cast<s32>(cy) : 1;
+
+      const f64 total = static_cast<f64>(cells_x) * static_cast<f64>(cells_y);
+      if (total <= max_cells) break;
+      cell_size *= static_cast<f32>(std::sqrt(total / max_cells)) * 1.01f;
+    }
+    inv_cell_size = 1.0f / cell_size;
+
+    const size_t cells = static_cast<size_t>(cells_x) * cells_y;
+    cell_count.assign(cells, 0);
+    cell_start.resize(cells);
+
+    // Histogram..
+    cell_of.resize(end - begin);
+    for (s32 i = begin; i < end; ++i)
+    {
+      const u32 c = cell_index(position[i]);
+      cell_of[i - begin] = c;
+      ++cell_count[c];
+    }
 
-    for (f32 y = min.y; y < max.y; y += row) {
-      for (f32 x = min.x; x < max.x; x += col) {
-        Rect bounds(vec2(x, y), vec2(x + col, y + row));
-        nodes.emplace_back(bounds);
-      }
+    // ..prefix sum..
+    u32 offset = 0;
+    cursor.resize(cells);
+    for (size_t c = 0; c < cells; ++c)
+    {
+      cell_start[c] = offset;
+      cursor[c] = offset;
+      offset += cell_count[c];
     }
-  };
 
-  void set_data(const vector<T> &objects) noexcept {
-    data = objects;
+    // ..and scatter.
+    indices.resize(offset);
+    for (s32 i = begin; i < end; ++i)
+      indices[cursor[cell_of[i - begin]]++] = i;
+  }
+
+  size_t cell_total() const noexcept
+  {
+    return cell_count.size();
   }
 
-  void multithreaded_input(size_t begin, size_t end) noexcept {
-    for (size_t i = begin; i < end; ++i) {
-      const auto id = this->data[i].id;
-      for (auto &node : nodes) {
-        if (node.contains(id)) {
-          node.insert(id);
-        }
+  // Calls 'f(a, b)' once for every pair of particles that share a cell or sit
+  // in adjacent cells, for the cells [begin, end). Only half of the 3x3
+  // neighbourhood is visited (E, NW, N, NE), so no pair is seen twice.
+  template <class F>
+  void for_each_pair(size_t begin, size_t end, F &&f) const noexcept
+  {
+    constexpr s32 offsets[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+    for (size_t c = begin; c < end; ++c)
+    {
+      const u32 count = cell_count[c];
+      if (count == 0) continue;
+
+      const s32 *a = indices.data() + cell_start[c];
+      const s32 x = static_cast<s32>(c % cells_x);
+      const s32 y = static_cast<s32>(c / cells_x);
+
+      for (u32 i = 0; i < count; ++i)
+        for (u32 j = i + 1; j < count; ++j)
+          f(a[i], a[j]);
+
+      for (const auto &o: offsets)
+      {
+        const s32 nx = x + o[0];
+        const s32 ny = y + o[1];
+        if (nx < 0 || nx >= cells_x || ny >= cells_y) continue;
+
+        const size_t n = static_cast<size_t>(ny) * cells_x + nx;
+        const u32 n_count = cell_count[n];
+        const s32 *b = indices.data() + cell_start[n];
+
+        for (u32 i = 0; i < count; ++i)
+          for (u32 j = 0; j < n_count; ++j)
+            f(a[i], b[j]);
       }
     }
   }
 
-  void input(const vector<T> &objects) noexcept {
-    data = objects;
-    for (const auto &obj : data) {
-      const auto id = obj.id;
-      for (auto &node : nodes) {
-        if (node.contains(id)) {
-          node.insert(id);
-        }
+  void get_neighbours(vector<vector<s32>> &cont, const vec2 &position, f32 radius) const noexcept
+  {
+    if (cell_count.empty()) return;
+
+    // Particles are binned by center, so reach out by the largest radius too.
+    const f32 reach = radius + max_radius;
+    const s32 x0 = cell_coord((position.x - reach - min.x) * inv_cell_size, cells_x);
+    const s32 x1 = cell_coord((position.x + reach - min.x) * inv_cell_size, cells_x);
+    const s32 y0 = cell_coord((position.y - reach - min.y) * inv_cell_size, cells_y);
+    const s32 y1 = cell_coord((position.y + reach - min.y) * inv_cell_size, cells_y);
+
+    for (s32 y = y0; y <= y1; ++y)
+    {
+      for (s32 x = x0; x <= x1; ++x)
+      {
+        const size_t c = static_cast<size_t>(y) * cells_x + x;
+        if (cell_count[c] == 0) continue;
+        const s32 *data = indices.data() + cell_start[c];
+        cont.emplace_back(data, data + cell_count[c]);
       }
     }
   }
-  void draw_bounds(const vec4& color) const noexcept {
-    for (const auto &node : nodes) {
-      node.draw_bounds(color);
+
+  void get(vector<vector<s32>> &cont) const noexcept
+  {
+    for (size_t c = 0; c < cell_count.size(); ++c)
+    {
+      if (cell_count[c] == 0) continue;
+      const s32 *data = indices.data() + cell_start[c];
+      cont.emplace_back(data, data + cell_count[c]);
     }
   }
 
-  void get_neighbours(vector<vector<s32>> &cont, const T& p) const noexcept {
-    for (const auto &node : nodes) {
-      if (node.bounds.contains(p.pos, p.radius)) {
-        node.get(cont);
-      }
+  void draw_bounds(bool show_occupied_only, const vec4 &color) const noexcept
+  {
+    for (size_t c = 0; c < cell_count.size(); ++c)
+    {
+      if (show_occupied_only && cell_count[c] == 0) continue;
+      const vec2 cell_min = min + vec2(c % cells_x, c / cells_x) * cell_size;
+      draw_rect(cell_min, cell_min + cell_size, color, true);
     }
   }
 
-  void get(vector<vector<s32>> &cont) const noexcept {
-    for (const auto &node : nodes) {
-      node.get(cont);
-    }
+private:
+
+  const vec2  *position {nullptr};
+  const f32   *radius   {nullptr};
+
+  vec2 min {0.0f, 0.0f};
+  vec2 max {0.0f, 0.0f};
+
+  f32 max_radius    {0.0f};
+  f32 inv_cell_size {0.0f};
+
+  // Scratch buffers kept around to avoid reallocating every frame
+  vector<u32> cell_of;
+  vector<u32> cursor;
+
+  // Clamps so particles outside the bounds land in the border cells.
+  static s32 cell_coord(f32 v, s32 cells) noexcept
+  {
+    if (v < 0.0f) return 0;
+    if (v >= static_cast<f32>(cells)) return cells - 1;
+    return static_cast<s32>(v);
   }
-  void reset() noexcept {
-    for (auto &node : nodes) {
-      node.index.clear();
-    }
+
+  u32 cell_index(const vec2 &p) const noexcept
+  {
+    const s32 x = cell_coord((p.x - min.x) * inv_cell_size, cells_x);
+    const s32 y = cell_coord((p.y - min.y) * inv_cell_size, cells_y);
+    return static_cast<u32>(y * cells_x + x);
   }
 };
-
-template <class T>
-vector<T> UniformGrid<T>::data;
@@ -36,10 +36,11 @@
 #endif
 
 #if __linux__
-  #include <linux/sysctl.h>
+  #include <sys/stat.h> // stat
   #include <unistd.h>
 #endif
 
+#include <chrono> // steady_clock
 #include <cstring> // strcpy
 #include <fstream> // ifstream
 #include <sstream> // istreambuf_iterator
@@ -63,7 +64,12 @@ vec4 rand_vec4(f32 min, f32 max) noexcept
 
 f64 get_time() noexcept
 {
+#ifdef ATHI_HEADLESS
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration<f64>(std::chrono::steady_clock::now() - start).count();
+#else
   return glfwGetTime();
+#endif
 }
 
 vec4 rgb_to_hsv(vec4 in) noexcept
@@ -243,7 +249,7 @@ string get_content_of_file(const string& file) noexcept
 void limit_FPS(u32 desired_framerate, f64 time_start_frame) noexcept
 {
   const f64 frametime = (1000.0 / desired_framerate);
-  f64 time_spent_frame = (glfwGetTime() - time_start_frame) * 1000.0;
+  f64 time_spent_frame = (get_time() - time_start_frame) * 1000.0;
   const f64 time_to_sleep = (frametime - time_spent_frame) * 0.7;
 
   if (time_to_sleep > 0.0) {
@@ -259,7 +265,7 @@ void limit_FPS(u32 desired_framerate, f64 time_start_frame) noexcept
 #endif
     }
     while (time_spent_frame < frametime) {
-      time_spent_frame = (glfwGetTime() - time_start_frame) * 1000.0;
+      time_spent_frame = (get_time() - time_start_frame) * 1000.0;
     }
   }
 }
@@ -299,12 +305,22 @@ string get_cpu_brand()
   }
   // string includes manufacturer, model and clockspeed
   return string(CPUBrandString);
-#else
+#elif __APPLE__
   char buffer[128];
   size_t bufferlen = 128;
 
   sysctlbyname("machdep.cpu.brand_string", &buffer, &bufferlen, NULL, 0);
   return string(buffer);
+#else
+  std::ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (std::getline(cpuinfo, line))
+  {
+    if (line.compare(0, 10, "model name") != 0) continue;
+    const auto colon = line.find(':');
+    if (colon != string::npos) return line.substr(colon + 2);
+  }
+  return "unknown";
 #endif
 }
 
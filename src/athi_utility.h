@@ -25,8 +25,10 @@
 #include "athi_settings.h"
 #include "Utility/fixed_size_types.h" // u32, f32, etc.
 
+#ifndef ATHI_HEADLESS
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>  // glfwGetTime
+#endif
 
 #include <vector> // std::vector
 #include <string> // std::string
@@ -41,6 +43,10 @@ using glm::vec4;
 
 #include <cstdlib>  // rand
 
+#ifdef _MSC_VER
+#include <intrin.h> // _BitScanForward64
+#endif
+
 /* FOREGROUND */
 #define RST "\x1B[0m"
 #define KRED "\x1B[31m"
@@ -68,7 +74,7 @@ vec2 rand_vec2(f32 min, f32 max) noexcept;
 vec3 rand_vec3(f32 min, f32 max) noexcept;
 vec4 rand_vec4(f32 min, f32 max) noexcept;
 
-// Returns the time in ns
+// Returns the time in seconds. Headless builds have no GLFW and use steady_clock.
 f64 get_time() noexcept;
 
 
@@ -82,6 +88,17 @@ static std::tuple<T,T> get_begin_and_end(s32 i, T container_size, s32 threads) n
   return std::tuple<T, T>{begin, end};
 }
 
+// Index of the lowest set bit. 'x' must not be zero.
+inline u32 count_trailing_zeros(u64 x) noexcept {
+#ifdef _MSC_VER
+  unsigned long index;
+  _BitScanForward64(&index, x);
+  return static_cast<u32>(index);
+#else
+  return static_cast<u32>(__builtin_ctzll(x));
+#endif
+}
+
 // Color functions
 vec4 hsv_to_rgb(s32 h, f32 s, f32 v, f32 a) noexcept;
 vec4 rgb_to_hsv(vec4 in) noexcept;
@@ -221,12 +221,6 @@ void framebuffer_size_callback(GLFWwindow *window, s32 width, s32 height) {
     }
   });
 
-  // @Hack
-  if (uniformgrid_parts != 4)
-    uniformgrid_parts = 4;
-  else
-    uniformgrid_parts = 16;
-
   {
     s32 w, h;
     glfwGetWindowSize(window, &w, &h);
@@ -0,0 +1,492 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+// Runs scene files headless and writes how long every stage took as JSON.
+//
+//   athi_bench --out before.json tools/scenes/*.scene
+//   athi_bench --set quadtree_depth=8 --set quadtree_capacity=50 tools/scenes/dense.scene
+//
+// A scene is a list of 'name : value' lines, like the config. See
+// tools/scenes/ for every key. '--set' overrides a key in every scene, so
+// the same scenes can be run with different settings and the results diffed.
+//
+//   athi_bench --micro narrowphase --micro dispatch
+//   athi_bench --micro all
+//
+// '--micro' runs the benchmarks of athi_benchmark.h instead, which print
+// their results to the console.
+//
+//   athi_bench --check all
+//
+// '--check' runs the correctness checks of athi_benchmark.h and exits with
+// 1 if any of them fails.
+
+#include "athi_headless.h"
+
+#include "athi_benchmark.h" // micro_benchmarks, correctness_checks
+
+#include "athi_dispatch.h" // dispatch, physical_core_count
+#include "athi_narrowphase.h" // get_narrowphase_name
+#include "athi_particle.h" // particle_system
+#include "athi_settings.h" // frame_stats, frame_times, tree_type, etc.
+#include "athi_utility.h" // get_time, get_cpu_brand, split_string, eat_chars
+#include "Utility/console.h" // console
+
+#include <algorithm> // std::sort
+#include <cmath> // std::ceil
+#include <cstdio> // fopen, fprintf
+#include <cstdlib> // strtol, strtof
+#include <cstring> // strcmp
+
+struct BenchScene
+{
+  string        name;
+  string        file;
+  HeadlessScene spawn;
+  f32           gravity             {0.0f};
+  bool          gravitational_force {false};
+  bool          barnes_hut          {false};
+  TreeType      tree                {TreeType::Quadtree};
+  s32           threads             {0};  // 0 uses every physical core
+  s32           physics_samples     {1};
+  s32           quadtree_depth      {10};
+  s32           quadtree_capacity   {100};
+  s32           reorder_interval    {60};
+  u32           warmup_frames       {60};
+  u32           frames              {300};
+  f32           dt                  {1.0f / 60.0f};
+};
+
+// Every frame of the measured part of a run.
+struct BenchResult
+{
+  vector<f64>         frame_ms;
+  vector<StageTimes>  stages;
+  StatTotals          stat_sums;
+};
+
+static const char *tree_name(TreeType tree) noexcept
+{
+  switch (tree)
+  {
+    case TreeType::Quadtree:      return "quadtree";
+    case TreeType::UniformGrid:   return "uniformgrid";
+    case TreeType::SweepAndPrune: return "sweep_and_prune";
+    case TreeType::None:          return "none";
+  }
+  return "";
+}
+
+static bool parse_bool(const string &value, bool &out) noexcept
+{
+  if      (value == "yes" || value == "YES" || value == "true" || value == "on")  out = true;
+  else if (value == "no" || value == "NO" || value == "false" || value == "off")  out = false;
+  else return false;
+  return true;
+}
+
+static bool parse_number(const string &value, f32 &out) noexcept
+{
+  char *end = nullptr;
+  out = std::strtof(value.c_str(), &end);
+  return end != value.c_str() && *end == '\0';
+}
+
+template <class T>
+static bool parse_number(const string &value, T &out) noexcept
+{
+  char *end = nullptr;
+  const long long v = std::strtoll(value.c_str(), &end, 10);
+  if (end == value.c_str() || *end != '\0' || v < 0) return false;
+  out = static_cast<T>(v);
+  return true;
+}
+
+// Sets one key of 'scene'. Returns false if the key or the value is unknown.
+static bool set_scene_value(BenchScene &scene, const string &key, const string &value) noexcept
+{
+  auto &spawn = scene.spawn;
+
+  if (key == "name")                    { scene.name = remove_quotes(value); return true; }
+  if (key == "particles")               return parse_number(value, spawn.particles);
+  if (key == "radius")                  return parse_number(value, spawn.radius);
+  if (key == "radius_max")              return parse_number(value, spawn.radius_max);
+  if (key == "speed")                   return parse_number(value, spawn.speed);
+  if (key == "width")                   return parse_number(value, spawn.width);
+  if (key == "height")                  return parse_number(value, spawn.height);
+  if (key == "seed")                    return parse_number(value, spawn.seed);
+  if (key == "gravity")                 return parse_number(value, scene.gravity);
+  if (key == "gravitational_force")     return parse_bool(value, scene.gravitational_force);
+  if (key == "barnes_hut")              return parse_bool(value, scene.barnes_hut);
+  if (key == "threads")                 return parse_number(value, scene.threads);
+  if (key == "physics_samples")         return parse_number(value, scene.physics_samples);
+  if (key == "quadtree_depth")          return parse_number(value, scene.quadtree_depth);
+  if (key == "quadtree_capacity")       return parse_number(value, scene.quadtree_capacity);
+  if (key == "reorder_interval")        return parse_number(value, scene.reorder_interval);
+  if (key == "warmup_frames")           return parse_number(value, scene.warmup_frames);
+  if (key == "frames")                  return parse_number(value, scene.frames);
+  if (key == "dt")                      return parse_number(value, scene.dt);
+
+  if (key == "shape")
+  {
+    if      (value == "point")      spawn.shape = EmitterShape::Point;
+    else if (value == "disc")       spawn.shape = EmitterShape::Disc;
+    else if (value == "rectangle")  spawn.shape = EmitterShape::Rectangle;
+    else if (value == "grid")       spawn.shape = EmitterShape::Grid;
+    else return false;
+    return true;
+  }
+
+  if (key == "tree_type")
+  {
+    for (const auto tree : {TreeType::Quadtree, TreeType::UniformGrid, TreeType::SweepAndPrune, TreeType::None})
+    {
+      if (value == tree_name(tree))
+      {
+        scene.tree = tree;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  return false;
+}
+
+// 'line' is 'key : value' or 'key=value' with the spaces already gone.
+static bool set_scene_line(BenchScene &scene, const string &line) noexcept
+{
+  const auto split = line.find_first_of(":=");
+  if (split == string::npos)
+  {
+    console->error("[Bench] expected 'key : value', got '{}'", line);
+    return false;
+  }
+
+  const string key = line.substr(0, split);
+  const string value = line.substr(split + 1);
+  if (!set_scene_value(scene, key, value))
+  {
+    console->error("[Bench] bad scene value '{}' for '{}'", value, key);
+    return false;
+  }
+  return true;
+}
+
+static bool load_scene(const string &file, const vector<string> &overrides, BenchScene &scene) noexcept
+{
+  if (!file_exists(file))
+  {
+    console->error("[Bench] no scene file {}", file);
+    return false;
+  }
+
+  scene.file = file;
+  scene.name = file;
+
+  const auto lines = split_string(eat_chars(get_content_of_file(file), {' ', '\t', '\r'}), '\n');
+  for (const auto &line : lines)
+  {
+    if (line.empty() || line[0] == '#') continue;
+    if (!set_scene_line(scene, line)) return false;
+  }
+
+  for (const auto &line : overrides)
+    if (!set_scene_line(scene, line)) return false;
+
+  if (scene.frames == 0 || scene.dt <= 0.0f || scene.spawn.radius <= 0.0f || scene.physics_samples <= 0)
+  {
+    console->error("[Bench] {}: frames, dt, radius and physics_samples must be positive", file);
+    return false;
+  }
+  return true;
+}
+
+static void apply_scene(const BenchScene &scene) noexcept
+{
+  gravity = scene.gravity;
+  use_gravitational_force = scene.gravitational_force;
+  use_barnes_hut = scene.barnes_hut;
+  tree_type = scene.tree;
+  physics_samples = scene.physics_samples;
+  quadtree_depth = scene.quadtree_depth;
+  quadtree_capacity = scene.quadtree_capacity;
+  reorder_interval = scene.reorder_interval;
+
+  // The pool always keeps a worker around, so one thread means not using it.
+  const s32 threads = (scene.threads > 0) ? scene.threads : physical_core_count();
+  use_multithreading = threads > 1;
+  multithreaded_particle_update = threads > 1;
+  if (threads > 1 && dispatch.size() != threads) dispatch.resize(threads);
+
+  particle_system.erase_all();
+  headless_spawn(scene.spawn);
+}
+
+static BenchResult run_scene(const BenchScene &scene) noexcept
+{
+  apply_scene(scene);
+
+  for (u32 frame = 0; frame < scene.warmup_frames; ++frame)
+    headless_step(scene.dt);
+
+  BenchResult result;
+  result.frame_ms.reserve(scene.frames);
+  result.stages.reserve(scene.frames);
+  for (u32 frame = 0; frame < scene.frames; ++frame)
+  {
+    const f64 start = get_time();
+    headless_step(scene.dt);
+    result.frame_ms.emplace_back((get_time() - start) * 1000.0);
+    result.stages.emplace_back(frame_times);
+    for (u32 s = 0; s < kStatCount; ++s) result.stat_sums.values[s] += frame_stats.values[s];
+  }
+  return result;
+}
+
+// Nearest rank
+static f64 percentile(const vector<f64> &sorted, f64 p) noexcept
+{
+  const size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * sorted.size()));
+  return sorted[(rank > 0) ? rank - 1 : 0];
+}
+
+static void write_summary(FILE *out, const char *name, vector<f64> ms, bool last) noexcept
+{
+  std::sort(ms.begin(), ms.end());
+  f64 sum = 0.0;
+  for (const auto v : ms) sum += v;
+
+  std::fprintf(out, "        \"%s\": { \"mean_ms\": %.4f, \"min_ms\": %.4f, \"p50_ms\": %.4f, \"p90_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f }%s\n",
+    name, sum / ms.size(), ms.front(), percentile(ms, 50.0), percentile(ms, 90.0), percentile(ms, 99.0), ms.back(), last ? "" : ",");
+}
+
+static string json_escape(const string &str) noexcept
+{
+  string result;
+  for (const auto c : str)
+  {
+    if (c == '"' || c == '\\') result += '\\';
+    result += c;
+  }
+  return result;
+}
+
+static void write_scene(FILE *out, const BenchScene &scene, const BenchResult &result, bool last) noexcept
+{
+  const auto &spawn = scene.spawn;
+  const s32 threads = use_multithreading ? dispatch.size() : 1;
+
+  std::fprintf(out, "    {\n");
+  std::fprintf(out, "      \"name\": \"%s\",\n", json_escape(scene.name).c_str());
+  std::fprintf(out, "      \"file\": \"%s\",\n", json_escape(scene.file).c_str());
+  std::fprintf(out, "      \"particles\": %u,\n", particle_system.particle_count);
+  std::fprintf(out, "      \"radius\": [%g, %g],\n", spawn.radius, std::max(spawn.radius, spawn.radius_max));
+  std::fprintf(out, "      \"gravity\": %g,\n", scene.gravity);
+  std::fprintf(out, "      \"gravitational_force\": %s,\n", scene.gravitational_force ? (scene.barnes_hut ? "\"barnes_hut\"" : "\"all_pairs\"") : "false");
+  std::fprintf(out, "      \"tree_type\": \"%s\",\n", tree_name(scene.tree));
+  std::fprintf(out, "      \"threads\": %d,\n", threads);
+  std::fprintf(out, "      \"physics_samples\": %d,\n", scene.physics_samples);
+  std::fprintf(out, "      \"quadtree_depth\": %d,\n", scene.quadtree_depth);
+  std::fprintf(out, "      \"quadtree_capacity\": %d,\n", scene.quadtree_capacity);
+  std::fprintf(out, "      \"warmup_frames\": %u,\n", scene.warmup_frames);
+  std::fprintf(out, "      \"frames\": %u,\n", scene.frames);
+  std::fprintf(out, "      \"dt\": %g,\n", scene.dt);
+
+  const f64 frames = static_cast<f64>(scene.frames);
+  std::fprintf(out, "      \"per_frame\": { \"candidate_pairs\": %.1f, \"narrowphase_hits\": %.1f, \"resolved_contacts\": %.1f },\n",
+    result.stat_sums[Stat::CandidatePairs] / frames,
+    result.stat_sums[Stat::NarrowphaseHits] / frames,
+    result.stat_sums[Stat::ResolvedContacts] / frames);
+
+  std::fprintf(out, "      \"timings\": {\n");
+  write_summary(out, "frame", result.frame_ms, false);
+  for (u32 s = 0; s < kStageCount; ++s)
+  {
+    vector<f64> ms;
+    ms.reserve(result.stages.size());
+    for (const auto &stages : result.stages) ms.emplace_back(stages.seconds[s] * 1000.0);
+    write_summary(out, stage_name(static_cast<Stage>(s)), std::move(ms), s + 1 == kStageCount);
+  }
+  std::fprintf(out, "      }\n");
+  std::fprintf(out, "    }%s\n", last ? "" : ",");
+}
+
+static void print_usage() noexcept
+{
+  std::printf(
+    "usage: athi_bench [options] scene...\n"
+    "  --out FILE            where the results go (athi_bench.json)\n"
+    "  --set KEY=VALUE       override a scene key in every scene\n"
+    "  --micro NAME          run a micro benchmark instead, or 'all' of them:\n");
+  for (const auto &benchmark : micro_benchmarks)
+    std::printf("                          %s\n", benchmark.name);
+  std::printf(
+    "  --check NAME          run a correctness check instead, or 'all' of them:\n");
+  for (const auto &check : correctness_checks)
+    std::printf("                          %s\n", check.name);
+}
+
+// Runs the named micro benchmarks, in the order given. Returns false on an unknown name.
+static bool run_micro_benchmarks(const vector<string> &names) noexcept
+{
+  for (const auto &name : names)
+  {
+    if (name == "all") continue;
+    bool known = false;
+    for (const auto &benchmark : micro_benchmarks) known |= (name == benchmark.name);
+    if (!known)
+    {
+      console->error("[Bench] no micro benchmark named '{}'", name);
+      return false;
+    }
+  }
+
+  for (const auto &name : names)
+  {
+    for (const auto &benchmark : micro_benchmarks)
+    {
+      if (name != "all" && name != benchmark.name) continue;
+      console->info("[Bench] {}", benchmark.name);
+      benchmark.run();
+    }
+  }
+  return true;
+}
+
+// Runs the named checks, in the order given. Returns false on an unknown
+// name or if any of them fails.
+static bool run_checks(const vector<string> &names) noexcept
+{
+  for (const auto &name : names)
+  {
+    if (name == "all") continue;
+    bool known = false;
+    for (const auto &check : correctness_checks) known |= (name == check.name);
+    if (!known)
+    {
+      console->error("[Bench] no check named '{}'", name);
+      return false;
+    }
+  }
+
+  bool passed = true;
+  for (const auto &name : names)
+  {
+    for (const auto &check : correctness_checks)
+    {
+      if (name != "all" && name != check.name) continue;
+      const bool ok = check.run();
+      if (ok) console->info("[Bench] {}: passed", check.name);
+      else    console->error("[Bench] {}: FAILED", check.name);
+      passed &= ok;
+    }
+  }
+  return passed;
+}
+
+int main(int argc, char **argv)
+{
+  string out_path = "athi_bench.json";
+  vector<string> overrides;
+  vector<string> files;
+  vector<string> micro;
+  vector<string> checks;
+  for (s32 i = 1; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0)
+    {
+      print_usage();
+      return 0;
+    }
+
+    const bool takes_value = std::strcmp(arg, "--out") == 0 || std::strcmp(arg, "--set") == 0 ||
+                             std::strcmp(arg, "--micro") == 0 || std::strcmp(arg, "--check") == 0;
+    if (takes_value && i + 1 == argc)
+    {
+      std::fprintf(stderr, "%s needs a value\n", arg);
+      return 1;
+    }
+
+    if      (std::strcmp(arg, "--out") == 0)  out_path = argv[++i];
+    else if (std::strcmp(arg, "--set") == 0)  overrides.emplace_back(eat_chars(argv[++i], {' ', '\t'}));
+    else if (std::strcmp(arg, "--micro") == 0) micro.emplace_back(argv[++i]);
+    else if (std::strcmp(arg, "--check") == 0) checks.emplace_back(argv[++i]);
+    else if (arg[0] == '-')
+    {
+      std::fprintf(stderr, "unknown option '%s'\n", arg);
+      print_usage();
+      return 1;
+    }
+    else files.emplace_back(arg);
+  }
+
+  if (files.empty() && micro.empty() && checks.empty())
+  {
+    print_usage();
+    return 1;
+  }
+
+  headless_init(false);
+
+  if (!checks.empty() || !micro.empty())
+  {
+    const bool passed = run_checks(checks);
+    return run_micro_benchmarks(micro) && passed ? 0 : 1;
+  }
+
+  // Load them all up front, so a typo doesn't show up halfway through a long run
+  vector<BenchScene> scenes(files.size());
+  for (size_t i = 0; i < files.size(); ++i)
+    if (!load_scene(files[i], overrides, scenes[i])) return 1;
+
+  FILE *out = std::fopen(out_path.c_str(), "w");
+  if (!out)
+  {
+    console->error("[Bench] couldn't open {}", out_path);
+    return 1;
+  }
+
+  std::fprintf(out, "{\n");
+  std::fprintf(out, "  \"cpu\": \"%s\",\n", json_escape(get_cpu_brand()).c_str());
+  std::fprintf(out, "  \"narrowphase\": \"%s\",\n", get_narrowphase_name());
+  std::fprintf(out, "  \"scenes\": [\n");
+
+  for (size_t i = 0; i < scenes.size(); ++i)
+  {
+    const auto &scene = scenes[i];
+    console->info("[Bench] {}: {} particles, {} + {} frames", scene.name, scene.spawn.particles, scene.warmup_frames, scene.frames);
+
+    const f64 start = get_time();
+    const auto result = run_scene(scene);
+    console->info("[Bench] {}: {:.2f}s", scene.name, get_time() - start);
+
+    write_scene(out, scene, result, i + 1 == scenes.size());
+    std::fflush(out);
+  }
+
+  std::fprintf(out, "  ]\n}\n");
+  std::fclose(out);
+
+  console->info("[Bench] wrote {}", out_path);
+  return 0;
+}
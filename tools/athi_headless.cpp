@@ -0,0 +1,201 @@
+// Copyright (c) 2018 Marcus Mathiassen
+
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+// FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+// DEALINGS IN THE SOFTWARE.
+
+
+// Steps the simulation without a window and writes what it did to disk.
+//
+//   athi_headless --frames 600 --particles 50000 --stats stats.csv --snapshots out/frame --snapshot-every 60
+//
+// Snapshots are written as '<prefix>_<frame>.snap', see write_snapshot for the format.
+
+#include "athi_headless.h"
+
+#include "athi_particle.h" // particle_system
+#include "athi_profiler.h" // profiler_capture
+#include "athi_settings.h" // frame_stats
+#include "athi_utility.h" // get_time
+#include "Utility/console.h" // console
+
+#include <cstdio> // fopen, fprintf
+#include <cstdlib> // strtol, strtod
+#include <cstring> // strcmp
+
+struct Options
+{
+  HeadlessScene scene;
+  u32           frames          {600};
+  f32           dt              {1.0f / 60.0f};
+  u32           snapshot_every  {0};  // 0 writes none
+  string        snapshot_prefix {"snapshot"};
+  string        stats_path;           // Empty writes none
+  string        trace_path;           // Empty captures no trace
+  u32           trace_frames    {0};  // 0 traces every frame
+};
+
+static void print_usage() noexcept
+{
+  std::printf(
+    "usage: athi_headless [options]\n"
+    "  --frames N            frames to simulate (600)\n"
+    "  --dt SECONDS          length of a frame (1/60)\n"
+    "  --particles N         particles to spawn (100000)\n"
+    "  --radius R            particle radius (1)\n"
+    "  --radius-max R        radii are uniform in [radius, R] if it's larger\n"
+    "  --speed S             largest starting speed (0)\n"
+    "  --shape NAME          point, disc, rectangle or grid (rectangle)\n"
+    "  --width W             width of the box (1920)\n"
+    "  --height H            height of the box (1080)\n"
+    "  --seed N              spawn seed (1)\n"
+    "  --snapshot-every N    write a snapshot every N frames (never)\n"
+    "  --snapshots PREFIX    snapshot file prefix (snapshot)\n"
+    "  --stats FILE          per frame stats as csv\n"
+    "  --trace FILE          write a Chrome trace of the run, see athi_profiler.h\n"
+    "  --trace-frames N      only trace the first N frames (all)\n");
+}
+
+static bool parse_shape(const char *name, EmitterShape &shape) noexcept
+{
+  if      (std::strcmp(name, "point") == 0)     shape = EmitterShape::Point;
+  else if (std::strcmp(name, "disc") == 0)      shape = EmitterShape::Disc;
+  else if (std::strcmp(name, "rectangle") == 0) shape = EmitterShape::Rectangle;
+  else if (std::strcmp(name, "grid") == 0)      shape = EmitterShape::Grid;
+  else return false;
+  return true;
+}
+
+static bool parse_options(s32 argc, char **argv, Options &options) noexcept
+{
+  for (s32 i = 1; i < argc; ++i)
+  {
+    const char *arg = argv[i];
+    if (std::strcmp(arg, "--help") == 0 || std::strcmp(arg, "-h") == 0) return false;
+    if (i + 1 == argc)
+    {
+      std::fprintf(stderr, "%s needs a value\n", arg);
+      return false;
+    }
+    const char *value = argv[++i];
+
+    if      (std::strcmp(arg, "--frames") == 0)         options.frames = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(arg, "--dt") == 0)             options.dt = std::strtof(value, nullptr);
+    else if (std::strcmp(arg, "--particles") == 0)      options.scene.particles = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(arg, "--radius") == 0)         options.scene.radius = std::strtof(value, nullptr);
+    else if (std::strcmp(arg, "--radius-max") == 0)     options.scene.radius_max = std::strtof(value, nullptr);
+    else if (std::strcmp(arg, "--speed") == 0)          options.scene.speed = std::strtof(value, nullptr);
+    else if (std::strcmp(arg, "--width") == 0)          options.scene.width = std::strtol(value, nullptr, 10);
+    else if (std::strcmp(arg, "--height") == 0)         options.scene.height = std::strtol(value, nullptr, 10);
+    else if (std::strcmp(arg, "--seed") == 0)           options.scene.seed = std::strtoull(value, nullptr, 10);
+    else if (std::strcmp(arg, "--snapshot-every") == 0) options.snapshot_every = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(arg, "--snapshots") == 0)      options.snapshot_prefix = value;
+    else if (std::strcmp(arg, "--stats") == 0)          options.stats_path = value;
+    else if (std::strcmp(arg, "--trace") == 0)          options.trace_path = value;
+    else if (std::strcmp(arg, "--trace-frames") == 0)   options.trace_frames = std::strtoul(value, nullptr, 10);
+    else if (std::strcmp(arg, "--shape") == 0)
+    {
+      if (!parse_shape(value, options.scene.shape))
+      {
+        std::fprintf(stderr, "unknown shape '%s'\n", value);
+        return false;
+      }
+    }
+    else
+    {
+      std::fprintf(stderr, "unknown option '%s'\n", arg);
+      return false;
+    }
+  }
+
+  if (options.dt <= 0.0f || options.scene.radius <= 0.0f || options.scene.width <= 0 || options.scene.height <= 0)
+  {
+    std::fprintf(stderr, "--dt, --radius, --width and --height must be positive\n");
+    return false;
+  }
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  Options options;
+  if (!parse_options(argc, argv, options))
+  {
+    print_usage();
+    return 1;
+  }
+
+  headless_init();
+  headless_spawn(options.scene);
+
+  FILE *stats = nullptr;
+  if (!options.stats_path.empty())
+  {
+    stats = std::fopen(options.stats_path.c_str(), "w");
+    if (!stats)
+    {
+      console->error("[Headless] couldn't open {}", options.stats_path);
+      return 1;
+    }
+    std::fprintf(stats, "frame,particles,ms,candidate_pairs,narrowphase_hits,resolved_contacts,duplicate_pairs,leaves,max_leaf_occupancy\n");
+  }
+
+  console->info("[Headless] {} frames of {} particles, dt {}", options.frames, options.scene.particles, options.dt);
+
+  if (!options.trace_path.empty())
+    profiler_capture(options.trace_frames ? options.trace_frames : options.frames, options.trace_path);
+
+  bool ok = true;
+  f64 total_time = 0.0;
+  for (u32 frame = 1; frame <= options.frames; ++frame)
+  {
+    const f64 start = get_time();
+    headless_step(options.dt);
+    const f64 elapsed = get_time() - start;
+    total_time += elapsed;
+
+    if (stats)
+    {
+      std::fprintf(stats, "%u,%u,%.4f,%llu,%llu,%llu,%llu,%llu,%llu\n",
+        frame, particle_system.particle_count, elapsed * 1000.0,
+        static_cast<unsigned long long>(frame_stats[Stat::CandidatePairs]),
+        static_cast<unsigned long long>(frame_stats[Stat::NarrowphaseHits]),
+        static_cast<unsigned long long>(frame_stats[Stat::ResolvedContacts]),
+        static_cast<unsigned long long>(frame_stats[Stat::DuplicatePairs]),
+        static_cast<unsigned long long>(frame_stats[Stat::LeafCount]),
+        static_cast<unsigned long long>(frame_stats[Stat::MaxLeafOccupancy]));
+    }
+
+    if (options.snapshot_every && frame % options.snapshot_every == 0)
+    {
+      particle_system.publish_snapshot();
+      const string path = options.snapshot_prefix + "_" + std::to_string(frame) + ".snap";
+      auto &snapshot = particle_system.snapshots.acquire();
+      snapshot.frame = frame;
+      ok = write_snapshot(snapshot, path) && ok;
+    }
+  }
+
+  if (stats) std::fclose(stats);
+
+  const f64 frames = static_cast<f64>(options.frames);
+  console->info("[Headless] {:.3f}s, {:.3f}ms a frame, {:.1f} frames/s, {:.0f} particle steps/s",
+    total_time, total_time / frames * 1000.0, frames / total_time,
+    frames * particle_system.particle_count / total_time);
+
+  return ok ? 0 : 1;
+}